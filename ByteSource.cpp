@@ -0,0 +1,325 @@
+#include "ByteSource.hpp"
+#include <string.h>
+#include <algorithm>
+#include "Instrumentation.hpp"
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+using namespace io;
+
+namespace {
+
+    int openFile(const std::filesystem::path& path) {
+#ifdef _WIN32
+        return _wopen(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+        return ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+    }
+
+    void closeFile(int fd) {
+#ifdef _WIN32
+        _close(fd);
+#else
+        ::close(fd);
+#endif
+    }
+
+    uint64_t fileSize(int fd) {
+#ifdef _WIN32
+        struct _stat64 st;
+        if (_fstat64(fd, &st)) {
+            throw ByteSource::OpenException{};
+        }
+#else
+        struct stat st;
+        if (fstat(fd, &st)) {
+            throw ByteSource::OpenException{};
+        }
+#endif
+        return st.st_size;
+    }
+
+    // reads until n bytes are read, EOF or error
+    size_t preadFull(int fd, uint8_t* dst, size_t n, uint64_t offset) {
+        size_t done = 0;
+        while (done < n) {
+#ifdef _WIN32
+            if (_lseeki64(fd, offset + done, SEEK_SET) < 0) {
+                break;
+            }
+            int res = _read(fd, dst + done, (unsigned)std::min<size_t>(n - done, 1 << 30));
+#else
+            ssize_t res = ::pread(fd, dst + done, n - done, offset + done);
+#endif
+            if (res <= 0) {
+                break;
+            }
+            INSTR_READ(offset + done, res);
+            done += res;
+        }
+        return done;
+    }
+
+}
+
+size_t io::ByteSource::read(void* dst, size_t n) {
+    size_t res = readAt(_pos, dst, n);
+    _pos += res;
+    return res;
+}
+
+io::PreadByteSource::PreadByteSource(const std::filesystem::path& path) {
+    fd = openFile(path);
+    if (fd < 0) {
+        throw OpenException{};
+    }
+    try {
+        _size = fileSize(fd);
+    }
+    catch (...) {
+        closeFile(fd);
+        throw;
+    }
+}
+
+io::PreadByteSource::~PreadByteSource() {
+    if (fd >= 0) {
+        closeFile(fd);
+    }
+}
+
+bool io::PreadByteSource::buffered(uint64_t offset, size_t n) const {
+    return buf && (offset >= bufOffset) && ((offset + n) <= (bufOffset + bufSize));
+}
+
+void io::PreadByteSource::fill(uint64_t offset, size_t n) {
+    size_t len = std::min<uint64_t>(std::max(n, BlockSize), _size - offset);
+    // blocks given away still reference old buffer - can't overwrite it
+    if (!buf || (buf.use_count() > 1) || (bufCapacity < len)) {
+        buf = Block(new uint8_t[len]);
+        bufCapacity = len;
+    }
+    bufOffset = offset;
+    bufSize = preadFull(fd, buf.get(), len, offset);
+}
+
+size_t io::PreadByteSource::readAt(uint64_t offset, void* dst, size_t n) {
+    if (offset >= _size) {
+        return 0;
+    }
+    n = std::min<uint64_t>(n, _size - offset);
+    if (!buffered(offset, n)) {
+        // big reads go directly to destination
+        if (n >= BlockSize) {
+            return preadFull(fd, (uint8_t*)dst, n, offset);
+        }
+        fill(offset, n);
+        n = std::min<uint64_t>(n, bufSize - (offset - bufOffset));
+    }
+    memcpy(dst, buf.get() + (offset - bufOffset), n);
+    return n;
+}
+
+ByteSource::Block io::PreadByteSource::block(uint64_t offset, size_t n) {
+    if ((offset > _size) || (n > (_size - offset))) {
+        return nullptr;
+    }
+    if (!buffered(offset, n)) {
+        fill(offset, n);
+        if (!buffered(offset, n)) {
+            return nullptr;
+        }
+    }
+    return Block(buf, buf.get() + (offset - bufOffset));
+}
+
+void io::PreadByteSource::prefetch(uint64_t offset, size_t n) {
+    if (offset >= _size) {
+        return;
+    }
+    n = std::min<uint64_t>(n, _size - offset);
+    if (!buffered(offset, n)) {
+        fill(offset, n);
+    }
+}
+
+size_t io::PreadByteSource::peekAt(uint64_t offset, void* dst, size_t n) {
+    if (offset >= _size) {
+        return 0;
+    }
+    n = std::min<uint64_t>(n, _size - offset);
+    if (buffered(offset, n)) {
+        memcpy(dst, buf.get() + (offset - bufOffset), n);
+        return n;
+    }
+    return preadFull(fd, (uint8_t*)dst, n, offset);
+}
+
+io::MmapByteSource::MmapByteSource(const std::filesystem::path& path) {
+#ifdef _WIN32
+    (void)path;
+    throw OpenException{};
+#else
+    int fd = openFile(path);
+    if (fd < 0) {
+        throw OpenException{};
+    }
+    try {
+        _size = fileSize(fd);
+    }
+    catch (...) {
+        closeFile(fd);
+        throw;
+    }
+    if (_size) {
+        void* addr = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            closeFile(fd);
+            throw OpenException{};
+        }
+        size_t len = _size;
+        mapping = Block((uint8_t*)addr, [len](uint8_t* p) { munmap(p, len); });
+    }
+    // mapping stays valid after descriptor is closed
+    closeFile(fd);
+#endif
+}
+
+size_t io::MmapByteSource::readAt(uint64_t offset, void* dst, size_t n) {
+    if (offset >= _size) {
+        return 0;
+    }
+    n = std::min<uint64_t>(n, _size - offset);
+    memcpy(dst, mapping.get() + offset, n);
+    return n;
+}
+
+ByteSource::Block io::MmapByteSource::block(uint64_t offset, size_t n) {
+    if ((offset > _size) || (n > (_size - offset)) || !mapping) {
+        return nullptr;
+    }
+    return Block(mapping, mapping.get() + offset);
+}
+
+void io::MmapByteSource::prefetch(uint64_t offset, size_t n) {
+#ifndef _WIN32
+    if (!mapping || (offset >= _size)) {
+        return;
+    }
+    // madvise wants page aligned address
+    static const uint64_t pageSize = sysconf(_SC_PAGESIZE);
+    uint64_t begin = offset & ~(pageSize - 1);
+    n = std::min<uint64_t>(n, _size - offset) + (offset - begin);
+    madvise(mapping.get() + begin, n, MADV_WILLNEED);
+#else
+    (void)offset;
+    (void)n;
+#endif
+}
+
+io::MemoryByteSource::MemoryByteSource(Block data, size_t size)
+    : data{std::move(data)}
+{
+    _size = size;
+}
+
+size_t io::MemoryByteSource::readAt(uint64_t offset, void* dst, size_t n) {
+    if (offset >= _size) {
+        return 0;
+    }
+    n = std::min<uint64_t>(n, _size - offset);
+    memcpy(dst, data.get() + offset, n);
+    return n;
+}
+
+ByteSource::Block io::MemoryByteSource::block(uint64_t offset, size_t n) {
+    if ((offset > _size) || (n > (_size - offset))) {
+        return nullptr;
+    }
+    return Block(data, data.get() + offset);
+}
+
+io::RangeByteSource::RangeByteSource(int fd, uint64_t size)
+    : fd{fd}
+{
+    _size = size;
+}
+
+void io::RangeByteSource::add(uint64_t offset, Block data, size_t n) {
+    if (data && n) {
+        ranges.push_back(Range{offset, n, std::move(data)});
+    }
+}
+
+const io::RangeByteSource::Range* io::RangeByteSource::find(uint64_t offset, size_t n) const {
+    for (const auto& range : ranges) {
+        if ((offset >= range.offset) && ((offset + n) <= (range.offset + range.size))) {
+            return &range;
+        }
+    }
+    return nullptr;
+}
+
+size_t io::RangeByteSource::readAt(uint64_t offset, void* dst, size_t n) {
+    if (offset >= _size) {
+        return 0;
+    }
+    n = std::min<uint64_t>(n, _size - offset);
+    if (const Range* range = find(offset, n)) {
+        memcpy(dst, range->data.get() + (offset - range->offset), n);
+        return n;
+    }
+    return preadFull(fd, (uint8_t*)dst, n, offset);
+}
+
+size_t io::RangeByteSource::peekAt(uint64_t offset, void* dst, size_t n) {
+    if (offset >= _size) {
+        return 0;
+    }
+    n = std::min<uint64_t>(n, _size - offset);
+    if (_deferPeeks && !find(offset, n)) {
+        _deferred.emplace_back(offset, n);
+        return 0;
+    }
+    return readAt(offset, dst, n);
+}
+
+ByteSource::Block io::RangeByteSource::block(uint64_t offset, size_t n) {
+    if ((offset > _size) || (n > (_size - offset))) {
+        return nullptr;
+    }
+    if (const Range* range = find(offset, n)) {
+        return Block(range->data, range->data.get() + (offset - range->offset));
+    }
+    Block res(new uint8_t[n]);
+    if (preadFull(fd, res.get(), n, offset) != n) {
+        return nullptr;
+    }
+    return res;
+}
+
+std::shared_ptr<ByteSource> io::open(const std::filesystem::path& path, Backend backend) {
+    INSTR_PHASE(Open);
+    try {
+#ifndef _WIN32
+        if (backend == Backend::Mmap) {
+            return std::shared_ptr<ByteSource>(new MmapByteSource(path));
+        }
+#else
+        (void)backend;
+#endif
+        return std::shared_ptr<ByteSource>(new PreadByteSource(path));
+    }
+    catch (ByteSource::OpenException&) {
+        return nullptr;
+    }
+}
@@ -0,0 +1,145 @@
+#ifndef BYTESOURCE_HPP
+#define BYTESOURCE_HPP
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <filesystem>
+#include <vector>
+#include <utility>
+
+namespace io {
+
+    /*
+        Random access input for extractors.
+        Keeps a cursor, so sequential code can be written like with std::ifstream (read/seek/tell),
+        but file size is known from open, and positional reads do not move the cursor.
+    */
+    class ByteSource {
+    public:
+        // memory holding requested range; owns (or shares ownership of) underlying buffer
+        using Block = std::shared_ptr<uint8_t[]>;
+
+        class OpenException : public std::exception {};
+
+        virtual ~ByteSource() {}
+
+        // reads at cursor and advances it; returns number of bytes actually read
+        size_t read(void* dst, size_t n);
+        inline void seek(uint64_t pos) { _pos = pos; }
+        inline void skip(uint64_t n) { _pos += n; }
+        inline uint64_t tell() const { return _pos; }
+        inline uint64_t size() const { return _size; }
+        inline uint64_t remaining() const { return _pos < _size ? _size - _pos : 0; }
+        inline bool eof() const { return _pos >= _size; }
+
+        // reads [offset, offset + n) without moving the cursor; returns number of bytes actually read
+        virtual size_t readAt(uint64_t offset, void* dst, size_t n) = 0;
+        // returns memory with [offset, offset + n) or nullptr, if range is out of source
+        virtual Block block(uint64_t offset, size_t n) = 0;
+        // tells that [offset, offset + n) will be read soon, so backend may load it at once
+        virtual void prefetch(uint64_t, size_t) {}
+        /*
+            Reads like readAt, but does not load more than n bytes: for small reads, scattered over the file (bitrate samples),
+            where a buffered block per read would cost much more I/O than the read itself.
+        */
+        virtual size_t peekAt(uint64_t offset, void* dst, size_t n) { return readAt(offset, dst, n); }
+        // false, if some reads were deferred (RangeByteSource) - results of parsing are not final then
+        virtual bool complete() const { return true; }
+    protected:
+        uint64_t _pos = 0;
+        uint64_t _size = 0;
+    };
+
+    /*
+        Reads file with pread into one internal buffer of at least BlockSize bytes.
+        Reads inside of buffered window cost no syscalls.
+    */
+    class PreadByteSource : public ByteSource {
+    public:
+        static constexpr size_t BlockSize = 64 * 1024;
+
+        PreadByteSource(const std::filesystem::path& path);
+        ~PreadByteSource();
+        PreadByteSource(const PreadByteSource&) = delete;
+        PreadByteSource& operator=(const PreadByteSource&) = delete;
+        size_t readAt(uint64_t offset, void* dst, size_t n) override;
+        Block block(uint64_t offset, size_t n) override;
+        void prefetch(uint64_t offset, size_t n) override;
+        size_t peekAt(uint64_t offset, void* dst, size_t n) override;
+    private:
+        bool buffered(uint64_t offset, size_t n) const;
+        void fill(uint64_t offset, size_t n);
+        int fd = -1;
+        Block buf;
+        size_t bufCapacity = 0;
+        uint64_t bufOffset = 0;
+        size_t bufSize = 0;
+    };
+
+    /*
+        Maps whole file into memory. Blocks are views into the mapping.
+    */
+    class MmapByteSource : public ByteSource {
+    public:
+        MmapByteSource(const std::filesystem::path& path);
+        size_t readAt(uint64_t offset, void* dst, size_t n) override;
+        Block block(uint64_t offset, size_t n) override;
+        void prefetch(uint64_t offset, size_t n) override;
+    private:
+        Block mapping;
+    };
+
+    /*
+        Source over bytes, which are in memory already (generated data, embedded files). Blocks are views into data.
+    */
+    class MemoryByteSource : public ByteSource {
+    public:
+        MemoryByteSource(Block data, size_t size);
+        size_t readAt(uint64_t offset, void* dst, size_t n) override;
+        Block block(uint64_t offset, size_t n) override;
+    private:
+        Block data;
+    };
+
+    /*
+        Serves reads from ranges, loaded beforehand (e.g. by asynchronous I/O); reads outside of them go to file with pread.
+        Does not own the descriptor.
+    */
+    class RangeByteSource : public ByteSource {
+    public:
+        RangeByteSource(int fd, uint64_t size);
+        // data holds [offset, offset + n) of file
+        void add(uint64_t offset, Block data, size_t n);
+        size_t readAt(uint64_t offset, void* dst, size_t n) override;
+        Block block(uint64_t offset, size_t n) override;
+        // with defer, peekAt outside of ranges reads nothing - range is recorded, so it can be loaded for the next parse
+        size_t peekAt(uint64_t offset, void* dst, size_t n) override;
+        inline void deferPeeks(bool defer) { _deferPeeks = defer; }
+        inline const std::vector<std::pair<uint64_t, size_t>>& deferred() const { return _deferred; }
+        inline bool complete() const override { return _deferred.empty(); }
+    private:
+        struct Range {
+            uint64_t offset;
+            size_t size;
+            Block data;
+        };
+        // returns range, holding whole [offset, offset + n), or nullptr
+        const Range* find(uint64_t offset, size_t n) const;
+        int fd;
+        // there are just a few of them - no need for ordered structure
+        std::vector<Range> ranges;
+        bool _deferPeeks = false;
+        std::vector<std::pair<uint64_t, size_t>> _deferred;
+    };
+
+    enum class Backend {
+        Pread,
+        Mmap
+    };
+
+    // returns nullptr if file could not be opened
+    std::shared_ptr<ByteSource> open(const std::filesystem::path& path, Backend backend = Backend::Pread);
+
+}
+
+#endif // BYTESOURCE_HPP
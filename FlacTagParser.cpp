@@ -1,4 +1,8 @@
 #include "FlacTagParser.hpp"
+#include "Instrumentation.hpp"
+#include "Format.hpp"
+#include <algorithm>
+#include <bit>
 
 using namespace tag::flac;
 using namespace util;
@@ -13,122 +17,254 @@ const std::array<std::string, (size_t)tag::flac::FlacTagExtractor::BlockType::Co
     "PICTURE"
 };
 
-tag::flac::FlacTagExtractor::FlacTagExtractor(std::ifstream& fs) {
-    if (!checkFile(fs)) {
+tag::flac::FlacTagExtractor::FlacTagExtractor(const std::shared_ptr<io::ByteSource>& src, const ExtractorConfig& config)
+    : src{src}, config{config}, _frames{config.memory}
+{
+    if (!checkFile(*src)) {
         throw InvalidTagException{};
     }
-    if (extractFrames(fs)) {
+    if (extractFrames(*src)) {
         throw InvalidTagException{};
     }
+    _audioOffset = src->tell();
 }
 
-std::list<std::pair<tag::Extractor::Data, size_t>> tag::flac::FlacTagExtractor::framesData(const std::string& frameName) {
-    auto iter = _frames.find(frameName);
-    if (iter == _frames.end()) {
-        return {};
+std::pair<tag::Extractor::Data, size_t> tag::flac::FlacTagExtractor::frameData(FrameId id) {
+    for (Frame& frame : _frames) {
+        if (frame.header.blockType == id) {
+            return {frame.data ? frame.data : load(frame), (size_t)frame.header.size};
+        }
     }
-    std::list<std::pair<tag::Extractor::Data, size_t>> res;
-    for (const auto& item : iter->second) {
-        res.push_back({item.data, item.header.size});
+    return {nullptr, 0};
+}
+
+tag::Extractor::FramesData tag::flac::FlacTagExtractor::framesData(FrameId id) {
+    FramesData res(config.memory);
+    for (Frame& frame : _frames) {
+        if (frame.header.blockType == id) {
+            res.push_back({frame.data ? frame.data : load(frame), (size_t)frame.header.size});
+        }
     }
     return res;
 }
 
+tag::Extractor::Data tag::flac::FlacTagExtractor::load(Frame& frame) {
+    frame.data = src->block(frame.offset, frame.header.size);
+    return frame.data;
+}
+
+namespace {
+
+    uint32_t be32(const uint8_t* data) {
+        uint32_t res;
+        memcpy(&res, data, sizeof(res));
+        return swapBytes(res);
+    }
+
+    /*
+        PICTURE block up to picture data: type, MIME type, description, dimensions and size of data.
+        Returns offset of picture data in block; nullopt, if head ends before it.
+    */
+    std::optional<size_t> readPictureHead(const uint8_t* head, size_t n, tag::user::APICUserData& picture, uint64_t& size) {
+        if (n < 8) {
+            return std::nullopt;
+        }
+        picture.type = (tag::user::ImageType)be32(head);
+        uint64_t mimeSize = be32(head + 4);
+        if ((8 + mimeSize + 4) > n) {
+            return std::nullopt;
+        }
+        picture.mimeType.assign((const char*)head + 8, mimeSize);
+        uint64_t descriptionSize = be32(head + 8 + mimeSize);
+        // width, height, color depth, number of colors - 4 bytes each
+        uint64_t sizeOffset = 8 + mimeSize + 4 + descriptionSize + 16;
+        if ((sizeOffset + 4) > n) {
+            return std::nullopt;
+        }
+        size = be32(head + sizeOffset);
+        return sizeOffset + 4;
+    }
+
+}
+
+std::vector<tag::user::APICUserData> tag::flac::FlacTagExtractor::imageLocations() {
+    std::vector<user::APICUserData> res;
+    for (Frame& frame : _frames) {
+        if ((BlockType)frame.header.blockType != BlockType::PICTURE) {
+            continue;
+        }
+        size_t blockSize = frame.header.size;
+        user::APICUserData picture{};
+        uint64_t size = 0;
+        std::optional<size_t> pictureOffset;
+        if (frame.data) {
+            pictureOffset = readPictureHead(frame.data.get(), blockSize, picture, size);
+        }
+        else {
+            size_t headSize = std::min<size_t>(blockSize, user::ImageHeadSize);
+            if (auto head = src->block(frame.offset, headSize)) {
+                pictureOffset = readPictureHead(head.get(), headSize, picture, size);
+            }
+            // long description
+            if (!pictureOffset && (headSize < blockSize)) {
+                if (auto head = src->block(frame.offset, blockSize)) {
+                    pictureOffset = readPictureHead(head.get(), blockSize, picture, size);
+                }
+            }
+        }
+        if (pictureOffset && (*pictureOffset <= blockSize)) {
+            picture.location = user::ImageLocation{{}, frame.offset + *pictureOffset, std::min<uint64_t>(size, blockSize - *pictureOffset)};
+            res.push_back(std::move(picture));
+        }
+    }
+    return res;
+}
+
+tag::FrameId tag::flac::FlacTagExtractor::frameId(std::string_view frameName) const {
+    auto iter = std::find(BlockTypeStrMap.begin(), BlockTypeStrMap.end(), frameName);
+    return iter - BlockTypeStrMap.begin();
+}
+
 std::vector<std::string> tag::flac::FlacTagExtractor::frameTitles() const {
     std::vector<std::string> res;
-    for (const auto& [title, frame] : _frames) {
-        res.push_back(title);
+    bool seen[(size_t)BlockType::Count] = {};
+    for (const Frame& frame : _frames) {
+        if (!seen[frame.header.blockType]) {
+            seen[frame.header.blockType] = true;
+            res.push_back(BlockTypeStrMap[frame.header.blockType]);
+        }
     }
     return res;
 }
 
-bool tag::flac::FlacTagExtractor::checkFile(std::ifstream& fs) {
-    char data[4];
-    fs.read((char*)&data, sizeof(data));
+bool tag::flac::FlacTagExtractor::checkFile(io::ByteSource& src) {
+    // some taggers prepend ID3v2 tag to FLAC stream
+    src.seek(id3v2Size(src));
+    char data[4] = {0};
+    src.read(&data[0], sizeof(data));
     if (!(data[0] == 'f' && data[1] == 'L' && data[2] == 'a' && data[3] == 'C')) {
         return false;
     }
     return true;
 }
 
-int tag::flac::FlacTagExtractor::extractFrames(std::ifstream& fs) {
-    Frame frame = extractFrame(fs);
+int tag::flac::FlacTagExtractor::extractFrames(io::ByteSource& src) {
+    INSTR_PHASE(Frames);
+    Frame frame = extractFrame(src);
     if ((BlockType)frame.header.blockType != BlockType::STREAMINFO) {
         // STREAMINFO is mandatory
         throw InvalidTagException{};
     }
     bool last = frame.header.lastMetadataBlockFlag;
-    _frames[BlockTypeStrMap[frame.header.blockType]].push_back(std::move(frame));
+    _frames.push_back(std::move(frame));
     while (!last) {
-        frame = extractFrame(fs);
+        frame = extractFrame(src);
         last = frame.header.lastMetadataBlockFlag;
-        _frames[BlockTypeStrMap[frame.header.blockType]].push_back(std::move(frame));
+        if (accepts(frame.header)) {
+            _frames.push_back(std::move(frame));
+        }
     }
     return 0;
 }
 
-tag::flac::FlacTagExtractor::Frame tag::flac::FlacTagExtractor::extractFrame(std::ifstream& fs) {
+bool tag::flac::FlacTagExtractor::accepts(const FrameHeader& header) const {
+    return accepts(config, header.blockType, header.size);
+}
+
+bool tag::flac::FlacTagExtractor::accepts(const ExtractorConfig& config, uint8_t blockType, size_t size) {
+    if (blockType >= (uint8_t)BlockType::Count) {
+        // reserved or invalid block type
+        return false;
+    }
+    if ((BlockType)blockType == BlockType::STREAMINFO) {
+        return true;
+    }
+    return config.filter.accepts(BlockTypeStrMap[blockType], size);
+}
+
+tag::flac::FlacTagExtractor::Frame tag::flac::FlacTagExtractor::extractFrame(io::ByteSource& src) {
     Frame frame;
     // can't use sizeof(Header) and must use hardcode, because of MSVC and it's alignment pervercies even with pragma pack
-    fs.read((char*)&frame.header, 4);
+    if (src.read(&frame.header, 4) != 4) {
+        throw InvalidTagException{};
+    }
     frame.header.size = ((frame.header.size & 0xff) << 16) | ((frame.header.size & 0xff00)) | ((frame.header.size & 0xff0000) >> 16);
-    frame.data = Data(new uint8_t[frame.header.size]);
-    fs.read((char*)frame.data.get(), frame.header.size);
+    if (frame.header.size > src.remaining()) {
+        throw InvalidTagException{};
+    }
+    frame.offset = src.tell();
+    if (accepts(frame.header) && ((BlockType)frame.header.blockType == BlockType::STREAMINFO || !config.filter.defers(BlockTypeStrMap[frame.header.blockType]))) {
+        frame.data = src.block(frame.offset, frame.header.size);
+    }
+    // filtered out blocks (PADDING, PICTURE...) and deferred ones are just skipped
+    src.skip(frame.header.size);
     return frame;
 }
 
-FlacTagParser::FlacTagParser(std::ifstream& fs)
+FlacTagParser::FlacTagParser(const std::shared_ptr<io::ByteSource>& src, const ExtractorConfig& config)
+    : vorbis{config.memory}, text{config.memory}
 {
-    extractor = std::shared_ptr<Extractor>(new FlacTagExtractor(fs));
-    vorbis = VorbisCommentMap();
+    memory = config.memory;
+    imageStore = config.imageStore;
+    extractor = std::allocate_shared<FlacTagExtractor>(std::pmr::polymorphic_allocator<FlacTagExtractor>(memory), src, config);
+    readVorbis();
 }
 
 VorbisCommentReader::ResultType tag::flac::FlacTagParser::VorbisComment() {
-    auto [frameData, frameSize] = extractor->frameData("VORBIS_COMMENT");
+    auto [frameData, frameSize] = extractor->frameData((FrameId)FlacTagExtractor::BlockType::VORBIS_COMMENT);
     if (!frameData || !frameSize) {
         return {};
     }
-    DataBlock data(frameData.get(), frameSize);
+    DataBlock data(frameData, frameSize);
     data.encoding = Encoding::Utf8;
+    data.memory = memory;
     return VorbisCommentReader().read(data);
 }
 
-std::unordered_map<std::string, std::string> tag::flac::FlacTagParser::VorbisCommentMap() {
-    auto vorbisComment = VorbisComment();
-    if (std::get<2>(vorbisComment) == 0) {
-        return {};
+void tag::flac::FlacTagParser::readVorbis() {
+    auto [frameData, frameSize] = extractor->frameData((FrameId)FlacTagExtractor::BlockType::VORBIS_COMMENT);
+    if (!frameData || !frameSize) {
+        return;
     }
-    std::unordered_map<std::string, std::string> res;
-    for (const auto& comment : std::get<3>(vorbisComment)) {
+    DataBlock data(frameData, frameSize);
+    data.encoding = Encoding::Utf8;
+    data.memory = memory;
+    data.text = &text;
+    auto vorbisComment = VorbisCommentViewReader().read(data);
+    for (std::string_view comment : std::get<3>(vorbisComment)) {
         auto pos = comment.find('=');
         if (pos == comment.npos) {
             continue;
         }
-        std::string val;
-        if (pos != (comment.size() - 1)) {
-            val = comment.substr(pos + 1);
-        }
-        res[comment.substr(0, pos)] = std::move(val);
+        vorbis.insert_or_assign(comment.substr(0, pos), comment.substr(pos + 1));
+    }
+}
+
+std::unordered_map<std::string, std::string> tag::flac::FlacTagParser::VorbisCommentMap() {
+    std::unordered_map<std::string, std::string> res;
+    for (const auto& [key, val] : vorbis) {
+        res[std::string(key)] = std::string(val);
     }
     return res;
 }
 
-std::list<PictureReader::ResultType> tag::flac::FlacTagParser::Picture() {
-    auto pictures = extractor->framesData("PICTURE");
-    std::list<PictureReader::ResultType> res;
+std::pmr::list<PictureReader::ResultType> tag::flac::FlacTagParser::Picture() {
+    auto pictures = extractor->framesData((FrameId)FlacTagExtractor::BlockType::PICTURE);
+    std::pmr::list<PictureReader::ResultType> res(memory);
     for (auto [frameData, frameSize] : pictures) {
         if (!frameData || !frameSize) {
             continue;
         }
-        DataBlock data(frameData.get(), frameSize);
+        DataBlock data(frameData, frameSize);
         data.encoding = Encoding::Utf8;
+        data.memory = memory;
         res.push_back(PictureReader().read(data));
     }
     return res;
 }
 
 tag::flac::FlacTagParser::StreamInfoDescr tag::flac::FlacTagParser::StreamInfo() {
-    auto [frameData, frameSize] = extractor->frameData("STREAMINFO");
+    auto [frameData, frameSize] = extractor->frameData((FrameId)FlacTagExtractor::BlockType::STREAMINFO);
     if (!frameData || !frameSize) {
         return {};
     }
@@ -170,11 +306,15 @@ std::string tag::flac::FlacTagParser::comment() {
 }
 
 std::string tag::flac::FlacTagParser::textual(const std::string& name) {
+    return std::string(textualView(name));
+}
+
+std::string_view tag::flac::FlacTagParser::textualView(std::string_view name) const {
     if (auto iter = vorbis.find(name); iter != vorbis.end()) {
         return iter->second;
     }
     else {
-        return "";
+        return {};
     }
 }
 
@@ -182,11 +322,128 @@ std::vector<tag::user::APICUserData> tag::flac::FlacTagParser::image() {
     auto images = Picture();
     std::vector<tag::user::APICUserData> res;
     for (auto& image : images) {
-        res.push_back({(user::ImageType)std::get<0>(image), std::get<2>(image), std::get<10>(image)});
+        res.push_back({(user::ImageType)std::get<0>(image), std::get<2>(image), intern(std::get<10>(image)), std::nullopt});
     }
     return res;
 }
 
+std::vector<tag::user::APICUserData> tag::flac::FlacTagParser::imageLocations() {
+    return static_cast<FlacTagExtractor&>(*extractor).imageLocations();
+}
+
+namespace {
+
+    // SEEKTABLE point: sample number, offset from first frame, samples in frame
+    constexpr size_t SeekPointSize = 18;
+    constexpr uint64_t PlaceholderSample = 0xffffffffffffffffull;
+    // frame header: sync (14 bits), reserved bit, blocking strategy; then UTF-8 coded frame or sample number
+    constexpr size_t MaxFrameHeaderSize = 16;
+    // for streams without maximum frame size in STREAMINFO
+    constexpr size_t DefaultScanWindow = 64 * 1024;
+
+    uint64_t be64(const uint8_t* data) {
+        uint64_t res;
+        memcpy(&res, data, sizeof(res));
+        return swapBytes(res);
+    }
+
+    uint8_t crc8(const uint8_t* data, size_t n) {
+        uint8_t crc = 0;
+        for (size_t i = 0; i < n; ++i) {
+            crc ^= data[i];
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+            }
+        }
+        return crc;
+    }
+
+    /*
+        Frame header at data: returns number of its first sample or nullopt, if it is not valid header.
+        fixedBlockSize - of streams with fixed blocking strategy (frame number is coded instead of sample number).
+    */
+    std::optional<uint64_t> frameSample(const uint8_t* data, size_t n, uint64_t fixedBlockSize) {
+        if ((n < 6) || (data[0] != 0xff) || ((data[1] & 0xfe) != 0xf8)) {
+            return std::nullopt;
+        }
+        bool variable = data[1] & 1;
+        uint8_t blockSizeCode = data[2] >> 4;
+        uint8_t sampleRateCode = data[2] & 0x0f;
+        uint8_t channels = data[3] >> 4;
+        uint8_t sampleSizeCode = (data[3] >> 1) & 0x07;
+        if (!blockSizeCode || (sampleRateCode == 0x0f) || (channels > 10) || (sampleSizeCode == 3) || (data[3] & 1)) {
+            return std::nullopt;
+        }
+        // like UTF-8, but up to 7 bytes (36 bits)
+        size_t length = std::countl_one(data[4]);
+        if ((length == 1) || (length > 7)) {
+            return std::nullopt;
+        }
+        uint64_t number = length ? data[4] & (0xff >> (length + 1)) : data[4];
+        length = std::max<size_t>(length, 1);
+        size_t pos = 5;
+        for (size_t i = 1; i < length; ++i, ++pos) {
+            if ((pos >= n) || ((data[pos] & 0xc0) != 0x80)) {
+                return std::nullopt;
+            }
+            number = (number << 6) | (data[pos] & 0x3f);
+        }
+        pos += (blockSizeCode == 6) ? 1 : ((blockSizeCode == 7) ? 2 : 0);
+        pos += (sampleRateCode == 12) ? 1 : (((sampleRateCode == 13) || (sampleRateCode == 14)) ? 2 : 0);
+        if ((pos >= n) || (crc8(data, pos) != data[pos])) {
+            return std::nullopt;
+        }
+        return variable ? number : number * fixedBlockSize;
+    }
+
+}
+
+seek::Index tag::flac::FlacTagParser::seekIndex(bool scan, size_t scanPoints) {
+    auto& flac = static_cast<FlacTagExtractor&>(*extractor);
+    StreamInfoDescr info = StreamInfo();
+    std::vector<seek::Point> points;
+    auto [table, tableSize] = flac.frameData((FrameId)FlacTagExtractor::BlockType::SEEKTABLE);
+    if (table) {
+        points.reserve(tableSize / SeekPointSize);
+        for (size_t pos = 0; (pos + SeekPointSize) <= tableSize; pos += SeekPointSize) {
+            uint64_t sample = be64(table.get() + pos);
+            if (sample != PlaceholderSample) {
+                points.push_back({sample, flac.audioOffset() + be64(table.get() + pos + 8)});
+            }
+        }
+    }
+    if (points.empty() && scan && scanPoints) {
+        io::ByteSource& src = flac.source();
+        uint64_t begin = flac.audioOffset();
+        uint64_t audioSize = (src.size() > begin) ? src.size() - begin : 0;
+        // window holds at least one whole frame
+        size_t window = (info.maximumFrameSizeInBytes ? info.maximumFrameSizeInBytes : DefaultScanWindow) + MaxFrameHeaderSize;
+        // fixed blocking strategy - all frames but last have same size
+        uint64_t fixedBlockSize = info.maximumBlockSizeInSamples;
+        std::vector<uint8_t> buf(window);
+        for (size_t i = 0; i < scanPoints; ++i) {
+            uint64_t offset = begin + audioSize * i / scanPoints;
+            // frame, found by previous window, is beyond this offset
+            if (!points.empty() && (offset <= points.back().offset)) {
+                continue;
+            }
+            size_t n = src.readAt(offset, buf.data(), buf.size());
+            for (size_t pos = 0; (pos + 1) < n; ++pos) {
+                if ((buf[pos] != 0xff) || ((buf[pos + 1] & 0xfe) != 0xf8)) {
+                    continue;
+                }
+                // false sync in audio data may pass CRC too - its number is likely out of stream
+                auto sample = frameSample(&buf[pos], n - pos, fixedBlockSize);
+                if (sample && (!info.totalSamples || (*sample < info.totalSamples))) {
+                    points.push_back({*sample, offset + pos});
+                    break;
+                }
+            }
+        }
+    }
+    return seek::Index(info.sampleRate, std::move(points));
+}
+
 size_t tag::flac::FlacTagParser::durationMs() {
     auto streamInfo = StreamInfo();
     if (!streamInfo.sampleRate) {
@@ -11,11 +11,14 @@
 #include <list>
 #include <array>
 #include "Tag.hpp"
+#include "ByteSource.hpp"
+#include "SeekIndex.hpp"
 
 namespace tag {
     namespace flac {
 
         using VorbisCommentReader = FrameReader<SizeOfData<LittleEndian>, EncodedStr, SizeOfData<LittleEndian>, ListOfEncodedStrings<LittleEndian>>;
+        using VorbisCommentViewReader = FrameReader<SizeOfData<LittleEndian>, EncodedStrView, SizeOfData<LittleEndian>, ListOfEncodedStringsView<LittleEndian>>;
         using PictureReader = FrameReader<Bytes<uint32_t, BigEndian>, SizeOfData<BigEndian>, EncodedStr, SizeOfData<BigEndian>, EncodedStr, Bytes<uint32_t, BigEndian>, Bytes<uint32_t, BigEndian>, Bytes<uint32_t, BigEndian>, Bytes<uint32_t, BigEndian>, SizeOfData<BigEndian>, BinaryData>;
 
         class FlacTagExtractor : public Extractor {
@@ -39,20 +42,42 @@ namespace tag {
             struct_packed_end;
             struct Frame {
                 FrameHeader header;
+                // empty until payload is loaded (deferred blocks)
                 Data data;
+                // payload offset in source
+                uint64_t offset = 0;
             };
 
-            using Frames = std::unordered_map<std::string, std::list<Frame>>;
-            FlacTagExtractor(std::ifstream& ifs);
+            // in order of the file; frame id is index of block type
+            using Frames = std::pmr::vector<Frame>;
+            // src is shared: deferred blocks and seek scan read it after construction
+            FlacTagExtractor(const std::shared_ptr<io::ByteSource>& src, const ExtractorConfig& config = {});
             inline Frames& frames() { return _frames; }
-            std::list<std::pair<Extractor::Data, size_t>> framesData(const std::string& frameName) override;
+            using Extractor::frameData;
+            using Extractor::framesData;
+            std::pair<Data, size_t> frameData(FrameId id) override;
+            FramesData framesData(FrameId id) override;
+            // unknown names get BlockType::Count, which is never stored
+            FrameId frameId(std::string_view frameName) const override;
             std::vector<std::string> frameTitles() const override;
+            // tells if block is stored with given config; STREAMINFO always is
+            static bool accepts(const ExtractorConfig& config, uint8_t blockType, size_t size);
+            // PICTURE blocks; only heads of deferred ones are read
+            std::vector<user::APICUserData> imageLocations();
+            // first audio frame - right after the last metadata block
+            inline uint64_t audioOffset() const { return _audioOffset; }
+            inline io::ByteSource& source() { return *src; }
         private:
-            bool checkFile(std::ifstream& fs);
-            int extractFrames(std::ifstream& fs);
-            Frame extractFrame(std::ifstream& fs);
+            bool checkFile(io::ByteSource& src);
+            int extractFrames(io::ByteSource& src);
+            Frame extractFrame(io::ByteSource& src);
+            bool accepts(const FrameHeader& header) const;
+            Data load(Frame& frame);
 
+            std::shared_ptr<io::ByteSource> src;
+            ExtractorConfig config;
             Frames _frames;
+            uint64_t _audioOffset = 0;
         };
 
 
@@ -84,11 +109,20 @@ namespace tag {
                 uint64_t totalSamples;
             };
 
-            FlacTagParser(std::ifstream& fs);
+            // points, placed by sparse scan, if there is no SEEKTABLE
+            static constexpr size_t ScanPoints = 256;
+
+            FlacTagParser(const std::shared_ptr<io::ByteSource>& src, const ExtractorConfig& config = {});
             VorbisCommentReader::ResultType VorbisComment();
             std::unordered_map<std::string, std::string> VorbisCommentMap();
-            std::list<PictureReader::ResultType> Picture();
+            std::pmr::list<PictureReader::ResultType> Picture();
             StreamInfoDescr StreamInfo();
+            /*
+                Points of SEEKTABLE (it must not be filtered out), placeholders skipped.
+                Without table and with scan - frames, found by sync code (and header CRC) at scanPoints evenly spaced offsets:
+                one small read per point, audio is not decoded.
+            */
+            seek::Index seekIndex(bool scan = false, size_t scanPoints = ScanPoints);
 
             std::string songTitle() override;
             std::string album() override;
@@ -97,10 +131,16 @@ namespace tag {
             std::string trackNumber() override;
             std::string comment() override;
             std::string textual(const std::string& name);
+            // valid while parser is
+            std::string_view textualView(std::string_view name) const;
             std::vector<user::APICUserData> image() override;
+            std::vector<user::APICUserData> imageLocations() override;
             size_t durationMs() override;
         private:
-            std::unordered_map<std::string, std::string> vorbis;
+            void readVorbis();
+            // views into VORBIS_COMMENT block (or text, if comment is not valid UTF-8)
+            std::pmr::unordered_map<std::string_view, std::string_view> vorbis;
+            TextBuffer text;
         };
 
     }
@@ -0,0 +1,100 @@
+#include "Format.hpp"
+#include <string.h>
+#include <string>
+#include <algorithm>
+#include "Instrumentation.hpp"
+
+using namespace tag;
+
+namespace {
+
+    // frame sync, followed by header without reserved values
+    bool mpegHeader(const uint8_t* data, size_t n) {
+        if (n < 4) {
+            return false;
+        }
+        uint8_t version = (data[1] >> 3) & 0b11;
+        uint8_t layer = (data[1] >> 1) & 0b11;
+        uint8_t bitrate = data[2] >> 4;
+        uint8_t sampleRate = (data[2] >> 2) & 0b11;
+        return (data[0] == 0xff) && ((data[1] & 0b11100000) == 0b11100000) &&
+               (version != 0b01) && (layer != 0b00) && (bitrate != 0b1111) && (sampleRate != 0b11);
+    }
+
+}
+
+uint64_t tag::id3v2Size(const uint8_t* head, size_t n) {
+    if ((n < 10) || memcmp(head, "ID3", 3)) {
+        return 0;
+    }
+    // size is syncsafe - 7 bits in each byte
+    if ((head[6] | head[7] | head[8] | head[9]) & 0x80) {
+        return 0;
+    }
+    uint64_t size = ((uint64_t)head[6] << 21) | ((uint64_t)head[7] << 14) | ((uint64_t)head[8] << 7) | head[9];
+    return ((head[5] & 0x10) ? 20 : 10) + size;
+}
+
+uint64_t tag::id3v2Size(io::ByteSource& src) {
+    uint8_t header[10];
+    return id3v2Size(header, src.peekAt(0, header, sizeof(header)));
+}
+
+Format tag::sniffFormat(const uint8_t* head, size_t n) {
+    if (uint64_t skip = id3v2Size(head, n)) {
+        // audio may be FLAC or WAV with ID3v2 tag prepended
+        if (skip >= n) {
+            return Format::Mp3;
+        }
+        Format format = sniffFormat(head + skip, n - skip);
+        return (format == Format::Unknown) ? Format::Mp3 : format;
+    }
+    if ((n >= 3) && !memcmp(head, "ID3", 3)) {
+        return Format::Mp3;
+    }
+    if ((n >= 4) && !memcmp(head, "fLaC", 4)) {
+        return Format::Flac;
+    }
+    if ((n >= 12) && !memcmp(head, "RIFF", 4) && !memcmp(head + 8, "WAVE", 4)) {
+        return Format::Wav;
+    }
+    // mp3 parser skips zero padding before first frame
+    size_t i = 0;
+    while ((i < n) && !head[i]) {
+        ++i;
+    }
+    if (mpegHeader(head + i, n - i)) {
+        return Format::Mp3;
+    }
+    return Format::Unknown;
+}
+
+Format tag::formatFromExtension(const std::filesystem::path& path) {
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](char c){ return std::tolower(c); });
+    if (extension == ".mp3") {
+        return Format::Mp3;
+    }
+    if (extension == ".flac") {
+        return Format::Flac;
+    }
+    if (extension == ".wav") {
+        return Format::Wav;
+    }
+    return Format::Unknown;
+}
+
+Format tag::detectFormat(io::ByteSource& src, const std::filesystem::path& path) {
+    INSTR_PHASE(Sniff);
+    uint8_t head[SniffSize];
+    size_t n = src.readAt(0, head, std::min<uint64_t>(src.size(), sizeof(head)));
+    Format format = sniffFormat(head, n);
+    // tag is longer than head (e.g. with big picture) - magic bytes of audio are read separately
+    if (uint64_t skip = id3v2Size(head, n); skip >= n) {
+        n = src.readAt(skip, head, std::min<uint64_t>(src.size() - std::min(src.size(), skip), 12));
+        if (Format audio = sniffFormat(head, n); (audio == Format::Flac) || (audio == Format::Wav)) {
+            format = audio;
+        }
+    }
+    return (format == Format::Unknown) ? formatFromExtension(path) : format;
+}
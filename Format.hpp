@@ -0,0 +1,39 @@
+#ifndef FORMAT_HPP
+#define FORMAT_HPP
+#include <cstdint>
+#include <cstddef>
+#include <filesystem>
+#include "ByteSource.hpp"
+
+namespace tag {
+
+    enum class Format : uint8_t {
+        Unknown,
+        // ID3v2 tag or bare MPEG audio
+        Mp3,
+        Flac,
+        Wav
+    };
+
+    // bytes at the beginning of file, which are enough to tell the format
+    constexpr size_t SniffSize = 4096;
+
+    // size of ID3v2 tag at the beginning of file (with header and footer), 0 if there is none
+    uint64_t id3v2Size(const uint8_t* head, size_t n);
+    uint64_t id3v2Size(io::ByteSource& src);
+    /*
+        Identifies format by magic bytes (fLaC, RIFF/WAVE, MPEG frame sync), looked for after leading ID3v2 tag.
+        ID3v2 tag, which ends beyond head, means Mp3.
+    */
+    Format sniffFormat(const uint8_t* head, size_t n);
+    // by extension - for files, which content does not tell the format (e.g. junk before first frame)
+    Format formatFromExtension(const std::filesystem::path& path);
+    /*
+        Content first, extension if content is unknown.
+        Head is read through src, so with buffering sources parser gets it without reading again.
+    */
+    Format detectFormat(io::ByteSource& src, const std::filesystem::path& path);
+
+}
+
+#endif // FORMAT_HPP
@@ -1,30 +1,27 @@
 #include "ID3V2Parser.hpp"
 #include "Mp3FrameParser.hpp"
+#include "Instrumentation.hpp"
+#include <algorithm>
 
 using namespace util;
 using namespace tag::id3v2;
 
-uint32_t syncSafe(uint32_t n) {
-    return (n & 0b01111111) | ((n & (0b01111111 << 8)) >> 1) | ((n & (0b01111111 << 16)) >> 2) | ((n & (0b01111111 << 24)) >> 3);
-}
-
-tag::id3v2::ID3V2Extractor::ID3V2Extractor(std::ifstream& fs) {
-    size_t offset = fs.tellg();
-    fs.seekg(0, std::ios_base::end);
-    fileSize = fs.tellg();
-    fs.seekg(offset, std::ios_base::beg);
-    init(fs);
+tag::id3v2::ID3V2Extractor::ID3V2Extractor(const std::shared_ptr<io::ByteSource>& src, const ExtractorConfig& config, uint64_t offset)
+    : src{src}, config{config}, _frames{config.memory}, _offset{offset}
+{
+    src->seek(offset);
+    init(*src);
 }
 
-void tag::id3v2::ID3V2Extractor::init(std::ifstream& fs) {
-    if (!checkFile(fs)) {
-        // leaving fs in state, convenient for later work (on actual audio data)
-        skipPadding(fs);
-        syncLookup(fs);
+void tag::id3v2::ID3V2Extractor::init(io::ByteSource& src) {
+    if (!checkFile(src)) {
+        // leaving src in state, convenient for later work (on actual audio data)
+        skipPadding(src);
+        syncLookup(src);
         throw InvalidTagException{};
     }
     //while (true) {
-    if (extractHeader(fs)) {
+    if (extractHeader(src)) {
         //throw InvalidTagException{};
     }
     /*if (auto iter = _frames.find("SEEK"); iter != _frames.end()) {
@@ -44,45 +41,163 @@ void tag::id3v2::ID3V2Extractor::init(std::ifstream& fs) {
         //throw std::runtime_error("unsupported file: extended headers");
         // ignoring - should not have influence on correct work
     }
-    bool error = extractFrames(fs);
-    // leaving fs in state, convenient for later work (on actual audio data)
-    fs.seekg((hasFooter() ? 20 : 10) + _size, std::ios_base::beg);
-    skipPadding(fs);
-    syncLookup(fs);
+    // header gives size of whole tag - reading it at once, together with beginning of audio data
+    // with filter, big unneeded (or deferred) frames are better skipped than read
+    if (!lazy() && config.filter.acceptsAll() && config.filter.deferred.empty()) {
+        src.prefetch(_offset, tagEnd() - _offset + AudioProbeSize);
+    }
+    bool error = extractFrames(src);
+    // leaving src in state, convenient for later work (on actual audio data)
+    src.seek(tagEnd());
+    skipPadding(src);
+    syncLookup(src);
     if (error) {
         throw InvalidTagException{};
     }
-    if ((_version == 4) && hasFooter()) {
-        throw NotImplementedException{};
+    // SEEK: minimum offset to the next tag from the end of this one
+    if (_seekOffset && (_version == 4)) {
+        uint32_t next = 0;
+        if (src.readAt(_seekOffset, &next, sizeof(next)) == sizeof(next)) {
+            uint64_t pos = src.tell();
+            mergeTag(tagEnd() + swapBytes<uint32_t>(next));
+            src.seek(pos);
+        }
+    }
+}
+
+bool tag::id3v2::ID3V2Extractor::mergeTag(uint64_t offset) {
+    // update tags only follow - this also ends SEEK loops
+    if ((offset < tagEnd()) || (offset >= src->size())) {
+        return false;
+    }
+    uint64_t pos = src->tell();
+    bool merged = false;
+    try {
+        ID3V2Extractor update(src, config, offset);
+        std::erase_if(_frames, [&update](const Frame& frame) { return update.find(frame.id) != nullptr; });
+        for (Frame& frame : update._frames) {
+            _frames.push_back(std::move(frame));
+        }
+        merged = true;
     }
-    if ((_version == 4) && _frames.find("SEEK") != _frames.end()) {
-        throw NotImplementedException{};
+    catch (...) {
+        // no tag or invalid one - frames of this tag stay
     }
+    src->seek(pos);
+    return merged;
 }
 
-std::list<std::pair<tag::Extractor::Data, size_t>> tag::id3v2::ID3V2Extractor::framesData(const std::string& frameName) {
-    auto iter = _frames.find(frameName);
-    if (iter == _frames.end()) {
-        return {};
+const tag::id3v2::ID3V2Extractor::Frame* tag::id3v2::ID3V2Extractor::find(FrameId id) const {
+    for (const Frame& frame : _frames) {
+        if (frame.id == id) {
+            return &frame;
+        }
+    }
+    return nullptr;
+}
+
+std::pair<tag::Extractor::Data, size_t> tag::id3v2::ID3V2Extractor::frameData(FrameId id) {
+    for (Frame& frame : _frames) {
+        if (frame.id == id) {
+            return {frame.data ? frame.data : load(frame), frame.size};
+        }
+    }
+    return {nullptr, 0};
+}
+
+tag::Extractor::FramesData tag::id3v2::ID3V2Extractor::framesData(FrameId id) {
+    FramesData res(config.memory);
+    for (Frame& frame : _frames) {
+        if (frame.id == id) {
+            res.push_back({frame.data ? frame.data : load(frame), frame.size});
+        }
     }
-    std::list<std::pair<tag::Extractor::Data, size_t>> res;
-    for (const auto& item : iter->second) {
-        res.push_back({item.data, item.size});
+    return res;
+}
+
+tag::Extractor::Data tag::id3v2::ID3V2Extractor::load(Frame& frame) {
+    frame.data = src->block(frame.offset, frame.size);
+    return frame.data;
+}
+
+namespace {
+
+    /*
+        APIC frame up to picture data: encoding, MIME type, picture type, description.
+        Returns offset of picture data in frame; nullopt, if head (not whole frame) ends before it.
+    */
+    std::optional<size_t> readPictureHead(const tag::Extractor::Data& head, size_t n, bool whole, tag::user::APICUserData& picture) {
+        if (n < 2) {
+            return std::nullopt;
+        }
+        tag::DataBlock data(head, n);
+        tag::EncodingByte().read(data);
+        picture.mimeType = tag::AsciiStrNullTerminated().read(data);
+        if (data.offset >= n) {
+            return std::nullopt;
+        }
+        picture.type = (tag::user::ImageType)tag::Byte().read(data);
+        // description
+        tag::EncodedStrNullTerminated().read(data);
+        // terminator of description may be beyond the head
+        if (!whole && (data.offset >= n)) {
+            return std::nullopt;
+        }
+        return data.offset;
+    }
+
+}
+
+std::vector<tag::user::APICUserData> tag::id3v2::ID3V2Extractor::imageLocations() {
+    std::vector<user::APICUserData> res;
+    if (unsynchronisation()) {
+        return res;
+    }
+    for (const Frame& frame : _frames) {
+        // format flags (compression, encryption, unsynchronisation, data length) - picture is not stored as it is
+        if ((frame.id != fourcc("APIC")) || (frame.flags & 0xff)) {
+            continue;
+        }
+        user::APICUserData picture{};
+        std::optional<size_t> pictureOffset;
+        if (frame.data) {
+            pictureOffset = readPictureHead(frame.data, frame.size, true, picture);
+        }
+        else {
+            size_t headSize = std::min<size_t>(frame.size, user::ImageHeadSize);
+            if (auto head = src->block(frame.offset, headSize)) {
+                pictureOffset = readPictureHead(head, headSize, headSize == frame.size, picture);
+            }
+            // long description
+            if (!pictureOffset && (headSize < frame.size)) {
+                if (auto head = src->block(frame.offset, frame.size)) {
+                    pictureOffset = readPictureHead(head, frame.size, true, picture);
+                }
+            }
+        }
+        if (pictureOffset) {
+            picture.location = user::ImageLocation{{}, frame.offset + *pictureOffset, frame.size - *pictureOffset};
+            res.push_back(std::move(picture));
+        }
     }
     return res;
 }
 
 std::vector<std::string> tag::id3v2::ID3V2Extractor::frameTitles() const {
     std::vector<std::string> res;
-    for (const auto& [title, frame] : _frames) {
-        res.push_back(title);
+    for (auto iter = _frames.begin(); iter != _frames.end(); ++iter) {
+        // every id once, at its first occurrence
+        bool first = std::none_of(_frames.begin(), iter, [id = iter->id](const Frame& frame) { return frame.id == id; });
+        if (first) {
+            res.push_back(fourccString(iter->id));
+        }
     }
     return res;
 }
 
-bool tag::id3v2::ID3V2Extractor::checkFile(std::ifstream& fs) {
+bool tag::id3v2::ID3V2Extractor::checkFile(io::ByteSource& src) {
     uint8_t data[5];
-    fs.read((char*)&data, sizeof(data));
+    src.read(&data[0], sizeof(data));
     _version = data[3];
 
     // 0x49 0x44 0x33 - ID3 string
@@ -96,15 +211,15 @@ bool tag::id3v2::ID3V2Extractor::checkFile(std::ifstream& fs) {
     if (!valid) {
         if ((data[0] == 0xff && ((data[1] & 0b11100000) == 0b11100000)) || (data[0] == 0x00)) {
             // sync bytes or some padding
-            fs.seekg(0);
-            skipPadding(fs);
+            src.seek(_offset);
+            skipPadding(src);
             throw NoTagException{};
         }
         else if (!(data[0] == 0x49 && data[1] == 0x44 && data[2] == 0x33)) {
             // not id3 tag at all, but may be tag of some other type
-            fs.seekg(0);
-            skipPadding(fs);
-            syncLookup(fs);
+            src.seek(_offset);
+            skipPadding(src);
+            syncLookup(src);
             throw UnknownTagException{};
         }
         if (data[3] != 0x02 && data[3] != 0x03 && data[3] != 0x04) {
@@ -114,98 +229,113 @@ bool tag::id3v2::ID3V2Extractor::checkFile(std::ifstream& fs) {
     return valid;
 }
 
-int tag::id3v2::ID3V2Extractor::extractHeader(std::ifstream& fs) {
-    fs.read((char*)&_flags, 1);
-    _size = extractSize(fs);
+int tag::id3v2::ID3V2Extractor::extractHeader(io::ByteSource& src) {
+    src.read(&_flags, 1);
+    _size = extractSize(src);
     return 0;
 }
 
-size_t tag::id3v2::ID3V2Extractor::extractSize(std::ifstream& fs) {
+size_t tag::id3v2::ID3V2Extractor::extractSize(io::ByteSource& src) {
     size_t size = 0;
-    fs.read((char*)&size, 4);
+    src.read(&size, 4);
     size = swapBytes<uint32_t>(size);
     size = syncSafe(size);
     return size;
 }
 
-int tag::id3v2::ID3V2Extractor::extractFrames(std::ifstream& fs) {
-    size_t offset = hasFooter() ? 20 : 10;
-    while (offset < _size) {
-        int nbytes = _version == 2 ? extractFrameV22(fs) : extractFrame(fs);
+int tag::id3v2::ID3V2Extractor::extractFrames(io::ByteSource& src) {
+    INSTR_PHASE(Frames);
+    // frames and padding are between header and footer
+    uint64_t end = std::min<uint64_t>(_offset + 10 + _size, src.size());
+    uint64_t headerSize = (_version == 2) ? 6 : 10;
+    while ((src.tell() + headerSize) <= end) {
+        int nbytes = _version == 2 ? extractFrameV22(src, end) : extractFrame(src, end);
         if (nbytes <= 0) {
             // error or PADDING
             return nbytes;
         }
-        offset += nbytes;
-        if (offset > _size) {
-            // invalid tag, but some already read data may be useful
-            return -1;
-        }
     }
     return 0;
 }
 
-int tag::id3v2::ID3V2Extractor::extractFramesFooter(std::ifstream&) {
+int tag::id3v2::ID3V2Extractor::extractFramesFooter(io::ByteSource&) {
     return 0;
 }
 
-int tag::id3v2::ID3V2Extractor::extractFrame(std::ifstream& fs) {
+int tag::id3v2::ID3V2Extractor::extractFrame(io::ByteSource& src, uint64_t end) {
     Frame frame;
     char ID[4];
-    fs.read((char*)&ID[0], sizeof(ID));
+    src.read(&ID[0], sizeof(ID));
     if (ID[0] == 0) {
         // padding?
         return 0;
     }
-    fs.read((char*)&frame.size, sizeof(frame.flags) + sizeof(frame.size));
+    src.read(&frame.size, sizeof(frame.flags) + sizeof(frame.size));
     frame.size = swapBytes<uint32_t>(frame.size);
     frame.flags = swapBytes<uint16_t>(frame.flags);
     if (frame.size == 0) {
         return frame.size;
     }
-    if (frame.size > (fileSize - fs.tellg())) {
-        return 0;
-    }
     // in id3v2.4 size of frame is also SYNCSAFE, like header (but NOT like frame size in id3v2.3)
     if (_version == 4) {
         frame.size = syncSafe(frame.size);
     }
-    frame.data = Data(new uint8_t[frame.size]);
-    fs.read((char*)frame.data.get(), frame.size);
-    _frames[std::string(&ID[0], sizeof(ID))].push_back(std::move(frame));
-    return frame.size;
+    // frame crosses end of tag - invalid, but already read frames may be useful
+    if (frame.size > (end - src.tell())) {
+        return 0;
+    }
+    uint32_t size = frame.size;
+    storeFrame(src, std::string_view(&ID[0], sizeof(ID)), frame);
+    return size;
 }
 
-int tag::id3v2::ID3V2Extractor::extractFrameV22(std::ifstream& fs) {
+int tag::id3v2::ID3V2Extractor::extractFrameV22(io::ByteSource& src, uint64_t end) {
     Frame frame;
     char ID[3];
-    fs.read((char*)&ID[0], sizeof(ID));
+    src.read(&ID[0], sizeof(ID));
     if (ID[0] == 0) {
         // padding?
         return 0;
     }
-    fs.read((char*)&frame.size, 3);
+    src.read(&frame.size, 3);
     // swapping 3 bytes in place
     frame.size = ((frame.size & 0xff) << 16) | ((frame.size & 0xff00)) | ((frame.size & 0xff0000) >> 16);
     if (frame.size == 0) {
         return frame.size;
     }
-    if (frame.size > (fileSize - fs.tellg())) {
+    if (frame.size > (end - src.tell())) {
         return 0;
     }
-    frame.data = Data(new uint8_t[frame.size]);
-    fs.read((char*)frame.data.get(), frame.size);
-    _frames[std::string(&ID[0], sizeof(ID))].push_back(std::move(frame));
-    return frame.size;
+    uint32_t size = frame.size;
+    storeFrame(src, std::string_view(&ID[0], sizeof(ID)), frame);
+    return size;
 }
 
-void tag::id3v2::ID3V2Extractor::skipPadding(std::ifstream& fs) {
+void tag::id3v2::ID3V2Extractor::storeFrame(io::ByteSource& src, std::string_view frameName, Frame& frame) {
+    frame.offset = src.tell();
+    src.skip(frame.size);
+    if ((frameName == "SEEK") && (frame.size == 4)) {
+        _seekOffset = frame.offset;
+    }
+    if (!config.filter.accepts(frameName, frame.size)) {
+        // filtered out - payload is neither read nor allocated
+        return;
+    }
+    if (!lazy() && !config.filter.defers(frameName)) {
+        // view into tag buffer
+        frame.data = src.block(frame.offset, frame.size);
+    }
+    frame.id = fourcc(frameName);
+    _frames.push_back(std::move(frame));
+}
+
+void tag::id3v2::ID3V2Extractor::skipPadding(io::ByteSource& src) {
     uint8_t byte = 0;
-    while (!byte && fs) {
-        fs.read((char*)&byte, 1);
+    while (!byte && src.read(&byte, 1)) {
+        ;
     }
     if (byte) {
-        fs.seekg((size_t)fs.tellg() - 1);
+        src.seek(src.tell() - 1);
     }
 }
 
@@ -214,77 +344,82 @@ void tag::id3v2::ID3V2Extractor::skipPadding(std::ifstream& fs) {
     handling known kinds of data (not equal to sync seq) (RIFF, another ID3 tag...)
     returns true if something was skipped
 */
-void tag::id3v2::ID3V2Extractor::syncLookup(std::ifstream& fs) {
+void tag::id3v2::ID3V2Extractor::syncLookup(io::ByteSource& src) {
+    INSTR_PHASE(SyncLookup);
     static constexpr size_t SyncLookupSize = 4096;
     size_t remainFsize = 0;
-    size_t initOffset = fs.tellg();
-    remainFsize = fileSize - initOffset;
+    size_t initOffset = src.tell();
+    remainFsize = src.remaining();
     uint8_t buf[4];
     // sync seq not found - giving up
     if (!(remainFsize > 2)) {
         return;
     }
-    fs.read((char*)&buf[0], 2);
+    src.read(&buf[0], 2);
     // sync seq is next - ok
     if (buf[0] == 0xff && (buf[1] & 0b11100000)) {
-        fs.seekg(initOffset);
+        src.seek(initOffset);
         return;
     }
     // suspect one more ID3 tag - JUST SKIPPING IT for now
     if (buf[0] == 'I' && buf[1] == 'D' && remainFsize >= 3) {
-        fs.read((char*)&buf[2], 1);
+        src.read(&buf[2], 1);
         if (buf[2] == '3') {
             // ID3 tag
             // skip version and flags
-            fs.seekg((size_t)fs.tellg() + 3);
-            size_t size = extractSize(fs);
-            fs.seekg((size_t)fs.tellg() + size);
-            skipPadding(fs);
+            src.skip(3);
+            size_t size = extractSize(src);
+            src.skip(size);
+            skipPadding(src);
             // can be more to skip
-            syncLookup(fs);
+            syncLookup(src);
             return;
         }
     }
     // suspect RIFF
     else if (buf[0] == 'R' && buf[1] == 'I' && remainFsize >= 4) {
-        fs.read((char*)&buf[2], 2);
+        src.read(&buf[2], 2);
         if (buf[2] == 'F' && buf[3] == 'F') {
             // RIFF found
             uint8_t RIFFBuf[SyncLookupSize];
-            fs.read((char*)&RIFFBuf[0], std::min(remainFsize - 4, SyncLookupSize));
-            for(size_t i = 0; i < SyncLookupSize - 1; ++i) {
+            size_t n = src.read(&RIFFBuf[0], std::min(remainFsize - 4, SyncLookupSize));
+            for(size_t i = 0; (i + 1) < n; ++i) {
                 if ((RIFFBuf[i] == 0xff) && ((RIFFBuf[i + 1] & 0b11100000) == 0b11100000)) {
-                    fs.seekg(initOffset + 4 + i);
+                    src.seek(initOffset + 4 + i);
                     return;
                 }
             }
             // not found sync seq in RIFFLookupSize bytes - returning to initial offset
-            fs.seekg(initOffset);
+            src.seek(initOffset);
             return;
         }
     }
     // something else - try to find sync seq
     else {
         uint8_t dataBuf[SyncLookupSize];
-        fs.read((char*)&dataBuf[0], std::min(remainFsize - 2, SyncLookupSize));
-        for(size_t i = 0; i < SyncLookupSize - 1; ++i) {
+        size_t n = src.read(&dataBuf[0], std::min(remainFsize - 2, SyncLookupSize));
+        for(size_t i = 0; (i + 1) < n; ++i) {
             if ((dataBuf[i] == 0xff) && ((dataBuf[i + 1] & 0b11100000) == 0b11100000)) {
-                fs.seekg(initOffset + 2 + i);
+                src.seek(initOffset + 2 + i);
                 return;
             }
         }
         // not found sync seq in RIFFLookupSize bytes - returning to initial offset
-        fs.seekg(initOffset);
+        src.seek(initOffset);
         return;
     }
-    fs.seekg(initOffset);
+    src.seek(initOffset);
     return;
 }
 
-tag::id3v2::ID3V2Parser::ID3V2Parser(std::ifstream& fs)
+tag::id3v2::ID3V2Parser::ID3V2Parser(const std::shared_ptr<io::ByteSource>& src, const ExtractorConfig& config)
+    : _tail{config.memory}
 {
+    memory = config.memory;
+    imageStore = config.imageStore;
+    std::shared_ptr<ID3V2Extractor> id3v2;
     try {
-        extractor = std::shared_ptr<Extractor>(new ID3V2Extractor(fs));
+        extractor = id3v2 = std::allocate_shared<ID3V2Extractor>(std::pmr::polymorphic_allocator<ID3V2Extractor>(memory), src, config);
     }
     // recoverable errors - still try to find duration
     catch (NoTagException&) {
@@ -296,8 +431,35 @@ tag::id3v2::ID3V2Parser::ID3V2Parser(std::ifstream& fs)
     catch (InvalidTagException&) {
         // tag is invalid, but some data may be ok
     }
+    // extractor leaves src at the audio
+    uint64_t audioBegin = src->tell();
+    _src = src;
+    _audioBegin = audioBegin;
+    if (config.tailTags) {
+        _tail = tail::probe(*src, memory);
+    }
+    else {
+        _tail.audioEnd = src->size();
+    }
+    // ID3v2 tag, appended to the file - update of the front one or the only tag
+    if (_tail.id3v2Offset && (*_tail.id3v2Offset > 0)) {
+        if (id3v2) {
+            id3v2->mergeTag(*_tail.id3v2Offset);
+        }
+        else {
+            try {
+                extractor = std::allocate_shared<ID3V2Extractor>(std::pmr::polymorphic_allocator<ID3V2Extractor>(memory), src, config, *_tail.id3v2Offset);
+            }
+            catch (...) {}
+        }
+    }
+    src->seek(audioBegin);
     try {
-        _durationMs = mp3::getMp3FileDuration(fs);
+        // tail tags are not audio - they would make CBR estimate longer
+        if (config.seekIndex) {
+            _seekIndex.emplace();
+        }
+        _durationMs = mp3::getMp3FileDuration(*src, std::max(_tail.audioEnd, audioBegin), _seekIndex ? &*_seekIndex : nullptr);
     }
     catch (mp3::Mp3FrameParser::EOFException&) {
         // just EOF of mp3 frame data
@@ -307,30 +469,53 @@ tag::id3v2::ID3V2Parser::ID3V2Parser(std::ifstream& fs)
     }
 }
 
+// files without ID3v2 text: APEv2 item first, then ID3v1 field (if there is such)
+std::string tag::id3v2::ID3V2Parser::tailText(std::string_view apeKey, std::string_view tail::ID3V1::* id3v1Field) const {
+    if (auto value = _tail.apeItem(apeKey); !value.empty()) {
+        return std::string(value);
+    }
+    if (_tail.id3v1 && id3v1Field) {
+        std::string_view value = (*_tail.id3v1).*id3v1Field;
+        return asUtf8String_ascii((uint8_t*)value.data(), value.size());
+    }
+    return "";
+}
+
 std::string tag::id3v2::ID3V2Parser::songTitle() {
-    return std::get<1>(Textual("TIT2"));
+    std::string res = std::get<1>(Textual("TIT2"));
+    return res.empty() ? tailText("Title", &tail::ID3V1::title) : res;
 }
 
 std::string tag::id3v2::ID3V2Parser::album() {
-    return std::get<1>(Textual("TALB"));
+    std::string res = std::get<1>(Textual("TALB"));
+    return res.empty() ? tailText("Album", &tail::ID3V1::album) : res;
 }
 
 std::string tag::id3v2::ID3V2Parser::artist() {
-    return std::get<1>(Textual("TPE1"));
+    std::string res = std::get<1>(Textual("TPE1"));
+    return res.empty() ? tailText("Artist", &tail::ID3V1::artist) : res;
 }
 
 std::string tag::id3v2::ID3V2Parser::year() {
-    return std::get<1>(Textual("TYER"));
+    std::string res = std::get<1>(Textual("TYER"));
+    return res.empty() ? tailText("Year", &tail::ID3V1::year) : res;
 }
 
 std::string tag::id3v2::ID3V2Parser::trackNumber() {
-    return std::get<1>(Textual("TRCK"));
+    std::string res = std::get<1>(Textual("TRCK"));
+    if (res.empty()) {
+        res = tailText("Track", nullptr);
+    }
+    if (res.empty() && _tail.id3v1 && _tail.id3v1->track) {
+        res = std::to_string(_tail.id3v1->track);
+    }
+    return res;
 }
 
 std::string tag::id3v2::ID3V2Parser::comment() {
     auto comment = COMM();
     if (comment.empty()) {
-        return "";
+        return tailText("Comment", &tail::ID3V1::comment);
     }
     return std::get<3>(comment.front());
 }
@@ -339,11 +524,35 @@ std::vector<tag::user::APICUserData> tag::id3v2::ID3V2Parser::image() {
     auto images = APIC();
     std::vector<tag::user::APICUserData> res;
     for (auto& image : images) {
-        res.push_back({(user::ImageType)std::get<2>(image), std::get<1>(image), std::get<4>(image)});
+        res.push_back({(user::ImageType)std::get<2>(image), std::get<1>(image), intern(std::get<4>(image)), std::nullopt});
     }
     return res;
 }
 
+std::vector<tag::user::APICUserData> tag::id3v2::ID3V2Parser::imageLocations() {
+    if (!extractor) {
+        return {};
+    }
+    return static_cast<ID3V2Extractor&>(*extractor).imageLocations();
+}
+
 size_t tag::id3v2::ID3V2Parser::durationMs() {
-    return _durationMs;
+    return _durationMs.value_or(0);
+}
+
+const seek::Index& tag::id3v2::ID3V2Parser::seekIndex() {
+    if (!_seekIndex) {
+        _seekIndex.emplace();
+        _src->seek(_audioBegin);
+        try {
+            mp3::getMp3FileDuration(*_src, std::max(_tail.audioEnd, _audioBegin), &*_seekIndex);
+        }
+        catch (mp3::Mp3FrameParser::EOFException&) {
+            ;
+        }
+        catch (mp3::Mp3FrameParser::NoFrameException&) {
+            ;
+        }
+    }
+    return *_seekIndex;
 }
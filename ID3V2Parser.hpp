@@ -11,6 +11,9 @@
 #include <list>
 #include "util.hpp"
 #include "Tag.hpp"
+#include "ByteSource.hpp"
+#include "TailTags.hpp"
+#include "SeekIndex.hpp"
 
 namespace tag {
     namespace id3v2 {
@@ -21,55 +24,96 @@ namespace tag {
         using WUrlFrameReader = FrameReader<AsciiStrNullTerminated>;
         using WXXXReader = FrameReader<EncodingByte, EncodedStrNullTerminated, AsciiStrNullTerminated>;
         using COMMReader = FrameReader<EncodingByte, AsciiStrSized<3>, EncodedStrNullTerminated, EncodedStrNullTerminated>;
+        // results point into frame data (or TextBuffer, given to readFrame) - nothing is copied, if text is UTF-8 or ASCII
+        using APICViewReader = FrameReader<EncodingByte, AsciiStrNullTerminatedView, Byte, EncodedStrNullTerminatedView, BinaryDataView>;
+        using TextualFrameViewReader = FrameReader<EncodingByte, EncodedStrNullTerminatedView>;
+        using TXXXViewReader = FrameReader<EncodingByte, EncodedStrNullTerminatedView, EncodedStrNullTerminatedView>;
+        using WUrlFrameViewReader = FrameReader<AsciiStrNullTerminatedView>;
+        using WXXXViewReader = FrameReader<EncodingByte, EncodedStrNullTerminatedView, AsciiStrNullTerminatedView>;
+        using COMMViewReader = FrameReader<EncodingByte, AsciiStrSizedView<3>, EncodedStrNullTerminatedView, EncodedStrNullTerminatedView>;
 
 
         class ID3V2Extractor : public Extractor {
         public:
             struct Frame {
+                FrameId id = NoFrameId;
+                // size and flags are read at once
                 uint32_t size = 0;
                 uint16_t flags = 0;
+                // empty until payload is loaded (lazy mode)
                 Data data;
+                // payload offset in source
+                uint64_t offset = 0;
             };
-            using Frames = std::unordered_map<std::string, std::list<Frame>>;
+            // in order of the tag; frames with same id are found by linear scan - tags are small
+            using Frames = std::pmr::vector<Frame>;
+            // bytes after the tag, loaded together with it: padding and first mp3 frame
+            static constexpr size_t AudioProbeSize = 4096;
 
-            ID3V2Extractor(std::ifstream& fs);
+            // offset - of tag header; tags may also be appended to audio or follow SEEK frame
+            ID3V2Extractor(const std::shared_ptr<io::ByteSource>& src, const ExtractorConfig& config = {}, uint64_t offset = 0);
+            /*
+                Reads update tag at offset (ID3v2.4 SEEK target or tag, appended to the file):
+                its frames replace frames with the same ids. Returns false if there is no valid tag.
+            */
+            bool mergeTag(uint64_t offset);
             inline Frames& frames() { return _frames; }
+            inline uint64_t offset() const { return _offset; }
+            // end of header, frames, padding and footer
+            inline uint64_t tagEnd() const { return _offset + (hasFooter() ? 20 : 10) + _size; }
             inline uint32_t size() const { return _size; }
             inline bool unsynchronisation() const { return _flags & ((uint8_t)1<<7); }
             inline bool extendedHeader() const { return _flags & ((uint8_t)1<<6); }
             inline bool experimental() const { return _flags & ((uint8_t)1<<5); }
             inline bool hasFooter() const { return (_version == 4) && (_flags & ((uint8_t)1 << 4) ); }
             inline uint8_t version() const { return _version; }
-            std::list<std::pair<Extractor::Data, size_t>> framesData(const std::string& frameName) override;
+            inline bool lazy() const { return config.lazy; }
+            using Extractor::frameData;
+            using Extractor::framesData;
+            std::pair<Data, size_t> frameData(FrameId id) override;
+            FramesData framesData(FrameId id) override;
+            inline FrameId frameId(std::string_view frameName) const override { return fourcc(frameName); }
             std::vector<std::string> frameTitles() const override;
+            // APIC frames, stored as they are (not compressed, encrypted or unsynchronised); only heads of deferred frames are read
+            std::vector<user::APICUserData> imageLocations();
         private:
-            void init(std::ifstream& fs);
-            bool checkFile(std::ifstream& fs);
-            int extractHeader(std::ifstream& fs);
-            size_t extractSize(std::ifstream& fs);
-            int extractFrames(std::ifstream& fs);
-            int extractFramesFooter(std::ifstream& fs);
-            int extractFrame(std::ifstream& fs);
-            int extractFrameV22(std::ifstream& fs);
-            void skipPadding(std::ifstream& fs);
-            void syncLookup(std::ifstream& fs);
+            void init(io::ByteSource& src);
+            bool checkFile(io::ByteSource& src);
+            int extractHeader(io::ByteSource& src);
+            size_t extractSize(io::ByteSource& src);
+            int extractFrames(io::ByteSource& src);
+            int extractFramesFooter(io::ByteSource& src);
+            // end - of frames area; frames do not cross it
+            int extractFrame(io::ByteSource& src, uint64_t end);
+            int extractFrameV22(io::ByteSource& src, uint64_t end);
+            void storeFrame(io::ByteSource& src, std::string_view frameName, Frame& frame);
+            const Frame* find(FrameId id) const;
+            void skipPadding(io::ByteSource& src);
+            void syncLookup(io::ByteSource& src);
+            Data load(Frame& frame);
+            std::shared_ptr<io::ByteSource> src;
+            ExtractorConfig config;
             Frames _frames;
             uint8_t _flags = 0;
             uint32_t _size = 0;
             uint8_t _version = 0;
-            size_t fileSize = 0;
+            uint64_t _offset = 0;
+            // payload of SEEK frame - kept even if filter drops the frame; 0 - none
+            uint64_t _seekOffset = 0;
         };
 
 
         class ID3V2Parser : public Tag {
         public:
-            ID3V2Parser(std::ifstream& fs);
-            inline std::list<APICReader::ResultType> APIC() { return readFrames<APICReader>("APIC"); }
-            inline TextualFrameReader::ResultType Textual(const std::string& frameName) { return readFrame<TextualFrameReader>(frameName); }
-            inline std::list<TXXXReader::ResultType> TXXX() { return readFrames<TXXXReader>("TXXX"); }
-            inline std::list<WUrlFrameReader::ResultType> WUrl(const std::string& frameName) { return readFrames<WUrlFrameReader>(frameName); }
-            inline std::list<WXXXReader::ResultType> WXXX() { return readFrames<WXXXReader>("WXXX"); }
-            inline std::list<COMMReader::ResultType> COMM() { return readFrames<COMMReader>("COMM"); }
+            ID3V2Parser(const std::shared_ptr<io::ByteSource>& src, const ExtractorConfig& config = {});
+            inline std::pmr::list<APICReader::ResultType> APIC() { return readFrames<APICReader>(fourcc("APIC")); }
+            inline TextualFrameReader::ResultType Textual(const std::string& frameName) { return readFrame<TextualFrameReader>(fourcc(frameName)); }
+            inline std::pmr::list<TXXXReader::ResultType> TXXX() { return readFrames<TXXXReader>(fourcc("TXXX")); }
+            inline std::pmr::list<WUrlFrameReader::ResultType> WUrl(const std::string& frameName) { return readFrames<WUrlFrameReader>(fourcc(frameName)); }
+            inline std::pmr::list<WXXXReader::ResultType> WXXX() { return readFrames<WXXXReader>(fourcc("WXXX")); }
+            inline std::pmr::list<COMMReader::ResultType> COMM() { return readFrames<COMMReader>(fourcc("COMM")); }
+            // text of the frame without copying; valid while parser and text are
+            inline TextualFrameViewReader::ResultType TextualView(const std::string& frameName, TextBuffer& text) { return readFrame<TextualFrameViewReader>(fourcc(frameName), &text); }
 
             std::string songTitle() override;
             std::string album() override;
@@ -78,38 +122,57 @@ namespace tag {
             std::string trackNumber() override;
             std::string comment() override;
             std::vector<user::APICUserData> image() override;
+            std::vector<user::APICUserData> imageLocations() override;
             size_t durationMs() override;
+            // ID3v1, APEv2 and appended ID3v2 tags; text getters fall back to first two; empty without ExtractorConfig::tailTags
+            inline const tail::TailTags& tailTags() const { return _tail; }
+            // time to frame offset, from Xing TOC or walk of frames; built on first call, unless ExtractorConfig::seekIndex was set
+            const seek::Index& seekIndex();
 
+            // text - for strings, which view readers have to transcode
             template<typename ReaderType>
-            typename ReaderType::ResultType readFrame(const std::string& frameName);
+            typename ReaderType::ResultType readFrame(FrameId id, TextBuffer* text = nullptr);
+            // list is allocated from memory resource of the parser
             template<typename ReaderType>
-            std::list<typename ReaderType::ResultType> readFrames(const std::string& frameName);
-            int64_t _durationMs = -1;
+            std::pmr::list<typename ReaderType::ResultType> readFrames(FrameId id, TextBuffer* text = nullptr);
+        private:
+            // nullopt - there is no audio, which duration could be found
+            std::optional<size_t> _durationMs;
+            std::string tailText(std::string_view apeKey, std::string_view tail::ID3V1::* id3v1Field) const;
+            tail::TailTags _tail;
+            // audio is found again for seekIndex()
+            std::shared_ptr<io::ByteSource> _src;
+            uint64_t _audioBegin = 0;
+            std::optional<seek::Index> _seekIndex;
         };
 
         template<typename ReaderType>
-        typename ReaderType::ResultType ID3V2Parser::readFrame(const std::string& frameName) {
+        typename ReaderType::ResultType ID3V2Parser::readFrame(FrameId id, TextBuffer* text) {
             if (!extractor) {
                 return {};
             }
-            auto frames = extractor->framesData(frameName);
-            if (frames.empty()) return {};
-            auto [data, size] = frames.front();
+            auto [data, size] = extractor->frameData(id);
             if (!data || !size) {
                 return {};
             }
-            return ReaderType().read(DataBlock(data.get(), size));
+            DataBlock block(data, size);
+            block.memory = memory;
+            block.text = text;
+            return ReaderType().read(block);
         }
 
         template<typename ReaderType>
-        std::list<typename ReaderType::ResultType> ID3V2Parser::readFrames(const std::string& frameName) {
+        std::pmr::list<typename ReaderType::ResultType> ID3V2Parser::readFrames(FrameId id, TextBuffer* text) {
+            std::pmr::list<typename ReaderType::ResultType> res(memory);
             if (!extractor) {
-                return {};
+                return res;
             }
-            auto frames = extractor->framesData(frameName);
-            std::list<typename ReaderType::ResultType> res;
+            auto frames = extractor->framesData(id);
             for (auto& [data, size] : frames) {
-                res.push_back(ReaderType().read(DataBlock(data.get(), size)));
+                DataBlock block(data, size);
+                block.memory = memory;
+                block.text = text;
+                res.push_back(ReaderType().read(block));
             }
             return res;
         }
@@ -0,0 +1,154 @@
+#include "ImageStore.hpp"
+#include <string.h>
+
+using namespace tag;
+
+namespace {
+
+    constexpr uint64_t Prime1 = 0x9e3779b185ebca87ull;
+    constexpr uint64_t Prime2 = 0xc2b2ae3d27d4eb4full;
+    constexpr uint64_t Prime3 = 0x165667b19e3779f9ull;
+    constexpr uint64_t Prime4 = 0x85ebca77c2b2ae63ull;
+    constexpr uint64_t Prime5 = 0x27d4eb2f165667c5ull;
+
+    inline uint64_t rotl(uint64_t x, int r) {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    // little endian, as XXH64 is defined
+    inline uint64_t read64(const uint8_t* p) {
+        uint64_t res;
+        memcpy(&res, p, sizeof(res));
+        return res;
+    }
+
+    inline uint32_t read32(const uint8_t* p) {
+        uint32_t res;
+        memcpy(&res, p, sizeof(res));
+        return res;
+    }
+
+    inline uint64_t lane(uint64_t acc, uint64_t input) {
+        acc += input * Prime2;
+        return rotl(acc, 31) * Prime1;
+    }
+
+    inline uint64_t mergeLane(uint64_t acc, uint64_t val) {
+        acc ^= lane(0, val);
+        return acc * Prime1 + Prime4;
+    }
+
+}
+
+uint64_t tag::ImageStore::hash(const uint8_t* data, size_t n, uint64_t seed) {
+    const uint8_t* p = data;
+    const uint8_t* end = data + n;
+    uint64_t h;
+    if (n >= 32) {
+        // 4 independent lanes over 32 byte stripes
+        uint64_t v1 = seed + Prime1 + Prime2;
+        uint64_t v2 = seed + Prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - Prime1;
+        for (; (end - p) >= 32; p += 32) {
+            v1 = lane(v1, read64(p));
+            v2 = lane(v2, read64(p + 8));
+            v3 = lane(v3, read64(p + 16));
+            v4 = lane(v4, read64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = mergeLane(h, v1);
+        h = mergeLane(h, v2);
+        h = mergeLane(h, v3);
+        h = mergeLane(h, v4);
+    }
+    else {
+        h = seed + Prime5;
+    }
+    h += n;
+    for (; (end - p) >= 8; p += 8) {
+        h ^= lane(0, read64(p));
+        h = rotl(h, 27) * Prime1 + Prime4;
+    }
+    if ((end - p) >= 4) {
+        h ^= (uint64_t)read32(p) * Prime1;
+        h = rotl(h, 23) * Prime2 + Prime3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h ^= *p * Prime5;
+        h = rotl(h, 11) * Prime1;
+    }
+    h ^= h >> 33;
+    h *= Prime2;
+    h ^= h >> 29;
+    h *= Prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+tag::ImageStore::ImageStore(size_t capacity)
+    : capacity{capacity}
+{}
+
+BinaryData::Data tag::ImageStore::intern(const BinaryData::Data& data) {
+    auto [bytes, size] = data;
+    if (!bytes || !size) {
+        return data;
+    }
+    // outside of lock - it is the expensive part
+    uint64_t h = hash(bytes.get(), size);
+    std::lock_guard lock(mtx);
+    ++_stats.lookups;
+    _stats.bytesReturned += size;
+    auto [first, last] = index.equal_range(h);
+    for (auto iter = first; iter != last; ++iter) {
+        Lru::iterator entry = iter->second;
+        if ((entry->data.second == size) && !memcmp(entry->data.first.get(), bytes.get(), size)) {
+            ++_stats.hits;
+            lru.splice(lru.begin(), lru, entry);
+            return entry->data;
+        }
+    }
+    if (size > capacity) {
+        return data;
+    }
+    BinaryData::Data copy{std::shared_ptr<uint8_t[]>(new uint8_t[size]), size};
+    memcpy(copy.first.get(), bytes.get(), size);
+    lru.push_front(Entry{h, copy});
+    index.emplace(h, lru.begin());
+    _stats.bytesStored += size;
+    ++_stats.images;
+    evict();
+    return copy;
+}
+
+void tag::ImageStore::evict() {
+    while ((_stats.bytesStored > capacity) && !lru.empty()) {
+        Lru::iterator victim = std::prev(lru.end());
+        auto [first, last] = index.equal_range(victim->hash);
+        for (auto iter = first; iter != last; ++iter) {
+            if (iter->second == victim) {
+                index.erase(iter);
+                break;
+            }
+        }
+        _stats.bytesStored -= victim->data.second;
+        --_stats.images;
+        ++_stats.evictions;
+        lru.erase(victim);
+    }
+}
+
+ImageStore::Stats tag::ImageStore::stats() const {
+    std::lock_guard lock(mtx);
+    return _stats;
+}
+
+void tag::ImageStore::clear() {
+    std::lock_guard lock(mtx);
+    index.clear();
+    lru.clear();
+    _stats.bytesStored = 0;
+    _stats.images = 0;
+}
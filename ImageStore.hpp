@@ -0,0 +1,62 @@
+#ifndef IMAGESTORE_HPP
+#define IMAGESTORE_HPP
+#include <cstdint>
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include "Tag.hpp"
+
+namespace tag {
+
+    /*
+        Pictures, which are the same in many files (album cover in every track), kept once.
+        Pictures are found by hash of their bytes and compared byte by byte, so hash collisions do no harm.
+        When stored bytes exceed capacity, least recently used pictures are dropped - callers, which hold them, keep them alive.
+        Thread safe.
+    */
+    class ImageStore {
+    public:
+        struct Stats {
+            // intern calls and those of them, which found stored picture
+            uint64_t lookups = 0;
+            uint64_t hits = 0;
+            // bytes, given to callers, and bytes, held by store now
+            uint64_t bytesReturned = 0;
+            uint64_t bytesStored = 0;
+            size_t images = 0;
+            uint64_t evictions = 0;
+        };
+        static constexpr size_t DefaultCapacity = 64 * 1024 * 1024;
+
+        ImageStore(size_t capacity = DefaultCapacity);
+        ImageStore(const ImageStore&) = delete;
+        ImageStore& operator=(const ImageStore&) = delete;
+        /*
+            Returns stored picture with the same bytes as data. New pictures are copied into store,
+            as data may be a view into bigger buffer (whole tag); pictures bigger than capacity are returned as they are.
+        */
+        BinaryData::Data intern(const BinaryData::Data& data);
+        Stats stats() const;
+        void clear();
+        // XXH64
+        static uint64_t hash(const uint8_t* data, size_t n, uint64_t seed = 0);
+    private:
+        struct Entry {
+            uint64_t hash;
+            BinaryData::Data data;
+        };
+        using Lru = std::list<Entry>;
+        // drops least recently used pictures until stored bytes fit into capacity
+        void evict();
+        size_t capacity;
+        mutable std::mutex mtx;
+        // most recently used first
+        Lru lru;
+        std::unordered_multimap<uint64_t, Lru::iterator> index;
+        Stats _stats;
+    };
+
+}
+
+#endif // IMAGESTORE_HPP
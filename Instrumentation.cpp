@@ -0,0 +1,289 @@
+#include "Instrumentation.hpp"
+#ifdef METATAGS_INSTRUMENTATION
+#include <mutex>
+#include <new>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+using namespace instr;
+
+namespace {
+
+    using Clock = std::chrono::steady_clock;
+
+    /*
+        Counters of current file, merged into totals when file ends.
+        Only trivial members - operator new uses it, so it must not need dynamic initialization.
+    */
+    struct ThreadState {
+        // open file and phase scopes; nothing is counted outside of them
+        uint32_t depth = 0;
+        uint32_t fileDepth = 0;
+        Phase phase = Phase::Other;
+        tag::Format format = tag::Format::Unknown;
+        int64_t since = 0;
+        uint64_t lastReadEnd = 0;
+        Counters counters[PhaseCount];
+    };
+
+    thread_local ThreadState state;
+
+    std::mutex mtx;
+    Totals allTotals;
+    std::shared_ptr<Sink> sink = std::make_shared<StreamSink>(std::cerr);
+
+    int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+    // time since last boundary goes to current phase
+    void tick() {
+        int64_t t = now();
+        state.counters[(size_t)state.phase].ns += t - state.since;
+        state.since = t;
+    }
+
+    void flush(bool file) {
+        std::lock_guard lock(mtx);
+        size_t format = (size_t)state.format;
+        allTotals.files[format] += file;
+        for (size_t i = 0; i < PhaseCount; ++i) {
+            allTotals.counters[format][i] += state.counters[i];
+            state.counters[i] = Counters{};
+        }
+    }
+
+    void allocated(size_t n) {
+        if (state.depth) {
+            Counters& counters = state.counters[(size_t)state.phase];
+            ++counters.allocations;
+            counters.allocatedBytes += n;
+        }
+    }
+
+}
+
+const char* instr::phaseName(Phase phase) {
+    static const char* names[PhaseCount] = {"other", "open", "cache", "sniff", "frames", "syncLookup", "duration", "decode", "asyncRead"};
+    return names[(size_t)phase];
+}
+
+Counters& instr::Counters::operator+=(const Counters& other) {
+    calls += other.calls;
+    ns += other.ns;
+    bytesRead += other.bytesRead;
+    reads += other.reads;
+    seeks += other.seeks;
+    allocations += other.allocations;
+    allocatedBytes += other.allocatedBytes;
+    return *this;
+}
+
+Counters& instr::Counters::operator-=(const Counters& other) {
+    calls -= other.calls;
+    ns -= other.ns;
+    bytesRead -= other.bytesRead;
+    reads -= other.reads;
+    seeks -= other.seeks;
+    allocations -= other.allocations;
+    allocatedBytes -= other.allocatedBytes;
+    return *this;
+}
+
+Totals& instr::Totals::operator-=(const Totals& other) {
+    for (size_t format = 0; format < FormatCount; ++format) {
+        files[format] -= other.files[format];
+        for (size_t phase = 0; phase < PhaseCount; ++phase) {
+            counters[format][phase] -= other.counters[format][phase];
+        }
+    }
+    return *this;
+}
+
+Totals instr::totals() {
+    std::lock_guard lock(mtx);
+    return allTotals;
+}
+
+void instr::dump(std::ostream& os, const Totals& totals) {
+    static const char* formats[FormatCount] = {"unknown", "mp3", "flac", "wav"};
+    auto flags = os.flags();
+    os << std::left << std::setw(8) << "format" << std::setw(12) << "phase" << std::right
+       << std::setw(10) << "calls" << std::setw(12) << "ms" << std::setw(12) << "MB read"
+       << std::setw(10) << "reads" << std::setw(10) << "seeks" << std::setw(10) << "allocs" << std::setw(12) << "alloc MB" << "\n";
+    os << std::fixed << std::setprecision(3);
+    for (size_t format = 0; format < FormatCount; ++format) {
+        Counters sum;
+        for (size_t phase = 0; phase < PhaseCount; ++phase) {
+            const Counters& c = totals.counters[format][phase];
+            sum += c;
+            if (!c.calls && !c.ns && !c.reads && !c.allocations) {
+                continue;
+            }
+            os << std::left << std::setw(8) << formats[format] << std::setw(12) << phaseName((Phase)phase) << std::right
+               << std::setw(10) << c.calls << std::setw(12) << c.ns / 1e6 << std::setw(12) << c.bytesRead / 1e6
+               << std::setw(10) << c.reads << std::setw(10) << c.seeks << std::setw(10) << c.allocations << std::setw(12) << c.allocatedBytes / 1e6 << "\n";
+        }
+        if (totals.files[format]) {
+            os << std::left << std::setw(8) << formats[format] << std::setw(12) << "all" << std::right
+               << std::setw(10) << totals.files[format] << std::setw(12) << sum.ns / 1e6 << std::setw(12) << sum.bytesRead / 1e6
+               << std::setw(10) << sum.reads << std::setw(10) << sum.seeks << std::setw(10) << sum.allocations << std::setw(12) << sum.allocatedBytes / 1e6 << "\n";
+        }
+    }
+    os.flags(flags);
+}
+
+void instr::StreamSink::scan(const std::string& name, double seconds, const Totals& totals) {
+    uint64_t files = 0;
+    for (uint64_t n : totals.files) {
+        files += n;
+    }
+    os << "scan " << name << ": " << files << " files in " << seconds << " s\n";
+    dump(os, totals);
+}
+
+void instr::setSink(std::shared_ptr<Sink> newSink) {
+    std::lock_guard lock(mtx);
+    sink = std::move(newSink);
+}
+
+void instr::read(uint64_t offset, size_t bytes) {
+    if (!state.depth) {
+        return;
+    }
+    Counters& counters = state.counters[(size_t)state.phase];
+    ++counters.reads;
+    counters.bytesRead += bytes;
+    counters.seeks += (offset != state.lastReadEnd);
+    state.lastReadEnd = offset + bytes;
+}
+
+void instr::asyncRead(uint64_t bytes, uint64_t reads) {
+    if (!state.depth) {
+        return;
+    }
+    Counters& counters = state.counters[(size_t)Phase::AsyncRead];
+    ++counters.calls;
+    counters.reads += reads;
+    counters.bytesRead += bytes;
+}
+
+void instr::setFormat(tag::Format format) {
+    state.format = format;
+}
+
+instr::PhaseScope::PhaseScope(Phase phase) : previous{state.phase} {
+    if (state.depth++) {
+        tick();
+    }
+    else {
+        state.since = now();
+    }
+    state.phase = phase;
+    ++state.counters[(size_t)phase].calls;
+}
+
+instr::PhaseScope::~PhaseScope() {
+    tick();
+    state.phase = previous;
+    if (!--state.depth) {
+        // phase outside of any file
+        flush(false);
+        state.format = tag::Format::Unknown;
+    }
+}
+
+instr::FileScope::FileScope() {
+    if (state.fileDepth++) {
+        return;
+    }
+    if (state.depth++) {
+        tick();
+    }
+    else {
+        state.since = now();
+    }
+    state.phase = Phase::Other;
+    state.format = tag::Format::Unknown;
+    state.lastReadEnd = 0;
+}
+
+instr::FileScope::~FileScope() {
+    if (--state.fileDepth) {
+        return;
+    }
+    tick();
+    --state.depth;
+    flush(true);
+    state.format = tag::Format::Unknown;
+}
+
+instr::ScanScope::ScanScope(std::string name)
+    : name{std::move(name)}, start{totals()}, begin{Clock::now()}
+{}
+
+instr::ScanScope::~ScanScope() {
+    double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+    Totals res = totals();
+    res -= start;
+    std::shared_ptr<Sink> current;
+    {
+        std::lock_guard lock(mtx);
+        current = sink;
+    }
+    if (current) {
+        current->scan(name, seconds, res);
+    }
+}
+
+/*
+    Global allocation functions count heap allocations of the current phase.
+    Array, nothrow and sized forms of the standard library call these.
+*/
+void* operator new(size_t n) {
+    allocated(n);
+    if (void* p = std::malloc(n ? n : 1)) {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+void* operator new(size_t n, std::align_val_t align) {
+    allocated(n);
+    size_t alignment = std::max<size_t>((size_t)align, sizeof(void*));
+#ifdef _WIN32
+    if (void* p = _aligned_malloc(n ? n : 1, alignment)) {
+        return p;
+    }
+#else
+    // aligned_alloc wants size multiple of alignment
+    if (void* p = std::aligned_alloc(alignment, std::max<size_t>((n + alignment - 1) / alignment * alignment, alignment))) {
+        return p;
+    }
+#endif
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void operator delete(void* p, size_t, std::align_val_t align) noexcept {
+    operator delete(p, align);
+}
+
+#endif // METATAGS_INSTRUMENTATION
@@ -0,0 +1,151 @@
+#ifndef INSTRUMENTATION_HPP
+#define INSTRUMENTATION_HPP
+
+/*
+    Optional per-phase timers and I/O / allocation counters of the scan path.
+    Built only with -DMETATAGS_INSTRUMENTATION=ON (cmake option); otherwise INSTR_* macros expand to nothing.
+
+    Parsers mark phase boundaries with INSTR_PHASE(name) - time of nested phases is not counted in outer ones.
+    Everything between INSTR_FILE() and the end of its scope is one file; its counters are added to the totals
+    of the format, given by INSTR_FORMAT, at the end. INSTR_SCAN(name) reports totals, gathered during its scope,
+    to the sink (StreamSink on std::cerr by default).
+*/
+#ifdef METATAGS_INSTRUMENTATION
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <ostream>
+#include "Format.hpp"
+
+namespace instr {
+
+    enum class Phase : uint8_t {
+        // inside of file, but not in any other phase
+        Other,
+        Open,
+        Cache,
+        Sniff,
+        Frames,
+        SyncLookup,
+        Duration,
+        Decode,
+        // reads done for the file by io_uring batch; only bytes and reads, time is not per file
+        AsyncRead,
+        Count
+    };
+
+    constexpr size_t PhaseCount = (size_t)Phase::Count;
+    constexpr size_t FormatCount = (size_t)tag::Format::Wav + 1;
+
+    const char* phaseName(Phase phase);
+
+    struct Counters {
+        uint64_t calls = 0;
+        uint64_t ns = 0;
+        uint64_t bytesRead = 0;
+        // read syscalls
+        uint64_t reads = 0;
+        // reads, which do not continue the previous one of the same file
+        uint64_t seeks = 0;
+        uint64_t allocations = 0;
+        uint64_t allocatedBytes = 0;
+
+        Counters& operator+=(const Counters& other);
+        Counters& operator-=(const Counters& other);
+    };
+
+    struct Totals {
+        uint64_t files[FormatCount] = {0};
+        Counters counters[FormatCount][PhaseCount];
+
+        Totals& operator-=(const Totals& other);
+    };
+
+    // sum over all threads since start of the process
+    Totals totals();
+    // table of non empty counters
+    void dump(std::ostream& os, const Totals& totals);
+
+    class Sink {
+    public:
+        virtual ~Sink() {}
+        virtual void scan(const std::string& name, double seconds, const Totals& totals) = 0;
+    };
+
+    class StreamSink : public Sink {
+    public:
+        StreamSink(std::ostream& os) : os{os} {}
+        void scan(const std::string& name, double seconds, const Totals& totals) override;
+    private:
+        std::ostream& os;
+    };
+
+    // nullptr - scans are not reported
+    void setSink(std::shared_ptr<Sink> sink);
+
+    // called by byte sources for every read syscall
+    void read(uint64_t offset, size_t bytes);
+    // bytes, loaded for current file elsewhere (e.g. by io_uring)
+    void asyncRead(uint64_t bytes, uint64_t reads);
+    void setFormat(tag::Format format);
+
+    class PhaseScope {
+    public:
+        PhaseScope(Phase phase);
+        ~PhaseScope();
+        PhaseScope(const PhaseScope&) = delete;
+        PhaseScope& operator=(const PhaseScope&) = delete;
+    private:
+        Phase previous;
+    };
+
+    // nested file scopes are parts of the outer one
+    class FileScope {
+    public:
+        FileScope();
+        ~FileScope();
+        FileScope(const FileScope&) = delete;
+        FileScope& operator=(const FileScope&) = delete;
+    };
+
+    /*
+        Reports difference of totals between construction and destruction.
+        Work of other threads in that time (e.g. concurrent scans) is included too.
+    */
+    class ScanScope {
+    public:
+        ScanScope(std::string name);
+        ~ScanScope();
+        ScanScope(const ScanScope&) = delete;
+        ScanScope& operator=(const ScanScope&) = delete;
+    private:
+        std::string name;
+        Totals start;
+        std::chrono::steady_clock::time_point begin;
+    };
+
+}
+
+#define INSTR_CAT_(a, b) a##b
+#define INSTR_CAT(a, b) INSTR_CAT_(a, b)
+#define INSTR_PHASE(phase) instr::PhaseScope INSTR_CAT(instrPhase, __LINE__)(instr::Phase::phase)
+#define INSTR_FILE() instr::FileScope INSTR_CAT(instrFile, __LINE__)
+#define INSTR_FORMAT(format) instr::setFormat(format)
+#define INSTR_SCAN(name) instr::ScanScope INSTR_CAT(instrScan, __LINE__)(name)
+#define INSTR_READ(offset, bytes) instr::read(offset, bytes)
+#define INSTR_ASYNC_READ(bytes, reads) instr::asyncRead(bytes, reads)
+
+#else
+
+#define INSTR_PHASE(phase) ((void)0)
+#define INSTR_FILE() ((void)0)
+#define INSTR_FORMAT(format) ((void)0)
+#define INSTR_SCAN(name) ((void)0)
+#define INSTR_READ(offset, bytes) ((void)0)
+#define INSTR_ASYNC_READ(bytes, reads) ((void)0)
+
+#endif // METATAGS_INSTRUMENTATION
+
+#endif // INSTRUMENTATION_HPP
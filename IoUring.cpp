@@ -0,0 +1,190 @@
+#include "IoUring.hpp"
+#ifdef __linux__
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <memory>
+
+using namespace io;
+
+io::Uring::Uring(unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) {
+        throw SetupException{};
+    }
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap) {
+        sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+    }
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+        sqRing = nullptr;
+        release();
+        throw SetupException{};
+    }
+    if (singleMmap) {
+        cqRing = sqRing;
+    }
+    else {
+        cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) {
+            cqRing = nullptr;
+            release();
+            throw SetupException{};
+        }
+    }
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqesAddr = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqesAddr == MAP_FAILED) {
+        release();
+        throw SetupException{};
+    }
+    sqes = (io_uring_sqe*)sqesAddr;
+    uint8_t* sq = (uint8_t*)sqRing;
+    sqHead = (unsigned*)(sq + params.sq_off.head);
+    sqTail = (unsigned*)(sq + params.sq_off.tail);
+    sqArray = (unsigned*)(sq + params.sq_off.array);
+    sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    sqEntries = params.sq_entries;
+    uint8_t* cq = (uint8_t*)cqRing;
+    cqHead = (unsigned*)(cq + params.cq_off.head);
+    cqTail = (unsigned*)(cq + params.cq_off.tail);
+    cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    localTail = *sqTail;
+}
+
+io::Uring::~Uring() {
+    release();
+}
+
+void io::Uring::release() {
+    if (sqes) {
+        munmap(sqes, sqesSize);
+    }
+    if (cqRing && (cqRing != sqRing)) {
+        munmap(cqRing, cqRingSize);
+    }
+    if (sqRing) {
+        munmap(sqRing, sqRingSize);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    sqes = nullptr;
+    cqRing = sqRing = nullptr;
+    fd = -1;
+}
+
+io_uring_sqe* io::Uring::sqe() {
+    if ((localTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE)) >= sqEntries) {
+        return nullptr;
+    }
+    unsigned idx = localTail & sqMask;
+    io_uring_sqe* res = &sqes[idx];
+    memset(res, 0, sizeof(*res));
+    sqArray[idx] = idx;
+    ++localTail;
+    ++toSubmit;
+    return res;
+}
+
+bool io::Uring::prepOpen(const char* path, int flags, uint64_t userData) {
+    io_uring_sqe* entry = sqe();
+    if (!entry) {
+        return false;
+    }
+    entry->opcode = IORING_OP_OPENAT;
+    entry->fd = AT_FDCWD;
+    entry->addr = (uint64_t)path;
+    entry->open_flags = flags;
+    entry->user_data = userData;
+    return true;
+}
+
+bool io::Uring::prepRead(int fd, void* dst, uint32_t n, uint64_t offset, uint64_t userData) {
+    io_uring_sqe* entry = sqe();
+    if (!entry) {
+        return false;
+    }
+    entry->opcode = IORING_OP_READ;
+    entry->fd = fd;
+    entry->addr = (uint64_t)dst;
+    entry->len = n;
+    entry->off = offset;
+    entry->user_data = userData;
+    return true;
+}
+
+void io::Uring::submit(unsigned minComplete) {
+    // entries must be written before kernel sees new tail
+    __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+    unsigned flags = minComplete ? IORING_ENTER_GETEVENTS : 0;
+    while (true) {
+        int res = (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+        if (res >= 0) {
+            _inflight += std::min<unsigned>(res, toSubmit);
+            toSubmit -= std::min<unsigned>(res, toSubmit);
+            // kernel may take only a part of entries; rest is submitted with next call
+            if (!toSubmit || minComplete) {
+                return;
+            }
+        }
+        // completion queue is full or kernel is short of memory - caller has to reap completions first
+        else if ((errno == EAGAIN) || (errno == EBUSY)) {
+            return;
+        }
+        else if (errno != EINTR) {
+            throw SetupException{};
+        }
+    }
+}
+
+const io_uring_cqe* io::Uring::peek() const {
+    unsigned head = *cqHead;
+    if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+        return nullptr;
+    }
+    return &cqes[head & cqMask];
+}
+
+void io::Uring::pop() {
+    __atomic_store_n(cqHead, *cqHead + 1, __ATOMIC_RELEASE);
+    --_inflight;
+}
+
+bool io::Uring::drain() {
+    while (true) {
+        while (peek()) {
+            pop();
+        }
+        if (!_inflight) {
+            return true;
+        }
+        int res = (int)syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if ((res < 0) && (errno != EINTR) && (errno != EBUSY)) {
+            return false;
+        }
+    }
+}
+
+bool io::Uring::supports(uint8_t opcode) const {
+    // probe with all ops, known to kernel; last_op - the highest of them
+    static constexpr size_t MaxOps = 256;
+    std::unique_ptr<uint8_t[]> buf(new uint8_t[sizeof(io_uring_probe) + MaxOps * sizeof(io_uring_probe_op)]());
+    io_uring_probe* probe = (io_uring_probe*)buf.get();
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, MaxOps) < 0) {
+        return false;
+    }
+    return (opcode <= probe->last_op) && (opcode < probe->ops_len) && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef IOURING_HPP
+#define IOURING_HPP
+#ifdef __linux__
+#include <cstdint>
+#include <cstddef>
+#include <exception>
+#include <linux/io_uring.h>
+
+namespace io {
+
+    /*
+        Minimal io_uring wrapper over raw syscalls (no liburing).
+        One thread only: entries are prepared and completions are reaped by the thread, which owns the ring.
+    */
+    class Uring {
+    public:
+        class SetupException : public std::exception {};
+
+        // throws SetupException, if io_uring is not available (old kernel, seccomp...)
+        Uring(unsigned entries);
+        ~Uring();
+        Uring(const Uring&) = delete;
+        Uring& operator=(const Uring&) = delete;
+        // returns nullptr, if submission queue is full (submit should be called then)
+        io_uring_sqe* sqe();
+        bool prepOpen(const char* path, int flags, uint64_t userData);
+        bool prepRead(int fd, void* dst, uint32_t n, uint64_t offset, uint64_t userData);
+        // submits prepared entries and waits until there are at least minComplete completions
+        void submit(unsigned minComplete = 0);
+        // returns oldest completion or nullptr; it stays valid until pop
+        const io_uring_cqe* peek() const;
+        void pop();
+        // entries, taken by kernel, which completions are not popped yet
+        inline unsigned inflight() const { return _inflight; }
+        /*
+            Waits for completions of all entries, taken by kernel, and drops them; prepared entries are not submitted.
+            False, if kernel refuses to wait - entries may still write into their buffers then.
+        */
+        bool drain();
+        // IORING_REGISTER_PROBE; kernels before 5.6 have no probe (and no IORING_OP_OPENAT) - false for every opcode
+        bool supports(uint8_t opcode) const;
+    private:
+        void release();
+
+        int fd = -1;
+        void* sqRing = nullptr;
+        size_t sqRingSize = 0;
+        void* cqRing = nullptr;
+        size_t cqRingSize = 0;
+        io_uring_sqe* sqes = nullptr;
+        size_t sqesSize = 0;
+        unsigned* sqHead = nullptr;
+        unsigned* sqTail = nullptr;
+        unsigned* sqArray = nullptr;
+        unsigned sqMask = 0;
+        unsigned sqEntries = 0;
+        unsigned* cqHead = nullptr;
+        unsigned* cqTail = nullptr;
+        unsigned cqMask = 0;
+        io_uring_cqe* cqes = nullptr;
+        // prepared, but not yet published to kernel
+        unsigned localTail = 0;
+        unsigned toSubmit = 0;
+        unsigned _inflight = 0;
+    };
+
+}
+
+#endif
+#endif // IOURING_HPP
@@ -0,0 +1,369 @@
+#include "MetaCache.hpp"
+#include <fstream>
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+using namespace cache;
+namespace fs = std::filesystem;
+
+namespace {
+
+    /*
+        Log layout (native byte order - cache is not meant to be moved between machines):
+            magic, version
+            records: payload size (4 bytes), payload checksum (4 bytes), payload
+        Payload: key, groups, then fields of every present group in Group order.
+    */
+    constexpr char Magic[8] = {'M', 'T', 'P', 'C', 'A', 'C', 'H', 'E'};
+    constexpr uint32_t Version = 2;
+    constexpr size_t HeaderSize = sizeof(Magic) + sizeof(Version);
+    constexpr size_t RecordHeaderSize = 8;
+    // pending records are written when they get bigger than that
+    constexpr size_t FlushThreshold = 1 << 20;
+    // dead records, which are tolerated before compaction
+    constexpr size_t CompactionSlack = 1024;
+
+    uint32_t fnv1a(const char* data, size_t n) {
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < n; ++i) {
+            hash = (hash ^ (uint8_t)data[i]) * 16777619u;
+        }
+        return hash;
+    }
+
+    template<typename T>
+    void putInt(std::string& out, T val) {
+        out.append((const char*)&val, sizeof(T));
+    }
+
+    void putStr(std::string& out, const std::string& str) {
+        putInt<uint32_t>(out, str.size());
+        out.append(str);
+    }
+
+    // reads payload; on overrun ok is reset and zeros are returned
+    struct Reader {
+        const char* cur;
+        const char* end;
+        bool ok = true;
+
+        template<typename T>
+        T get() {
+            T val{};
+            if ((size_t)(end - cur) < sizeof(T)) {
+                ok = false;
+                return val;
+            }
+            memcpy(&val, cur, sizeof(T));
+            cur += sizeof(T);
+            return val;
+        }
+
+        std::string str() {
+            uint32_t len = get<uint32_t>();
+            if ((size_t)(end - cur) < len) {
+                ok = false;
+                return "";
+            }
+            std::string res(cur, len);
+            cur += len;
+            return res;
+        }
+    };
+
+    void serialize(std::string& out, const Entry& entry) {
+        size_t begin = out.size();
+        out.resize(begin + RecordHeaderSize);
+        putInt(out, entry.key.dev);
+        putInt(out, entry.key.ino);
+        putInt(out, entry.key.size);
+        putInt(out, entry.key.mtimeNs);
+        putInt(out, entry.groups);
+        if (entry.groups & Entry::Textual) {
+            for (const std::string* str : {&entry.title, &entry.album, &entry.artist, &entry.year, &entry.trackNumber, &entry.comment}) {
+                putStr(out, *str);
+            }
+        }
+        if (entry.groups & Entry::Duration) {
+            putInt<uint64_t>(out, entry.durationMs);
+        }
+        if (entry.groups & Entry::Images) {
+            putInt<uint32_t>(out, entry.images.size());
+            for (const auto& image : entry.images) {
+                putInt(out, image.type);
+                putStr(out, image.mimeType);
+                putInt(out, image.size);
+                putInt(out, image.offset);
+            }
+        }
+        if (entry.groups & Entry::Frames) {
+            putInt<uint32_t>(out, entry.frames.size());
+            for (const auto& frame : entry.frames) {
+                putStr(out, frame);
+            }
+        }
+        uint32_t size = out.size() - begin - RecordHeaderSize;
+        uint32_t checksum = fnv1a(out.data() + begin + RecordHeaderSize, size);
+        memcpy(out.data() + begin, &size, 4);
+        memcpy(out.data() + begin + 4, &checksum, 4);
+    }
+
+    bool deserialize(Reader& reader, Entry& entry) {
+        entry.key.dev = reader.get<uint64_t>();
+        entry.key.ino = reader.get<uint64_t>();
+        entry.key.size = reader.get<uint64_t>();
+        entry.key.mtimeNs = reader.get<int64_t>();
+        entry.groups = reader.get<uint8_t>();
+        if (entry.groups & Entry::Textual) {
+            for (std::string* str : {&entry.title, &entry.album, &entry.artist, &entry.year, &entry.trackNumber, &entry.comment}) {
+                *str = reader.str();
+            }
+        }
+        if (entry.groups & Entry::Duration) {
+            entry.durationMs = reader.get<uint64_t>();
+        }
+        if (entry.groups & Entry::Images) {
+            uint32_t count = reader.get<uint32_t>();
+            for (uint32_t i = 0; (i < count) && reader.ok; ++i) {
+                ImageInfo image;
+                image.type = reader.get<uint8_t>();
+                image.mimeType = reader.str();
+                image.size = reader.get<uint64_t>();
+                image.offset = reader.get<uint64_t>();
+                entry.images.push_back(std::move(image));
+            }
+        }
+        if (entry.groups & Entry::Frames) {
+            uint32_t count = reader.get<uint32_t>();
+            for (uint32_t i = 0; (i < count) && reader.ok; ++i) {
+                entry.frames.push_back(reader.str());
+            }
+        }
+        return reader.ok && (reader.cur == reader.end);
+    }
+
+    // makes written data (or directory entries) durable
+    void syncPath(const fs::path& path) {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            fsync(fd);
+            ::close(fd);
+        }
+#else
+        (void)path;
+#endif
+    }
+
+}
+
+std::optional<FileKey> cache::statFile(const std::filesystem::path& path) {
+    FileKey key;
+#if defined(__linux__) && defined(STATX_BASIC_STATS)
+    struct statx stx;
+    if (statx(AT_FDCWD, path.c_str(), AT_STATX_SYNC_AS_STAT, STATX_TYPE | STATX_INO | STATX_SIZE | STATX_MTIME, &stx) || !S_ISREG(stx.stx_mode)) {
+        return std::nullopt;
+    }
+    key.dev = ((uint64_t)stx.stx_dev_major << 32) | stx.stx_dev_minor;
+    key.ino = stx.stx_ino;
+    key.size = stx.stx_size;
+    key.mtimeNs = (int64_t)stx.stx_mtime.tv_sec * 1000000000 + stx.stx_mtime.tv_nsec;
+#elif !defined(_WIN32)
+    struct stat st;
+    if (::stat(path.c_str(), &st) || !S_ISREG(st.st_mode)) {
+        return std::nullopt;
+    }
+    key.dev = st.st_dev;
+    key.ino = st.st_ino;
+    key.size = st.st_size;
+#ifdef __APPLE__
+    key.mtimeNs = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    key.mtimeNs = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+#else
+    // no inodes - path identifies the file
+    std::error_code ec;
+    if (!fs::is_regular_file(path, ec)) {
+        return std::nullopt;
+    }
+    key.size = fs::file_size(path, ec);
+    if (ec) {
+        return std::nullopt;
+    }
+    key.mtimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(fs::last_write_time(path, ec).time_since_epoch()).count();
+    key.ino = std::hash<std::wstring>()(fs::absolute(path).lexically_normal().wstring());
+#endif
+    return key;
+}
+
+void cache::Entry::merge(Entry&& other) {
+    if (other.groups & Textual) {
+        title = std::move(other.title);
+        album = std::move(other.album);
+        artist = std::move(other.artist);
+        year = std::move(other.year);
+        trackNumber = std::move(other.trackNumber);
+        comment = std::move(other.comment);
+    }
+    if (other.groups & Duration) {
+        durationMs = other.durationMs;
+    }
+    if (other.groups & Images) {
+        images = std::move(other.images);
+    }
+    if (other.groups & Frames) {
+        frames = std::move(other.frames);
+    }
+    // parsed successfully this time
+    if (other.groups & (Textual | Duration | Images)) {
+        groups &= ~Failed;
+    }
+    groups |= other.groups;
+}
+
+cache::MetaCache::MetaCache(const std::filesystem::path& path)
+    : path(path)
+{
+    load();
+}
+
+cache::MetaCache::~MetaCache() {
+    try {
+        flush();
+    }
+    catch (...) {}
+}
+
+void cache::MetaCache::load() {
+    std::string data;
+    {
+        std::ifstream ifs(path, std::ios::binary);
+        if (ifs) {
+            data.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+        }
+    }
+    size_t offset = HeaderSize;
+    bool valid = (data.size() >= HeaderSize) && !memcmp(data.data(), Magic, sizeof(Magic));
+    if (valid) {
+        uint32_t version = 0;
+        memcpy(&version, data.data() + sizeof(Magic), sizeof(version));
+        valid = (version == Version);
+    }
+    while (valid && ((offset + RecordHeaderSize) <= data.size())) {
+        uint32_t size = 0, checksum = 0;
+        memcpy(&size, data.data() + offset, 4);
+        memcpy(&checksum, data.data() + offset + 4, 4);
+        const char* payload = data.data() + offset + RecordHeaderSize;
+        if ((size > (data.size() - offset - RecordHeaderSize)) || (fnv1a(payload, size) != checksum)) {
+            break;
+        }
+        Reader reader{payload, payload + size};
+        Entry entry;
+        if (!deserialize(reader, entry)) {
+            break;
+        }
+        entries[Id{entry.key.dev, entry.key.ino}] = std::move(entry);
+        ++records;
+        offset += RecordHeaderSize + size;
+    }
+    // missing, foreign or torn log is rewritten at once, so records can be appended to it
+    if (!valid || (offset != data.size())) {
+        compactLocked();
+    }
+}
+
+std::optional<Entry> cache::MetaCache::find(const FileKey& key) const {
+    std::lock_guard lock(mtx);
+    auto iter = entries.find(Id{key.dev, key.ino});
+    if ((iter == entries.end()) || !(iter->second.key == key)) {
+        return std::nullopt;
+    }
+    return iter->second;
+}
+
+void cache::MetaCache::put(Entry entry) {
+    std::lock_guard lock(mtx);
+    Entry& stored = entries[Id{entry.key.dev, entry.key.ino}];
+    if (stored.key == entry.key) {
+        stored.merge(std::move(entry));
+    }
+    else {
+        stored = std::move(entry);
+    }
+    serialize(pending, stored);
+    ++records;
+    if (pending.size() >= FlushThreshold) {
+        try {
+            flushLocked();
+        }
+        catch (OpenException&) {
+            // e.g. disk is full: records are dropped, entries are kept - next flush rewrites the log from them
+            pending.clear();
+            rewrite = true;
+        }
+    }
+}
+
+void cache::MetaCache::flush() {
+    std::lock_guard lock(mtx);
+    flushLocked();
+}
+
+void cache::MetaCache::compact() {
+    std::lock_guard lock(mtx);
+    compactLocked();
+}
+
+void cache::MetaCache::flushLocked() {
+    if (rewrite || (records > (2 * entries.size() + CompactionSlack))) {
+        compactLocked();
+        return;
+    }
+    if (pending.empty()) {
+        return;
+    }
+    std::ofstream ofs(path, std::ios::binary | std::ios::app);
+    if (!ofs.write(pending.data(), pending.size())) {
+        throw OpenException{};
+    }
+    pending.clear();
+}
+
+void cache::MetaCache::compactLocked() {
+    fs::path tmpPath = path;
+    tmpPath += ".tmp";
+    {
+        std::ofstream ofs(tmpPath, std::ios::binary | std::ios::trunc);
+        std::string buf(Magic, sizeof(Magic));
+        putInt(buf, Version);
+        for (const auto& [id, entry] : entries) {
+            serialize(buf, entry);
+            if (buf.size() >= FlushThreshold) {
+                ofs.write(buf.data(), buf.size());
+                buf.clear();
+            }
+        }
+        if (!ofs.write(buf.data(), buf.size()) || !ofs.flush()) {
+            throw OpenException{};
+        }
+    }
+    // data must reach the disk before rename, otherwise crash may leave empty file under the log name
+    syncPath(tmpPath);
+    std::error_code ec;
+    fs::rename(tmpPath, path, ec);
+    if (ec) {
+        throw OpenException{};
+    }
+    syncPath(path.has_parent_path() ? path.parent_path() : fs::path("."));
+    records = entries.size();
+    pending.clear();
+    rewrite = false;
+}
@@ -0,0 +1,119 @@
+#ifndef METACACHE_HPP
+#define METACACHE_HPP
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <optional>
+#include <mutex>
+#include <filesystem>
+
+namespace cache {
+
+    // identity and version of a file; file is considered unchanged while all of them are equal
+    struct FileKey {
+        uint64_t dev = 0;
+        uint64_t ino = 0;
+        uint64_t size = 0;
+        int64_t mtimeNs = 0;
+        bool operator==(const FileKey&) const = default;
+    };
+
+    // one statx (stat on non Linux systems) call; returns nullopt if file can't be stat'ed or is not a regular file
+    std::optional<FileKey> statFile(const std::filesystem::path& path);
+
+    struct ImageInfo {
+        uint8_t type = 0;
+        std::string mimeType;
+        uint64_t size = 0;
+        // of picture data in file; 0 - unknown (picture is not stored as it is)
+        uint64_t offset = 0;
+    };
+
+    /*
+        Parse results of one file.
+        Every user fills only its groups (getMetainfo - textual, duration, images; TagScout - frames, duration),
+        entries of the same file version are merged.
+    */
+    struct Entry {
+        enum Group : uint8_t {
+            Textual = 1 << 0,
+            Duration = 1 << 1,
+            Images = 1 << 2,
+            Frames = 1 << 3,
+            // file could not be parsed; other groups are empty
+            Failed = 1 << 4
+        };
+        FileKey key;
+        uint8_t groups = 0;
+        std::string title;
+        std::string album;
+        std::string artist;
+        std::string year;
+        std::string trackNumber;
+        std::string comment;
+        size_t durationMs = 0;
+        // only descriptors: image data is read from file when needed
+        std::vector<ImageInfo> images;
+        std::vector<std::string> frames;
+
+        inline bool has(uint8_t requested) const { return (groups & requested) == requested; }
+        void merge(Entry&& other);
+    };
+
+    /*
+        On-disk cache of parse results, keyed by (device, inode); size and mtime validate the entry.
+        File is a log of records: updates are appended, newer record of a file overrides older ones.
+        Torn record at the end (after crash) is dropped on load.
+        Log is compacted, when it has more dead records than live ones: live entries are written into a temporary file,
+        which is synced and renamed over the log, so the old log stays intact until new one is complete.
+        Thread safe.
+    */
+    class MetaCache {
+    public:
+        class OpenException : public std::exception {};
+
+        // loads existing log; throws OpenException, if it can't be created
+        MetaCache(const std::filesystem::path& path);
+        // flushes appended records
+        ~MetaCache();
+        MetaCache(const MetaCache&) = delete;
+        MetaCache& operator=(const MetaCache&) = delete;
+        // returns entry, if file has not changed since it was stored
+        std::optional<Entry> find(const FileKey& key) const;
+        // stores entry; groups of the stored entry for the same file version are kept. Does not throw on write errors
+        void put(Entry entry);
+        // throws OpenException, if log can't be written
+        void flush();
+        void compact();
+        inline size_t size() const {
+            std::lock_guard lock(mtx);
+            return entries.size();
+        }
+    private:
+        struct Id {
+            uint64_t dev;
+            uint64_t ino;
+            bool operator==(const Id&) const = default;
+        };
+        struct IdHash {
+            inline size_t operator()(const Id& id) const { return std::hash<uint64_t>()(id.ino * 31 + id.dev); }
+        };
+        void load();
+        void flushLocked();
+        void compactLocked();
+
+        std::filesystem::path path;
+        std::unordered_map<Id, Entry, IdHash> entries;
+        // serialized records, not yet written to the log
+        std::string pending;
+        // records in the log, including superseded ones
+        size_t records = 0;
+        // append failed - log misses records, so it is rewritten from entries on next flush
+        bool rewrite = false;
+        mutable std::mutex mtx;
+    };
+
+}
+
+#endif // METACACHE_HPP
@@ -1,6 +1,8 @@
 #include "Mp3FrameParser.hpp"
+#include "Instrumentation.hpp"
 #include <string.h>
-#include <iostream>
+#include <algorithm>
+#include <vector>
 
 using namespace mp3;
 
@@ -25,43 +27,123 @@ const int mp3::Mp3FrameParser::SamplingRateFreqIndexMap[4][4] = {
     {44100,48000,32000,-1}      // v1
 };
 
-mp3::Mp3FrameParser::Mp3FrameParser(std::ifstream& ifs)
-    : ifs{ifs}
+namespace {
+    // frame header bits 20-17 (version, layer) and 15-9 (bitrate, sampling rate, padding); protection bit is skipped
+    inline size_t frameLengthIndex(uint32_t header) {
+        return (((header >> 17) & 0xf) << 7) | ((header >> 9) & 0x7f);
+    }
+}
+
+/*
+    Layer I: FrameLengthInBytes = (12 * BitRate / SampleRate + Padding) * 4
+    Layer II, Layer III (MPEG1): FrameLengthInBytes = 144 * BitRate / SampleRate + Padding
+    Layer III (MPEG2/2.5): FrameLengthInBytes = 72 * BitRate / SampleRate + Padding
+    Result size is floor()'ed
+*/
+const std::array<uint16_t, 2048> mp3::Mp3FrameParser::FrameLengthMap = []() {
+    std::array<uint16_t, 2048> res{};
+    for (size_t version = 0; version < 4; ++version) {
+        for (size_t layer = 0; layer < 4; ++layer) {
+            for (size_t bitrateIndex = 0; bitrateIndex < 16; ++bitrateIndex) {
+                for (size_t sampleRateIndex = 0; sampleRateIndex < 4; ++sampleRateIndex) {
+                    int bitrate = ((MPEGAudioVersion)version == MPEGAudioVersion::MPEGVersion1) ?
+                        BitrateIndexV1Map[layer][bitrateIndex] :
+                        BitrateIndexV2Map[layer][bitrateIndex];
+                    int sampleRate = SamplingRateFreqIndexMap[version][sampleRateIndex];
+                    // reserved values and free format
+                    if ((bitrate <= 0) || (sampleRate <= 0)) {
+                        continue;
+                    }
+                    for (size_t padding = 0; padding < 2; ++padding) {
+                        uint32_t len = 0;
+                        if ((Layer)layer == Layer::LayerI) {
+                            len = (12 * bitrate * 1000 / sampleRate + padding) * 4;
+                        }
+                        else if (((Layer)layer == Layer::LayerIII) && ((MPEGAudioVersion)version != MPEGAudioVersion::MPEGVersion1)) {
+                            len = 72 * bitrate * 1000 / sampleRate + padding;
+                        }
+                        else {
+                            len = 144 * bitrate * 1000 / sampleRate + padding;
+                        }
+                        res[(version << 9) | (layer << 7) | (bitrateIndex << 3) | (sampleRateIndex << 1) | padding] = len;
+                    }
+                }
+            }
+        }
+    }
+    return res;
+}();
+
+uint32_t mp3::Mp3FrameParser::frameLength(uint32_t header) {
+    if ((header & 0xffe00000) != 0xffe00000) {
+        return 0;
+    }
+    return FrameLengthMap[frameLengthIndex(header)];
+}
+
+uint32_t mp3::Mp3FrameParser::frameSamples(uint32_t header) {
+    // [version][layer]
+    static constexpr uint16_t SamplesMap[4][4] = {
+        {0, 576, 1152, 384},    // v2.5
+        {0, 0, 0, 0},           // reserved
+        {0, 576, 1152, 384},    // v2
+        {0, 1152, 1152, 384}    // v1
+    };
+    return SamplesMap[(header >> 19) & 0b11][(header >> 17) & 0b11];
+}
+
+uint32_t mp3::Mp3FrameParser::frameSampleRate(uint32_t header) {
+    int sampleRate = SamplingRateFreqIndexMap[(header >> 19) & 0b11][(header >> 10) & 0b11];
+    return sampleRate > 0 ? sampleRate : 0;
+}
+
+mp3::Mp3FrameParser::Mp3FrameParser(io::ByteSource& src)
+    : src{src}
 {
     memset((void*)&headerRaw, 0, sizeof(headerRaw));
-    parse(ifs);
+    parse(src);
 }
 
 void mp3::Mp3FrameParser::next() {
-    parse(ifs);
+    parse(src);
 }
 
-double mp3::Mp3FrameParser::frameLenBytes() const {
-    //
-    //For Layer I files us this formula:
-    //    FrameLengthInBytes = (12 * BitRate / SampleRate + Padding) * 4
-    //For Layer II & III files use this formula:
-    //    FrameLengthInBytes = 144 * BitRate / SampleRate + Padding
-    // Result size is floor()'ed
-    if (header.layer == Layer::LayerI) {
-        return (12.0 * (double)header.bitrate / (double)header.sampleRate + headerRaw.paddingBit) * 4.0;
-    }
-    // layers II and III
-    else {
-        return (144.0 * (double)header.bitrate / (double)header.sampleRate) + headerRaw.paddingBit;
-    }
+size_t mp3::Mp3FrameParser::frameLenBytes() const {
+    const uint8_t* bytes = (const uint8_t*)&headerRaw;
+    return frameLength(((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | (uint32_t)bytes[3]);
 }
 
 double mp3::Mp3FrameParser::frameLenMs() const {
+    return (double)samplesPerFrame() / (double)header.sampleRate * 1000;
+}
+
+size_t mp3::Mp3FrameParser::samplesPerFrame() const {
     // each L1 frame has 384 samples
-    // each L2 or L3 frame has 1152 samples
+    // each L2 frame has 1152 samples
+    // each L3 frame has 1152 samples in MPEG1 and 576 in MPEG2/2.5
     if (header.layer == Layer::LayerI) {
-        return 384.0 / (double)header.sampleRate * 1000;
+        return 384;
     }
-    // layers II and III
-    else {
-        return 1152.0 / (double)header.sampleRate * 1000;
+    else if ((header.layer == Layer::LayerIII) && (header.version != MPEGAudioVersion::MPEGVersion1)) {
+        return 576;
     }
+    return 1152;
+}
+
+size_t mp3::Mp3FrameParser::xingOffset() const {
+    // 4 bytes of header + side information: 32/17 bytes in MPEG1, 17/9 in MPEG2/2.5 (stereo/mono)
+    bool mono = header.channelMode == ChannelMode::SingleChannelMono;
+    if (header.version == MPEGAudioVersion::MPEGVersion1) {
+        return 4 + (mono ? 17 : 32);
+    }
+    return 4 + (mono ? 9 : 17);
+}
+
+size_t mp3::Mp3FrameParser::vbrHeaderDurationMs() const {
+    if (!_vbrHeader.frames || !header.sampleRate) {
+        return 0;
+    }
+    return (uint64_t)_vbrHeader.frames * samplesPerFrame() * 1000 / header.sampleRate;
 }
 
 size_t mp3::Mp3FrameParser::headerLenBytes() const  {
@@ -74,14 +156,16 @@ size_t mp3::Mp3FrameParser::headerLenBytes() const  {
     }
 }
 
-void mp3::Mp3FrameParser::parse(std::ifstream& ifs) {
-    if (!ifs) {
+void mp3::Mp3FrameParser::parse(io::ByteSource& src) {
+    if (src.eof()) {
         throw EOFException{};
     }
 
     bool firstFrame = !headerRaw.sync1;
 
-    ifs.read((char*)&headerRaw, sizeof(headerRaw));
+    if (src.read(&headerRaw, sizeof(headerRaw)) != sizeof(headerRaw)) {
+        throw EOFException{};
+    }
     if (!(headerRaw.sync1 == 0xff && headerRaw.sync2 == 0x7)) {
         firstFrame ? throw NoFrameException{} : throw EOFException{};
     }
@@ -97,6 +181,7 @@ void mp3::Mp3FrameParser::parse(std::ifstream& ifs) {
     }
     header.layer = (Layer)headerRaw.layerDescr;
     header.version = (MPEGAudioVersion)headerRaw.mpegAudioVersionID;
+    header.channelMode = (ChannelMode)headerRaw.channelMode;
     header.sampleRate = SamplingRateFreqIndexMap[headerRaw.mpegAudioVersionID][headerRaw.samplingRateFreqIndex];
     header.bitrate = (header.version == MPEGAudioVersion::MPEGVersion1 ?
         BitrateIndexV1Map[headerRaw.layerDescr][headerRaw.bitrateIndex] :
@@ -104,45 +189,274 @@ void mp3::Mp3FrameParser::parse(std::ifstream& ifs) {
         * 1000;
 
     // searching for Xing header - we need to determine if that mp3 file has variadic bitrate
-    size_t pos = ifs.tellg();
+    size_t pos = src.tell();
     if (firstFrame) {
-        ifs.seekg(pos + 32);
-        char data[4];
-        ifs.read((char*)&data, sizeof(data));
-        // Xing header is an indicator of variadic bitrate
-        if (data[0] == 'X' && data[1] == 'i' && data[2] == 'n' && data[3] == 'g') {
-            VBR = true;
+        parseVbrHeader(src, pos - 4);
+    }
+    src.seek(pos + frameLenBytes() - 4);
+}
+
+/*
+    Xing/Info: "Xing"|"Info", flags (4 bytes BE), then optional fields in order: frames (4), bytes (4), TOC (100), quality (4)
+    VBRI: always at 32 bytes after header: "VBRI", version (2), delay (2), quality (2), bytes (4), frames (4), ...
+*/
+void mp3::Mp3FrameParser::parseVbrHeader(io::ByteSource& src, size_t frameOffset) {
+    static constexpr size_t VBRIOffset = 4 + 32;
+    static constexpr uint32_t FramesFlag = 0x1;
+    static constexpr uint32_t BytesFlag = 0x2;
+    static constexpr uint32_t TocFlag = 0x4;
+    // side information of MPEG1 stereo, Xing id, flags, frames, bytes and TOC
+    uint8_t data[4 + 32 + 16 + 100] = {0};
+    src.readAt(frameOffset, &data[0], sizeof(data));
+    auto be32 = [](const uint8_t* p) { return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3]; };
+    const uint8_t* xing = &data[xingOffset()];
+    if (!memcmp(xing, "Xing", 4) || !memcmp(xing, "Info", 4)) {
+        _vbrHeader.type = (xing[0] == 'X') ? VbrHeader::Type::Xing : VbrHeader::Type::Info;
+        uint32_t flags = be32(xing + 4);
+        const uint8_t* field = xing + 8;
+        if (flags & FramesFlag) {
+            _vbrHeader.frames = be32(field);
+            field += 4;
+        }
+        if (flags & BytesFlag) {
+            _vbrHeader.bytes = be32(field);
+            field += 4;
+        }
+        if (flags & TocFlag) {
+            _vbrHeader.hasToc = true;
+            memcpy(_vbrHeader.toc.data(), field, _vbrHeader.toc.size());
+        }
+    }
+    else if (!memcmp(&data[VBRIOffset], "VBRI", 4)) {
+        _vbrHeader.type = VbrHeader::Type::VBRI;
+        _vbrHeader.bytes = be32(&data[VBRIOffset + 10]);
+        _vbrHeader.frames = be32(&data[VBRIOffset + 14]);
+    }
+    // Info header is written into CBR files
+    VBR = (_vbrHeader.type == VbrHeader::Type::Xing) || (_vbrHeader.type == VbrHeader::Type::VBRI);
+}
+
+mp3::Mp3FrameWalker::Mp3FrameWalker(io::ByteSource& src, uint64_t begin, uint64_t end)
+    : src{src}, _offset{begin}, end{std::min(end, src.size())}
+{
+    ;
+}
+
+bool mp3::Mp3FrameWalker::next(FrameInfo& frame) {
+    if ((_offset + 4) > end) {
+        return false;
+    }
+    if (!block || (_offset < blockOffset) || ((_offset + 4) > (blockOffset + blockSize))) {
+        // releasing previous block first - so pread source can reuse its buffer
+        block.reset();
+        blockOffset = _offset;
+        blockSize = std::min<uint64_t>(BlockSize, end - _offset);
+        block = src.block(blockOffset, blockSize);
+        if (!block) {
+            return false;
         }
     }
-    ifs.seekg(pos + frameLenBytes() - 4);
+    const uint8_t* bytes = block.get() + (_offset - blockOffset);
+    uint32_t header = ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | (uint32_t)bytes[3];
+    uint32_t length = Mp3FrameParser::frameLength(header);
+    if (!length) {
+        return false;
+    }
+    frame.offset = _offset;
+    frame.length = length;
+    frame.samples = Mp3FrameParser::frameSamples(header);
+    frame.sampleRate = Mp3FrameParser::frameSampleRate(header);
+    _offset += length;
+    return true;
 }
 
-size_t mp3::getMp3FileDuration(std::ifstream& ifs) {
-    size_t pos = ifs.tellg();
-    ifs.seekg(0, std::ios_base::end);
-    size_t fileSize = (size_t)ifs.tellg() - pos;
-    ifs.seekg(pos, std::ios_base::beg);
-    double durationMs = 0.0;
+namespace {
+
+    // longest frame (Layer II, MPEG2.5, 160 kbps, 8000 Hz, padding) - there is a frame header in any range of that size
+    constexpr size_t MaxFrameLength = 2881;
+
+    inline uint32_t be32(const uint8_t* p) {
+        return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+    }
+
+    /*
+        First frame in [offset, offset + window): valid header, followed by header of the same stream (version, layer and sampling rate),
+        so that sync bits in audio data are not taken for a frame. Reads just the window and one frame (up to maxLength) after it;
+        header of longer frame costs one more 4 byte read.
+    */
+    std::optional<uint64_t> syncFrame(io::ByteSource& src, uint64_t offset, uint64_t end,
+                                      size_t window = MaxFrameLength, size_t maxLength = MaxFrameLength) {
+        static constexpr uint32_t StreamMask = 0xfffe0c00;
+        uint8_t data[2 * MaxFrameLength + 4];
+        window = std::min(window, MaxFrameLength);
+        maxLength = std::min(maxLength, MaxFrameLength);
+        size_t n = src.peekAt(offset, data, std::min<uint64_t>(window + maxLength + 4, end - offset));
+        for (size_t pos = 0; ((pos + 4) <= n) && (pos < window); ++pos) {
+            uint32_t header = be32(data + pos);
+            uint32_t length = mp3::Mp3FrameParser::frameLength(header);
+            if (!length) {
+                continue;
+            }
+            // last frame of the stream
+            if ((offset + pos + length + 4) > end) {
+                if ((offset + pos + length) >= end) {
+                    return offset + pos;
+                }
+                continue;
+            }
+            uint8_t next[4];
+            if ((pos + length + 4) <= n) {
+                memcpy(next, data + pos + length, sizeof(next));
+            }
+            else if (src.peekAt(offset + pos + length, next, sizeof(next)) != sizeof(next)) {
+                continue;
+            }
+            if ((be32(next) & StreamMask) == (header & StreamMask)) {
+                return offset + pos;
+            }
+        }
+        return std::nullopt;
+    }
+
+    /*
+        Xing TOC: entry i is position of i% of duration in 1/256 of stream size, counted from the header frame.
+        Positions are not frame boundaries - every one is moved to the next frame header.
+    */
+    seek::Index tocIndex(io::ByteSource& src, const mp3::Mp3FrameParser& parser, uint64_t begin, uint64_t end) {
+        const mp3::VbrHeader& vbr = parser.vbrHeader();
+        uint32_t sampleRate = parser.getHeader().sampleRate;
+        if (!vbr.hasToc || !vbr.frames || !sampleRate) {
+            return {};
+        }
+        uint64_t totalSamples = (uint64_t)vbr.frames * parser.samplesPerFrame();
+        uint64_t streamSize = vbr.bytes ? vbr.bytes : end - begin;
+        // frame with the header holds no audio
+        uint64_t audioBegin = begin + parser.frameLenBytes();
+        std::vector<seek::Point> points;
+        points.reserve(vbr.toc.size());
+        points.push_back({0, audioBegin});
+        for (size_t i = 1; i < vbr.toc.size(); ++i) {
+            uint64_t offset = std::max(begin + vbr.toc[i] * streamSize / 256, audioBegin);
+            if (offset >= end) {
+                break;
+            }
+            if (auto frame = syncFrame(src, offset, end)) {
+                points.push_back({totalSamples * i / vbr.toc.size(), *frame});
+            }
+        }
+        return seek::Index(sampleRate, std::move(points));
+    }
+
+    /*
+        Stream without VBR header is CBR only if all frames have bitrate of the first one;
+        frames are sampled at evenly spaced offsets - finding VBR stream this way takes a few reads, not a walk.
+    */
+    bool constantBitrate(io::ByteSource& src, uint64_t begin, uint64_t end) {
+        static constexpr size_t SamplePoints = 16;
+        static constexpr uint32_t BitrateMask = 0xf000;
+        uint8_t bytes[4] = {0};
+        if ((end <= begin) || (src.readAt(begin, bytes, sizeof(bytes)) != sizeof(bytes))) {
+            return false;
+        }
+        uint32_t first = be32(bytes);
+        // frames of CBR stream differ only by padding byte - next one is at most frame length away
+        size_t length = mp3::Mp3FrameParser::frameLength(first) + 1;
+        for (size_t i = 1; i < SamplePoints; ++i) {
+            uint64_t offset = begin + (end - begin) * i / SamplePoints;
+            auto frame = syncFrame(src, offset, end, length, length);
+            if (!frame) {
+                continue;
+            }
+            if ((src.peekAt(*frame, bytes, sizeof(bytes)) != sizeof(bytes)) || ((be32(bytes) & BitrateMask) != (first & BitrateMask))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+}
+
+size_t mp3::getMp3FileDuration(io::ByteSource& src) {
+    return getMp3FileDuration(src, src.size());
+}
+
+size_t mp3::getMp3FileDuration(io::ByteSource& src, uint64_t end) {
+    return getMp3FileDuration(src, end, nullptr);
+}
+
+size_t mp3::getMp3FileDuration(io::ByteSource& src, uint64_t end, seek::Index* index, uint32_t intervalMs) {
+    INSTR_PHASE(Duration);
+    end = std::min(end, src.size());
+    uint64_t begin = src.tell();
+    size_t audioSize = (end > begin) ? end - begin : 0;
     try {
-        Mp3FrameParser mp3FrameParser(ifs);
-        //std::cout << "VBR=" << (mp3FrameParser.isVBR() ? "true" : "false") << std::endl;
-        //std::cout << "Bitrate: " << mp3FrameParser.getHeader().bitrate <<  ", Duration: " << mp3FrameParser.durationMs() << " ms\n";
-        // CBR
-        if (!mp3FrameParser.isVBR()) {
-            return mp3FrameParser.frameLenMs() * (fileSize / mp3FrameParser.frameLenBytes());
+        Mp3FrameParser mp3FrameParser(src);
+        const Mp3FrameHeader& header = mp3FrameParser.getHeader();
+        if (index) {
+            *index = tocIndex(src, mp3FrameParser, begin, end);
+        }
+        // without TOC index is built by walk, which is done anyway for VBR files without frame count
+        bool indexWalk = index && index->empty();
+        // frame count from Xing/Info/VBRI header gives exact duration without walking frames
+        size_t headerDurationMs = mp3FrameParser.vbrHeaderDurationMs();
+        if (headerDurationMs && !indexWalk) {
+            return headerDurationMs;
+        }
+        // Info header is written only into CBR files; without any header bitrate is checked over the file
+        bool cbr = !mp3FrameParser.isVBR();
+        if (cbr && (mp3FrameParser.vbrHeader().type == VbrHeader::Type::None)) {
+            cbr = constantBitrate(src, begin, end);
+        }
+        if (cbr && !indexWalk) {
+            return (uint64_t)audioSize * 8000 / header.bitrate;
         }
         // VBR
-        else {
-            durationMs = mp3FrameParser.frameLenMs();
-            while (true) {
-                mp3FrameParser.next();
-                durationMs += mp3FrameParser.frameLenMs();
-                //std::cout << "Bitrate: " << mp3FrameParser.getHeader().bitrate <<  ", Duration: " << mp3FrameParser.durationMs() << " ms\n";
+        // counting samples, not milliseconds, so there is no rounding error per frame
+        uint64_t samples = mp3FrameParser.samplesPerFrame();
+        uint32_t sampleRate = header.sampleRate;
+        double durationMs = 0.0;
+        // index position is in samples of the first frame rate, from the first audio frame
+        std::vector<seek::Point> points;
+        uint32_t indexRate = header.sampleRate;
+        uint64_t intervalSamples = std::max<uint64_t>((uint64_t)intervalMs * indexRate / 1000, 1);
+        uint64_t position = 0;
+        uint64_t nextPoint = 0;
+        if (indexWalk && (mp3FrameParser.vbrHeader().type == VbrHeader::Type::None)) {
+            points.push_back({0, begin});
+            position = samples;
+            nextPoint = intervalSamples;
+        }
+        Mp3FrameWalker walker(src, src.tell(), end);
+        FrameInfo frame;
+        while (walker.next(frame)) {
+            if (frame.sampleRate != sampleRate) {
+                durationMs += (double)samples * 1000 / sampleRate;
+                samples = 0;
+                sampleRate = frame.sampleRate;
+            }
+            samples += frame.samples;
+            if (indexWalk) {
+                if (position >= nextPoint) {
+                    points.push_back({position, frame.offset});
+                    nextPoint = position + intervalSamples;
+                }
+                position += (frame.sampleRate == indexRate) ? frame.samples : (uint64_t)frame.samples * indexRate / frame.sampleRate;
             }
         }
+        src.seek(walker.offset());
+        if (indexWalk) {
+            *index = seek::Index(indexRate, std::move(points));
+        }
+        if (headerDurationMs) {
+            return headerDurationMs;
+        }
+        if (cbr) {
+            return (uint64_t)audioSize * 8000 / header.bitrate;
+        }
+        return durationMs + (double)samples * 1000 / sampleRate;
     }
     catch(Mp3FrameParser::EOFException&) {
         ;
     }
-    return durationMs;
+    return 0;
 }
@@ -2,8 +2,10 @@
 #define Mp3FrameParser_HPP
 #include <string>
 #include <cstdint>
-#include <fstream>
 #include <unordered_map>
+#include <array>
+#include "ByteSource.hpp"
+#include "SeekIndex.hpp"
 
 namespace mp3 {
 
@@ -56,6 +58,26 @@ namespace mp3 {
         ChannelMode channelMode;
     };
 
+    // header in the first frame of a file, written by encoders instead of audio data
+    struct VbrHeader {
+        enum class Type : uint8_t {
+            None,
+            // Xing - VBR, Info - same header in CBR file (LAME)
+            Xing,
+            Info,
+            // Fraunhofer encoder
+            VBRI
+        };
+        Type type = Type::None;
+        // number of audio frames, not counting the one holding the header; 0 - unknown
+        uint32_t frames = 0;
+        // size of audio data in bytes; 0 - unknown
+        uint32_t bytes = 0;
+        // Xing/Info: byte position (in 1/256 of bytes) of every percent of duration, from the header frame
+        bool hasToc = false;
+        std::array<uint8_t, 100> toc{};
+    };
+
     class Mp3FrameParser {
     public:
 
@@ -64,25 +86,80 @@ namespace mp3 {
         class NoFrameException : public std::exception{};
         class InvalidFrameHeaderException : public std::exception{};
 
-        Mp3FrameParser(std::ifstream& ifs);
+        Mp3FrameParser(io::ByteSource& src);
         void next();
         inline const Mp3FrameHeader& getHeader() const { return header; }
         inline bool isVBR() const { return VBR; }
-        double frameLenBytes() const;
+        inline const VbrHeader& vbrHeader() const { return _vbrHeader; }
+        size_t frameLenBytes() const;
         double frameLenMs() const;
         size_t headerLenBytes() const;
+        size_t samplesPerFrame() const;
+        // offset of Xing/Info header from frame start - it follows side information
+        size_t xingOffset() const;
+        // exact duration from Xing/Info/VBRI frame count; 0 if there is no such header
+        size_t vbrHeaderDurationMs() const;
+
+        // decoding of 4 header bytes (as big endian number) by lookup tables; 0 - invalid or unsupported header
+        static uint32_t frameLength(uint32_t header);
+        static uint32_t frameSamples(uint32_t header);
+        static uint32_t frameSampleRate(uint32_t header);
     private:
-        void parse(std::ifstream& ifs);
+        void parse(io::ByteSource& src);
+        void parseVbrHeader(io::ByteSource& src, size_t frameOffset);
         Mp3FrameHeaderRaw headerRaw;
         Mp3FrameHeader header;
-        std::ifstream& ifs;
+        io::ByteSource& src;
         bool VBR = false;
+        VbrHeader _vbrHeader;
         static const int BitrateIndexV1Map[4][16];
         static const int BitrateIndexV2Map[4][16];
         static const int SamplingRateFreqIndexMap[4][4];
+        // indexed by version, layer, bitrate index, sampling rate index and padding bit
+        static const std::array<uint16_t, 2048> FrameLengthMap;
+    };
+
+    // frame, found by Mp3FrameWalker
+    struct FrameInfo {
+        uint64_t offset = 0;
+        uint32_t length = 0;
+        uint32_t samples = 0;
+        uint32_t sampleRate = 0;
+    };
+
+    /*
+        Walks frames of region [begin, end) without a read per frame:
+        region is streamed through big blocks (views into mapping for mmap source), headers are decoded in place.
+    */
+    class Mp3FrameWalker {
+    public:
+        static constexpr size_t BlockSize = 1024 * 1024;
+
+        Mp3FrameWalker(io::ByteSource& src, uint64_t begin, uint64_t end);
+        // false at end of region or when there is no valid frame header at current offset
+        bool next(FrameInfo& frame);
+        inline uint64_t offset() const { return _offset; }
+    private:
+        io::ByteSource& src;
+        io::ByteSource::Block block;
+        uint64_t blockOffset = 0;
+        size_t blockSize = 0;
+        uint64_t _offset = 0;
+        uint64_t end = 0;
     };
 
-    size_t getMp3FileDuration(std::ifstream& ifs);
+    // distance between points of seek index, built by frame walk
+    constexpr uint32_t SeekIntervalMs = 1000;
+
+    size_t getMp3FileDuration(io::ByteSource& src);
+    // audio is [src.tell(), end) - tags at the end of file are not counted
+    size_t getMp3FileDuration(io::ByteSource& src, uint64_t end);
+    /*
+        Also fills index, if it is not nullptr: from Xing TOC, when there is one - 100 frames, which are found at TOC positions,
+        with time off by up to 1/256 of duration (byte positions of TOC are that coarse); otherwise from frame walk -
+        exact first frame of every interval, even in CBR files, which are not walked for duration alone.
+    */
+    size_t getMp3FileDuration(io::ByteSource& src, uint64_t end, seek::Index* index, uint32_t intervalMs = SeekIntervalMs);
 
 }
 
@@ -0,0 +1,101 @@
+#include "SeekIndex.hpp"
+#include <algorithm>
+
+seek::Index::Index(uint32_t sampleRate, std::vector<Point> points)
+    : _sampleRate{sampleRate}
+{
+    std::sort(points.begin(), points.end(), [](const Point& lhs, const Point& rhs) { return lhs.sample < rhs.sample; });
+    _points.reserve(points.size());
+    for (const Point& point : points) {
+        // duplicates and points, which contradict previous ones (broken table or false sync)
+        if (!_points.empty() && ((point.sample <= _points.back().sample) || (point.offset <= _points.back().offset))) {
+            continue;
+        }
+        _points.push_back(point);
+    }
+    _points.shrink_to_fit();
+}
+
+std::optional<seek::Point> seek::Index::findSample(uint64_t sample) const {
+    auto iter = std::upper_bound(_points.begin(), _points.end(), sample, [](uint64_t sample, const Point& point) { return sample < point.sample; });
+    if (iter == _points.begin()) {
+        return std::nullopt;
+    }
+    return *std::prev(iter);
+}
+
+std::optional<seek::Point> seek::Index::find(uint64_t ms) const {
+    return findSample(sampleAt(ms));
+}
+
+namespace {
+
+    constexpr uint8_t Version = 1;
+
+    void putVarint(std::string& out, uint64_t val) {
+        while (val >= 0x80) {
+            out.push_back((char)((val & 0x7f) | 0x80));
+            val >>= 7;
+        }
+        out.push_back((char)val);
+    }
+
+    // false on truncated or over-long number
+    bool getVarint(std::string_view& data, uint64_t& val) {
+        val = 0;
+        for (unsigned shift = 0; (shift < 64) && !data.empty(); shift += 7) {
+            uint8_t byte = data.front();
+            data.remove_prefix(1);
+            val |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+}
+
+std::string seek::Index::serialize() const {
+    std::string res;
+    res.reserve(8 + _points.size() * 4);
+    res.push_back((char)Version);
+    putVarint(res, _sampleRate);
+    putVarint(res, _points.size());
+    Point prev{0, 0};
+    for (const Point& point : _points) {
+        putVarint(res, point.sample - prev.sample);
+        putVarint(res, point.offset - prev.offset);
+        prev = point;
+    }
+    return res;
+}
+
+std::optional<seek::Index> seek::Index::deserialize(std::string_view data) {
+    if (data.empty() || ((uint8_t)data.front() != Version)) {
+        return std::nullopt;
+    }
+    data.remove_prefix(1);
+    uint64_t sampleRate = 0;
+    uint64_t count = 0;
+    if (!getVarint(data, sampleRate) || !getVarint(data, count) || (sampleRate > UINT32_MAX) || (count > data.size() / 2)) {
+        return std::nullopt;
+    }
+    std::vector<Point> points;
+    points.reserve(count);
+    Point point{0, 0};
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t sample = 0;
+        uint64_t offset = 0;
+        if (!getVarint(data, sample) || !getVarint(data, offset)) {
+            return std::nullopt;
+        }
+        point.sample += sample;
+        point.offset += offset;
+        points.push_back(point);
+    }
+    if (!data.empty()) {
+        return std::nullopt;
+    }
+    return Index((uint32_t)sampleRate, std::move(points));
+}
@@ -0,0 +1,51 @@
+#ifndef SEEKINDEX_HPP
+#define SEEKINDEX_HPP
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace seek {
+
+    struct Point {
+        // first sample of frame
+        uint64_t sample;
+        // of frame header, from beginning of file
+        uint64_t offset;
+    };
+
+    /*
+        Sorted points of audio stream: frame to start playback (or HTTP range) from for given time is found with binary search.
+        Found point is at or before asked time - decoder skips the rest.
+    */
+    class Index {
+    public:
+        Index() = default;
+        // points are sorted; ones, which do not move forward in both sample and offset, are dropped
+        Index(uint32_t sampleRate, std::vector<Point> points);
+        inline bool empty() const { return _points.empty(); }
+        inline size_t size() const { return _points.size(); }
+        inline uint32_t sampleRate() const { return _sampleRate; }
+        inline const std::vector<Point>& points() const { return _points; }
+        // last point at or before sample; nullopt, if there is none
+        std::optional<Point> findSample(uint64_t sample) const;
+        std::optional<Point> find(uint64_t ms) const;
+        inline uint64_t sampleAt(uint64_t ms) const { return ms * _sampleRate / 1000; }
+        inline uint64_t msAt(uint64_t sample) const { return _sampleRate ? sample * 1000 / _sampleRate : 0; }
+        /*
+            Compact form to keep next to metadata: version, sample rate, point count, then differences from previous point
+            (sample, offset) as LEB128 varints - independent of byte order, 3-5 bytes per point of typical index.
+        */
+        std::string serialize() const;
+        // nullopt for data of other version, truncated or corrupted
+        static std::optional<Index> deserialize(std::string_view data);
+    private:
+        uint32_t _sampleRate = 0;
+        std::vector<Point> _points;
+    };
+
+}
+
+#endif // SEEKINDEX_HPP
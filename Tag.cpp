@@ -1,40 +1,97 @@
 #include "Tag.hpp"
+#include "ByteSource.hpp"
+#include "ImageStore.hpp"
+#include "Instrumentation.hpp"
 
 using namespace util;
 using namespace tag;
 
-std::pair<Extractor::Data, size_t> Extractor::frameData(const std::string& frameName) {
-    auto res = framesData(frameName);
+std::string tag::fourccString(FrameId id) {
+    std::string res;
+    for (int shift = 24; (shift >= 0) && ((id >> shift) & 0xff); shift -= 8) {
+        res.push_back((char)((id >> shift) & 0xff));
+    }
+    return res;
+}
+
+std::pair<Extractor::Data, size_t> Extractor::frameData(FrameId id) {
+    auto res = framesData(id);
     if (res.empty()) {
         return {nullptr, 0};
     }
     return {res.front().first, res.front().second};
 }
 
+bool tag::FrameFilter::accepts(std::string_view frameName, size_t size) const {
+    if (size > maxFrameSize) {
+        return false;
+    }
+    if (allowed && !allowed->contains(frameName)) {
+        return false;
+    }
+    return !denied.contains(frameName);
+}
+
+bool tag::FrameFilter::acceptsAll() const {
+    return !allowed && denied.empty() && (maxFrameSize == std::numeric_limits<size_t>::max());
+}
+
 tag::DataBlock::DataBlock(uint8_t* data, size_t size)
     : data{data}, size{size}, offset{0}, encoding{Encoding::Ascii}
 {
     ;
 }
 
+tag::DataBlock::DataBlock(const std::shared_ptr<uint8_t[]>& owner, size_t size)
+    : owner{owner}, data{owner.get()}, size{size}, offset{0}, encoding{Encoding::Ascii}
+{
+    ;
+}
+
+static bool isWide(Encoding encoding) {
+    return (encoding == Encoding::Utf16BE) || (encoding == Encoding::Utf16BOM);
+}
+
+// length of string at data.offset; offset is moved past null terminator (\0\0 for wide strings)
+static size_t takeNullTerminated(DataBlock& data, bool wide) {
+    size_t i = data.offset;
+    size_t terminatorSize = 1;
+    if (wide) {
+        terminatorSize = 2;
+        for (i = data.offset; (i + 1) < data.size; i += 2) {
+            if (*((char16_t*)(data.data + i)) == 0) {
+                break;
+            }
+        }
+        // odd byte at the end is not a character
+        if ((i + 1) >= data.size) {
+            i = data.size;
+        }
+    }
+    else {
+        for (i = data.offset; i < data.size; ++i) {
+            if (data.data[i] == 0) {
+                break;
+            }
+        }
+    }
+    size_t len = i - data.offset;
+    data.offset = std::min(i + terminatorSize, data.size);
+    return len;
+}
+
 AsciiStrNullTerminated::Data tag::AsciiStrNullTerminated::read(DataBlock& data) {
     assert (((int64_t)data.size - (int64_t)data.offset) >= 0);
     if ((data.size - data.offset) == 0) {
         return Data{};
     }
-    size_t i = data.offset;
-    for (i = data.offset; i < data.size; ++i) {
-        if (data.data[i] == 0) {
-            break;
-        }
-    }
-    assert (i >= data.offset);
-    Data res = Tag::asUtf8String_ascii(data.data + data.offset, i - data.offset);
-    data.offset = i + 1;
-    return res;
+    uint8_t* begin = data.data + data.offset;
+    size_t len = takeNullTerminated(data, false);
+    return Tag::asUtf8String_ascii(begin, len);
 }
 
 std::string tag::decodeStr(uint8_t* data, size_t sz, Encoding encoding) {
+    INSTR_PHASE(Decode);
     switch (encoding) {
     case Encoding::Ascii:
         return Tag::asUtf8String_ascii(data, sz);
@@ -49,48 +106,82 @@ std::string tag::decodeStr(uint8_t* data, size_t sz, Encoding encoding) {
     }
 }
 
-// !!!encoding stored in data!!!
-EncodedStrNullTerminated::Data tag::EncodedStrNullTerminated::EncodedStrNullTerminated::read(DataBlock& data) {
+std::string_view tag::decodeStrView(uint8_t* data, size_t sz, Encoding encoding, TextBuffer* text) {
+    INSTR_PHASE(Decode);
+    // most of tags are in ASCII or UTF-8 - no need to copy them
+    if (((encoding == Encoding::Utf8) && isValidUtf8((char*)data, sz)) || ((encoding == Encoding::Ascii) && isAscii((char*)data, sz))) {
+        return std::string_view((char*)data, sz);
+    }
+    assert (text);
+    if (!text) {
+        return {};
+    }
+    return text->store(decodeStr(data, sz, encoding));
+}
+
+AsciiStrNullTerminatedView::Data tag::AsciiStrNullTerminatedView::read(DataBlock& data) {
     assert (((int64_t)data.size - (int64_t)data.offset) >= 0);
     if ((data.size - data.offset) == 0) {
         return Data{};
     }
-    //Data res = asUtf8String(data.data + data.offset, n);
-    size_t i = data.offset;
-    if (data.encoding == Encoding::Utf16BE || data.encoding == Encoding::Utf16BOM) {
-        for (i = data.offset; i < data.size; i += 2) {
-            if (*((char16_t*)(data.data + i)) == 0) {
-                break;
-            }
-        }
-    }
-    else {
-        for (i = data.offset; i < data.size; ++i) {
-            if (data.data[i] == 0) {
-                break;
-            }
-        }
+    uint8_t* begin = data.data + data.offset;
+    size_t len = takeNullTerminated(data, false);
+    return decodeStrView(begin, len, Encoding::Ascii, data.text);
+}
+
+EncodedStrNullTerminatedView::Data tag::EncodedStrNullTerminatedView::read(DataBlock& data) {
+    assert (((int64_t)data.size - (int64_t)data.offset) >= 0);
+    if ((data.size - data.offset) == 0) {
+        return Data{};
     }
-    assert (i >= data.offset);
-    Data res = decodeStr(data.data + data.offset, i - data.offset, Encoding(data.encoding));
-    if (data.encoding == Encoding::Utf16BE || data.encoding == Encoding::Utf16BOM) {
-        // \0\0
-        data.offset = i + 2;
+    uint8_t* begin = data.data + data.offset;
+    size_t len = takeNullTerminated(data, isWide(data.encoding));
+    return decodeStrView(begin, len, data.encoding, data.text);
+}
+
+EncodedStrView::Data tag::EncodedStrView::read(DataBlock& data) {
+    assert (((int64_t)data.size - (int64_t)data.offset) >= 0);
+    if ((data.size - data.offset) == 0) {
+        return Data{};
     }
-    else {
-        // \0
-        data.offset = i + 1;
+    size_t len = std::min<size_t>(data.sizeOfData, data.size - data.offset);
+    Data res = decodeStrView(data.data + data.offset, len, data.encoding, data.text);
+    data.offset += len;
+    return res;
+}
+
+BinaryDataView::Data tag::BinaryDataView::read(DataBlock& data) {
+    assert (((int64_t)data.size - (int64_t)data.offset) >= 0);
+    if ((data.size - data.offset) == 0) {
+        return Data{};
     }
+    size_t size = data.sizeOfData ? std::min(data.sizeOfData, data.size - data.offset) : data.size - data.offset;
+    data.sizeOfData = 0;
+    Data res(data.data + data.offset, size);
+    data.offset += size;
     return res;
 }
 
+// !!!encoding stored in data!!!
+EncodedStrNullTerminated::Data tag::EncodedStrNullTerminated::EncodedStrNullTerminated::read(DataBlock& data) {
+    assert (((int64_t)data.size - (int64_t)data.offset) >= 0);
+    if ((data.size - data.offset) == 0) {
+        return Data{};
+    }
+    uint8_t* begin = data.data + data.offset;
+    size_t len = takeNullTerminated(data, isWide(data.encoding));
+    return decodeStr(begin, len, data.encoding);
+}
+
 EncodedStr::Data tag::EncodedStr::read(DataBlock& data) {
     assert (((int64_t)data.size - (int64_t)data.offset) >= 0);
     if ((data.size - data.offset) == 0) {
         return Data{};
     }
-    Data res = decodeStr(data.data + data.offset, data.sizeOfData, Encoding(data.encoding));
-    data.offset += data.sizeOfData;
+    // size comes from the file - it must not take more than there is in the block
+    size_t len = std::min<size_t>(data.sizeOfData, data.size - data.offset);
+    Data res = decodeStr(data.data + data.offset, len, Encoding(data.encoding));
+    data.offset += len;
     return res;
 }
 
@@ -99,11 +190,16 @@ BinaryData::Data tag::BinaryData::read(DataBlock& data) {
     if ((data.size - data.offset) == 0) {
         return Data{};
     }
-    size_t size = data.sizeOfData ? data.sizeOfData : data.size - data.offset;
+    // size comes from the file - it must not take more than there is in the block
+    size_t size = data.sizeOfData ? std::min(data.sizeOfData, data.size - data.offset) : data.size - data.offset;
+    data.sizeOfData = 0;
+    if (data.owner) {
+        // view into frame buffer, sharing its ownership
+        return Data{std::shared_ptr<uint8_t[]>(data.owner, data.data + data.offset), size};
+    }
     Data res{new uint8_t[size], 0};
     memcpy(res.first.get(), data.data + data.offset, size);
     res.second = size;
-    data.sizeOfData = 0;
     return res;
 }
 
@@ -145,13 +241,15 @@ std::basic_string<char16_t> tag::Tag::asUtf16LEString(const std::string& title)
 }
 
 std::basic_string<char16_t> tag::Tag::asUtf16LEString(uint8_t* data, size_t size) {
-    if (data[0] != 1) {
+    if (size < 3 || data[0] != 1) {
         return u"";
     }
-    // bin endian - swapping bytes
+    std::basic_string<char16_t> res((size - 3) / 2, u'\0');
+    memcpy(res.data(), &data[3], res.size() * 2);
+    // big endian - swapping bytes of a copy, frame data is shared
     if (data[1] == 0xfe && data[2] == 0xff) {
-        for (size_t i = 3; i < size; i+=2) {
-            std::swap(data[i], data[i+1]);
+        for (auto& ch : res) {
+            ch = swapBytes<uint16_t>(ch);
         }
     }
     // little endian - ok
@@ -162,7 +260,7 @@ std::basic_string<char16_t> tag::Tag::asUtf16LEString(uint8_t* data, size_t size
     else {
         return u"";
     }
-    return std::basic_string<char16_t>((char16_t*)&data[3], (size - 3) / 2);
+    return res;
 }
 
 std::wstring tag::Tag::asUtf16LEWstring(const std::string& title) {
@@ -211,30 +309,64 @@ std::string tag::Tag::asUtf8String_ascii(uint8_t* data, size_t n) {
 }
 
 std::string tag::Tag::asUtf8String_utf16BOM(uint8_t* data, size_t size) {
-    // bin endian - swapping bytes
+    if (size < 2) {
+        return "";
+    }
+    // big endian
     if (data[0] == 0xfe && data[1] == 0xff) {
-        for (size_t i = 2; i < size; i+=2) {
-            std::swap(data[i], data[i+1]);
-        }
+        return utf16ToUtf8((char*)&data[2], size - 2, true);
     }
-    // little endian - ok
+    // little endian
     else if (data[0] == 0xff && data[1] == 0xfe) {
-        ;
+        return utf16ToUtf8((char*)&data[2], size - 2);
     }
     // error - unknown encoding
-    else {
-        return "";
-    }
-    return utf16ToUtf8((char*)&data[2], size - 2);
+    return "";
 }
 
 std::string tag::Tag::asUtf8String_utf16BE(uint8_t* data, size_t size) {
-    for (size_t i = 0; i < size; i+=2) {
-        std::swap(data[i], data[i+1]);
-    }
-    return utf16ToUtf8((char*)&data[0], size);
+    return utf16ToUtf8((char*)&data[0], size, true);
 }
 
 std::string tag::Tag::asUtf8String_utf8(uint8_t* data, size_t n) {
-    return std::string((char*)&data[0], n);
+    // frames come from files - they may contain anything
+    return validUtf8((char*)&data[0], n);
+}
+
+BinaryData::Data tag::Tag::intern(const BinaryData::Data& data) const {
+    return imageStore ? imageStore->intern(data) : data;
+}
+
+BinaryData::Data tag::user::ImageLocation::read() const {
+    auto src = io::open(path);
+    if (!src) {
+        return {};
+    }
+    return read(*src);
+}
+
+BinaryData::Data tag::user::ImageLocation::read(io::ByteSource& src) const {
+    if ((offset > src.size()) || (size > (src.size() - offset))) {
+        return {};
+    }
+    if (auto block = src.block(offset, size)) {
+        return {std::move(block), size};
+    }
+    return {};
+}
+
+bool tag::user::ImageLocation::stream(const std::function<bool(std::span<const uint8_t>)>& sink, size_t chunkSize) const {
+    auto src = io::open(path);
+    if (!src || (offset > src->size()) || (size > (src->size() - offset))) {
+        return false;
+    }
+    std::vector<uint8_t> buf(std::min<uint64_t>(std::max<size_t>(chunkSize, 1), size));
+    for (uint64_t done = 0; done < size;) {
+        size_t n = src->readAt(offset + done, buf.data(), std::min<uint64_t>(buf.size(), size - done));
+        if (!n || !sink(std::span<const uint8_t>(buf.data(), n))) {
+            return false;
+        }
+        done += n;
+    }
+    return true;
 }
@@ -3,16 +3,28 @@
 #include <string>
 #include <cstdint>
 #include <unordered_map>
+#include <unordered_set>
+#include <optional>
+#include <limits>
 #include <memory>
 #include <fstream>
 #include <cassert>
 #include <concepts>
 #include <string.h>
 #include <list>
+#include <algorithm>
 #include <vector>
 #include <filesystem>
+#include <memory_resource>
+#include <string_view>
+#include <span>
+#include <functional>
 #include "util.hpp"
 
+namespace io {
+    class ByteSource;
+}
+
 namespace tag {
 
     enum class Encoding : uint8_t{
@@ -22,14 +34,32 @@ namespace tag {
         Utf8
     };
 
+    // keeps strings, which view readers had to transcode; views into it are valid until it is cleared or destroyed
+    class TextBuffer {
+    public:
+        TextBuffer(std::pmr::memory_resource* memory = std::pmr::get_default_resource()) : strings{memory} {}
+        inline std::string_view store(std::string&& str) { return strings.emplace_back(std::move(str)); }
+        inline void clear() { strings.clear(); }
+    private:
+        // list - stored strings (and their short string buffers) never move
+        std::pmr::list<std::string> strings;
+    };
+
     struct DataBlock {
         DataBlock(uint8_t* data, size_t size);
+        // data is shared with owner, so binary payloads may be returned without copying
+        DataBlock(const std::shared_ptr<uint8_t[]>& owner, size_t size);
+        std::shared_ptr<uint8_t[]> owner;
         uint8_t* data = 0;
         size_t size = 0;
         size_t offset = 0;
         Encoding encoding = Encoding::Ascii;
         // to determine size of lists, strings etc
         size_t sizeOfData = 0;
+        // for containers, built by readers
+        std::pmr::memory_resource* memory = std::pmr::get_default_resource();
+        // for strings, which view readers can't return as views into data; without it they are returned empty
+        TextBuffer* text = nullptr;
     };
 
     struct AsciiStrNullTerminated {
@@ -49,6 +79,8 @@ namespace tag {
     };
 
     std::string decodeStr(uint8_t* data, size_t sz, Encoding encoding);
+    // view into data, if it is valid UTF-8 already, otherwise transcoded string, stored in text
+    std::string_view decodeStrView(uint8_t* data, size_t sz, Encoding encoding, TextBuffer* text);
 
     // Encoded string with null terminator of unknown length
     class EncodedStrNullTerminated {
@@ -64,6 +96,36 @@ namespace tag {
         Data read(DataBlock& data);
     };
 
+    /*
+        View readers - same formats as readers above, but strings and binary data are not copied:
+        results point into frame data (or DataBlock::text) and are valid while they are.
+    */
+    struct AsciiStrNullTerminatedView {
+        using Data = std::string_view;
+        Data read(DataBlock& data);
+    };
+
+    template<size_t N>
+    struct AsciiStrSizedView {
+        using Data = std::string_view;
+        Data read(DataBlock& data) {
+            assert ((data.size - data.offset) >= N);
+            Data res((char*)data.data + data.offset, N);
+            data.offset += N;
+            return res;
+        }
+    };
+
+    struct EncodedStrNullTerminatedView {
+        using Data = std::string_view;
+        Data read(DataBlock& data);
+    };
+
+    struct EncodedStrView {
+        using Data = std::string_view;
+        Data read(DataBlock& data);
+    };
+
     struct BigEndian {};
     struct LittleEndian {};
 
@@ -96,6 +158,11 @@ namespace tag {
         Data read(DataBlock& data);
     };
 
+    struct BinaryDataView {
+        using Data = std::span<const uint8_t>;
+        Data read(DataBlock& data);
+    };
+
     struct EncodingByte {
         using Data = Encoding;
         Data read(DataBlock& data);
@@ -117,19 +184,20 @@ namespace tag {
     // endiannes for internal numbers (size of list)
     template<Endianness E>
     struct ListOfEncodedStrings {
-        using Data = std::list<std::string>;
+        using Data = std::pmr::list<std::string>;
         Data read(DataBlock& data);
     };
 
     template<Endianness E>
     ListOfEncodedStrings<E>::Data ListOfEncodedStrings<E>::read(DataBlock& data) {
         assert (((int64_t)data.size - (int64_t)data.offset) >= 0);
+        Data res(data.memory);
         if ((data.size - data.offset) == 0) {
-            return Data{};
+            return res;
         }
-        Data res;
         size_t sizeOfList = data.sizeOfData;
-        for (size_t i = 0; i < sizeOfList; ++i) {
+        // count comes from file - it is not trusted
+        for (size_t i = 0; (i < sizeOfList) && ((data.size - data.offset) >= 4); ++i) {
             SizeOfData<E> size;
             size.read(data);
             EncodedStr str;
@@ -138,6 +206,29 @@ namespace tag {
         return res;
     }
 
+    template<Endianness E>
+    struct ListOfEncodedStringsView {
+        using Data = std::pmr::vector<std::string_view>;
+        Data read(DataBlock& data);
+    };
+
+    template<Endianness E>
+    ListOfEncodedStringsView<E>::Data ListOfEncodedStringsView<E>::read(DataBlock& data) {
+        assert (((int64_t)data.size - (int64_t)data.offset) >= 0);
+        Data res(data.memory);
+        if ((data.size - data.offset) == 0) {
+            return res;
+        }
+        size_t sizeOfList = data.sizeOfData;
+        res.reserve(std::min(sizeOfList, (data.size - data.offset) / 4));
+        // count comes from file - it is not trusted
+        for (size_t i = 0; (i < sizeOfList) && ((data.size - data.offset) >= 4); ++i) {
+            SizeOfData<E>().read(data);
+            res.push_back(EncodedStrView().read(data));
+        }
+        return res;
+    }
+
     using Byte = Bytes<uint8_t, LittleEndian>;
 
 
@@ -168,11 +259,35 @@ namespace tag {
             StudioLogo
         };
 
+        // picture frames are parsed from that many first bytes; whole frame is read only if its description is longer
+        constexpr size_t ImageHeadSize = 1024;
+
+        /*
+            Picture bytes, left in the file - read or streamed when they are needed (e.g. when cover is served).
+            Valid while file is not changed.
+        */
+        struct ImageLocation {
+            // parsers do not know it - set by getMetainfo
+            std::filesystem::path path;
+            // of picture data, from beginning of file
+            uint64_t offset = 0;
+            uint64_t size = 0;
+            // nullptr, if file can't be read or ends before picture does
+            BinaryData::Data read() const;
+            // same from source, opened by caller
+            BinaryData::Data read(io::ByteSource& src) const;
+            // picture in chunks of at most chunkSize bytes, without loading all of it; sink returns false to stop
+            // returns true, if all bytes were given to sink
+            bool stream(const std::function<bool(std::span<const uint8_t>)>& sink, size_t chunkSize = 64 * 1024) const;
+        };
+
         struct APICUserData {
             // type of image (cover,
             ImageType type;
             std::string mimeType;
+            // empty, if only location was asked for
             BinaryData::Data data;
+            std::optional<ImageLocation> location;
         };
     }
 
@@ -191,11 +306,79 @@ namespace tag {
     class UnknownTagException : public std::exception {};
     class NotImplementedException : public std::exception {};
 
+    // lets maps with pmr::string keys be searched by any string without building a key
+    struct StringHash {
+        using is_transparent = void;
+        inline size_t operator()(std::string_view str) const { return std::hash<std::string_view>()(str); }
+    };
+
+    struct StringEqual {
+        using is_transparent = void;
+        inline bool operator()(std::string_view lhs, std::string_view rhs) const { return lhs == rhs; }
+    };
+
+    // decides which frames (blocks) are stored; rejected ones are skipped without reading
+    struct FrameFilter {
+        // nullopt - all frames are allowed
+        std::optional<std::unordered_set<std::string, StringHash, StringEqual>> allowed;
+        std::unordered_set<std::string, StringHash, StringEqual> denied;
+        // accepted frames, which are stored with their place in source, but loaded only on first access (located pictures)
+        std::unordered_set<std::string, StringHash, StringEqual> deferred;
+        size_t maxFrameSize = std::numeric_limits<size_t>::max();
+        bool accepts(std::string_view frameName, size_t size) const;
+        inline bool defers(std::string_view frameName) const { return deferred.contains(frameName); }
+        bool acceptsAll() const;
+    };
+
+    class ImageStore;
+
+    struct ExtractorConfig {
+        // only frame headers are read, payloads are loaded on first access (ID3v2)
+        bool lazy = false;
+        FrameFilter filter;
+        // pictures, returned by image(), are deduplicated there (shared by many parsers); nullptr - every parser has own copies
+        ImageStore* imageStore = nullptr;
+        // MP3: duration is found together with seek index (ID3V2Parser::seekIndex()), so it does not walk frames again
+        bool seekIndex = false;
+        /*
+            MP3: ID3v1, APEv2 and appended ID3v2 tags are looked for - one more read (at the end) per file.
+            Without them text getters have no fallbacks and CBR duration counts tail tags as audio.
+        */
+        bool tailTags = true;
+        // all allocations of parser and its extractor (frame tables, lists of frames);
+        // must outlive the parser and everything taken from it except of returned strings and images
+        std::pmr::memory_resource* memory = std::pmr::get_default_resource();
+    };
+
+    /*
+        Frame ID packed into integer, first character in the highest byte ("TIT2" - 0x54495432).
+        3 character IDs (ID3v2.2) are padded with zero byte; longer names get NoFrameId.
+    */
+    using FrameId = uint32_t;
+    constexpr FrameId NoFrameId = 0;
+    constexpr FrameId fourcc(std::string_view name) {
+        if (name.empty() || (name.size() > 4)) {
+            return NoFrameId;
+        }
+        FrameId res = 0;
+        for (size_t i = 0; i < 4; ++i) {
+            res = (res << 8) | ((i < name.size()) ? (uint8_t)name[i] : 0);
+        }
+        return res;
+    }
+    std::string fourccString(FrameId id);
+
     class Extractor {
     public:
         using Data = std::shared_ptr<uint8_t[]>;
-        std::pair<Extractor::Data, size_t> frameData(const std::string& frameName);
-        virtual std::list<std::pair<Extractor::Data, size_t>> framesData(const std::string& frameName) = 0;
+        using FramesData = std::pmr::list<std::pair<Extractor::Data, size_t>>;
+        // by name - for convenience; name is converted to id once
+        inline std::pair<Extractor::Data, size_t> frameData(const std::string& frameName) { return frameData(frameId(frameName)); }
+        inline FramesData framesData(const std::string& frameName) { return framesData(frameId(frameName)); }
+        // first frame with the id
+        virtual std::pair<Extractor::Data, size_t> frameData(FrameId id);
+        virtual FramesData framesData(FrameId id) = 0;
+        virtual FrameId frameId(std::string_view frameName) const = 0;
         virtual std::vector<std::string> frameTitles() const = 0;
     };
 
@@ -225,9 +408,15 @@ namespace tag {
         virtual std::string trackNumber() = 0;
         virtual std::string comment() = 0;
         virtual std::vector<user::APICUserData> image() = 0;
+        // pictures without their data - only location in file (without path) is given, picture bytes are not read
+        virtual std::vector<user::APICUserData> imageLocations() = 0;
         virtual size_t durationMs()  = 0;
     protected:
+        // stored copy of picture, if parser has image store
+        BinaryData::Data intern(const BinaryData::Data& data) const;
         std::shared_ptr<Extractor> extractor;
+        std::pmr::memory_resource* memory = std::pmr::get_default_resource();
+        ImageStore* imageStore = nullptr;
     };
 
 }
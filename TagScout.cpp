@@ -1,6 +1,21 @@
 #include "TagScout.hpp"
 #include <fstream>
 #include <algorithm>
+#include <functional>
+#include <unordered_set>
+#include <string.h>
+#include "ThreadPool.hpp"
+#include "Format.hpp"
+#include "Instrumentation.hpp"
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "IoUring.hpp"
+#endif
 
 namespace fs = std::filesystem;
 using namespace tag::id3v2;
@@ -9,72 +24,236 @@ using namespace tag::wav;
 using namespace mp3;
 using namespace tag;
 
-TagScout::TagScout(const std::filesystem::path& path) {
-    for (const fs::directory_entry& entry : fs::recursive_directory_iterator(path)) {
+// frame tables of a typical tag fit into it, so parsing a file does not touch global heap
+static constexpr size_t ParseArenaSize = 16 * 1024;
+
+/*
+    Errors, caused by contents of file (malformed tag or audio data), repeat until file changes - they are cached.
+    Open and I/O errors (no descriptors, EIO) may be temporary - they are not.
+*/
+static bool malformedFile(const std::exception_ptr& error) {
+    try {
+        std::rethrow_exception(error);
+    }
+    catch (NoTagException&) {}
+    catch (UnknownTagException&) {}
+    catch (UnknownTagVersionException&) {}
+    catch (InvalidTagException&) {}
+    catch (tag::NotImplementedException&) {}
+    catch (Mp3FrameParser::EOFException&) {}
+    catch (Mp3FrameParser::NoFrameException&) {}
+    catch (Mp3FrameParser::InvalidFrameHeaderException&) {}
+    catch (Mp3FrameParser::NotImplementedException&) {}
+    catch (...) {
+        return false;
+    }
+    return true;
+}
+
+TagScout::TagScout(const std::filesystem::path& path, size_t threads, cache::MetaCache* cache)
+    : root(path), threads(threads), cache(cache), scanStart(fs::file_time_type::clock::now())
+{
+    INSTR_SCAN("TagScout");
+    auto results = scan();
+    merge(results);
+}
+
+TagScout::~TagScout() {
+    stopWatching();
+}
+
+std::vector<TagScout::ScanResult> TagScout::scan() {
+    if (threads != 1) {
+        return scanParallel();
+    }
+    std::vector<ScanResult> results(1);
+    for (const fs::directory_entry& entry : fs::recursive_directory_iterator(root)) {
         try {
             if (!entry.is_regular_file()) {
                 continue;
             }
-            std::string extension = path.extension().string();
-            std::transform(extension.begin(), extension.end(), extension.begin(), [](char c){ return std::tolower(c); });
-            if (!(extension == ".mp3" || extension == ".flac")) {
-                continue;
-            }
-            std::ifstream ifs(entry.path(), std::ios_base::binary);
-            if (!ifs) {
-                continue;
-            }
-            std::unique_ptr<Tag> parser;
-            if (extension == ".mp3"){
-                parser.reset(new ID3V2Parser(ifs));
-            }
-            else {
-                parser.reset(new FlacTagParser(ifs));
-            }
-            for (const auto& frame: parser->getExtractor()->frameTitles()) {
-                framePathMap[frame].push_back(entry.path().string());
-            }
-            if (extension == ".mp3") {
-                /*if (extractor.version() == 4) {
-                    framePathMap["v4"].push_back(entry.path().string());
-                }*/
-                songDurationMap[entry.path().string()] = getMp3FileDuration(ifs);
+        }
+        catch (...) {
+            continue;
+        }
+        scanFile(entry.path(), results[0], cache);
+    }
+    return results;
+}
+
+/*
+    Every directory is a task; its files are split into batches, which are tasks too.
+    So idle workers can steal both subtrees and parts of big flat directories.
+*/
+std::vector<TagScout::ScanResult> TagScout::scanParallel() {
+    static constexpr size_t FilesPerTask = 64;
+    util::WorkStealingPool pool(threads);
+    std::vector<ScanResult> results(pool.size());
+    std::function<void(const fs::path&)> scanDir = [&](const fs::path& dir) {
+        std::vector<fs::path> files;
+        auto submitFiles = [&]() {
+            pool.submit([&results, cache = cache, files = std::move(files)](size_t worker) {
+                for (const auto& file : files) {
+                    scanFile(file, results[worker], cache);
+                }
+            });
+            files.clear();
+        };
+        std::error_code ec;
+        for (fs::directory_iterator iter(dir, fs::directory_options::skip_permission_denied, ec), end; !ec && iter != end; iter.increment(ec)) {
+            const fs::directory_entry& entry = *iter;
+            std::error_code entryEc;
+            // symlinks to directories are not followed - like recursive_directory_iterator does
+            if (entry.is_directory(entryEc) && !entry.is_symlink(entryEc)) {
+                pool.submit([&scanDir, subdir = entry.path()](size_t) { scanDir(subdir); });
             }
-            else {
-                auto p = dynamic_cast<FlacTagParser*>(parser.get());
-                songDurationMap[entry.path().string()] = p->StreamInfo().totalSamples / p->StreamInfo().sampleRate;
+            else if (entry.is_regular_file(entryEc)) {
+                files.push_back(entry.path());
+                if (files.size() == FilesPerTask) {
+                    submitFiles();
+                }
             }
+        }
+        if (!files.empty()) {
+            submitFiles();
+        }
+    };
+    pool.submit([&scanDir, this](size_t) { scanDir(root); });
+    pool.wait();
+    return results;
+}
 
-            /*mp3::Mp3FrameParser mp3FrameParser(ifs);
-            if (mp3FrameParser.isVBR()) {
-                framePathMap["VBR"].push_back(entry.path().string());
-            }
-            else {
-                framePathMap["CBR"].push_back(entry.path().string());
-            }*/
+// merging in the same order regardless of how work was split between threads
+void TagScout::merge(std::vector<ScanResult>& results) {
+    for (auto& res : results) {
+        for (auto& [frame, paths] : res.framePathMap) {
+            framePathMap[frame].splice(framePathMap[frame].end(), paths);
         }
-        catch (NoTagException&) {
-            // not a error, just no tag
-            continue;
+        songDurationMap.merge(res.songDurationMap);
+    }
+    for (auto& [frame, paths] : framePathMap) {
+        paths.sort();
+    }
+}
+
+void TagScout::scanFile(const std::filesystem::path& path, ScanResult& res, cache::MetaCache* cache) {
+    INSTR_FILE();
+    std::optional<cache::FileKey> key;
+    if (cache) {
+        INSTR_PHASE(Cache);
+        key = cache::statFile(path);
+        if (auto entry = key ? cache->find(*key) : std::nullopt; entry && entry->has(cache::Entry::Frames)) {
+            addEntry(path, *entry, res);
+            return;
         }
-        catch (UnknownTagException&) {
-            // not a error, just unknown tag
-            framePathMap["unknown"].push_back(entry.path().string());
-            continue;
+    }
+    cache::Entry entry;
+    try {
+        if (!parseFile(path, entry)) {
+            return;
         }
-        catch (InvalidTagException&) {
-            // tag is invalid, but some data may be ok
-            continue;
+    }
+    catch (...) {
+        if (!malformedFile(std::current_exception())) {
+            // not cached - error may be temporary
+            res.framePathMap["error"].push_back(path.string());
+            return;
         }
-        catch (Mp3FrameParser::EOFException&) {
-            continue;
+        entry = {};
+        entry.groups = cache::Entry::Frames;
+        entry.frames = {"error"};
+    }
+    addEntry(path, entry, res);
+    if (key) {
+        INSTR_PHASE(Cache);
+        entry.key = *key;
+        cache->put(std::move(entry));
+    }
+}
+
+void TagScout::addEntry(const std::filesystem::path& path, const cache::Entry& entry, ScanResult& res) {
+    for (const auto& frame : entry.frames) {
+        res.framePathMap[frame].push_back(path.string());
+    }
+    if (entry.has(cache::Entry::Duration)) {
+        res.songDurationMap[path.string()] = entry.durationMs;
+    }
+}
+
+bool TagScout::parseFile(const std::filesystem::path& path, cache::Entry& entry) {
+    auto src = io::open(path);
+    if (!src) {
+        return false;
+    }
+    entry.groups = cache::Entry::Frames;
+    Format format = detectFormat(*src, path);
+    INSTR_FORMAT(format);
+    if ((format != Format::Mp3) && (format != Format::Flac)) {
+        // nothing to scan - cached as it is, so file is not read again
+        return true;
+    }
+    // declared before parser - it has to outlive it
+    std::byte arenaBuf[ParseArenaSize];
+    std::pmr::monotonic_buffer_resource arena(arenaBuf, sizeof(arenaBuf));
+    try {
+        ExtractorConfig config;
+        config.memory = &arena;
+        std::unique_ptr<Tag> parser;
+        if (format == Format::Mp3){
+            // only frame titles are needed - payloads are never loaded
+            config.lazy = true;
+            parser.reset(new ID3V2Parser(src, config));
         }
-        catch (Mp3FrameParser::NoFrameException&) {
-            continue;
+        else {
+            parser.reset(new FlacTagParser(src, config));
         }
-        catch (...) {
-            framePathMap["error"].push_back(entry.path().string());
+        // no extractor - file has no tag
+        if (auto extractor = parser->getExtractor()) {
+            entry.frames = extractor->frameTitles();
         }
+        if (format == Format::Mp3) {
+            // tags at the end of file have no frames - they are listed by kind
+            const auto& tail = static_cast<ID3V2Parser&>(*parser).tailTags();
+            if (tail.hasApe) {
+                entry.frames.push_back("APEv2");
+            }
+            if (tail.id3v1) {
+                entry.frames.push_back("ID3v1");
+            }
+        }
+        /*if (extractor.version() == 4) {
+            entry.frames.push_back("v4");
+        }*/
+        entry.durationMs = parser->durationMs();
+        entry.groups |= cache::Entry::Duration;
+
+        /*mp3::Mp3FrameParser mp3FrameParser(*src);
+        if (mp3FrameParser.isVBR()) {
+            entry.frames.push_back("VBR");
+        }
+        else {
+            entry.frames.push_back("CBR");
+        }*/
+        return true;
+    }
+    catch (NoTagException&) {
+        // not a error, just no tag
+        return true;
+    }
+    catch (UnknownTagException&) {
+        // not a error, just unknown tag
+        entry.frames.push_back("unknown");
+        return true;
+    }
+    catch (InvalidTagException&) {
+        // tag is invalid, but some data may be ok
+        return true;
+    }
+    catch (Mp3FrameParser::EOFException&) {
+        return true;
+    }
+    catch (Mp3FrameParser::NoFrameException&) {
+        return true;
     }
 }
 
@@ -83,6 +262,7 @@ void TagScout::dump(const std::filesystem::path& path) {
     if (!ofs) {
         return;
     }
+    std::lock_guard lock(mtx);
     for (const auto& [frame, songs] : framePathMap) {
         ofs << frame << "\n";
         for (const auto& song : songs) {
@@ -97,63 +277,862 @@ void TagScout::dumpDurations(const std::filesystem::path& path) {
     if (!ofs) {
         return;
     }
+    std::lock_guard lock(mtx);
     for (const auto& [path, duration] : songDurationMap) {
         ofs << duration << ": " << path << std::endl;
     }
 }
 
+#ifdef __linux__
+void TagScout::watch() {
+    if (watcher.joinable()) {
+        return;
+    }
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ((inotifyFd < 0) || (stopFd < 0)) {
+        stopWatching();
+        throw std::system_error(errno, std::generic_category(), "inotify");
+    }
+    std::vector<fs::path> files;
+    addWatches(root, files);
+    // catching up with changes, made between scan and adding of watches;
+    // file times are coarse (up to 2 s on FAT), so files, changed shortly before scan, are parsed again too
+    auto since = scanStart - std::chrono::seconds(2);
+    std::vector<fs::path> changed;
+    std::unordered_set<std::string> present;
+    for (const auto& file : files) {
+        std::error_code ec;
+        present.insert(file.string());
+        if (fs::last_write_time(file, ec) >= since) {
+            changed.push_back(file);
+        }
+    }
+    {
+        std::lock_guard lock(mtx);
+        buildPathIndex();
+        for (const auto& [path, frames] : pathFrames) {
+            if (!present.contains(path)) {
+                changed.push_back(path);
+            }
+        }
+    }
+    update(changed, {});
+    watcher = std::thread([this]() { watchLoop(); });
+}
 
+void TagScout::stopWatching() {
+    if (watcher.joinable()) {
+        uint64_t one = 1;
+        (void)!write(stopFd, &one, sizeof(one));
+        watcher.join();
+    }
+    if (inotifyFd >= 0) {
+        close(inotifyFd);
+        inotifyFd = -1;
+    }
+    if (stopFd >= 0) {
+        close(stopFd);
+        stopFd = -1;
+    }
+    watchDirs.clear();
+}
 
-std::unordered_map<std::string, MetainfoData> getMetainfo(const std::filesystem::path& path, const GetMetaInfoConfig& config) {
-
-    if (!std::filesystem::is_regular_file(path)) {
-        throw NoTagException{};
+void TagScout::addWatches(const std::filesystem::path& dir, std::vector<std::filesystem::path>& files) {
+    static constexpr uint32_t Mask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+    int wd = inotify_add_watch(inotifyFd, dir.c_str(), Mask);
+    if (wd < 0) {
+        return;
     }
-    std::string extension = path.extension().string();
-    std::transform(extension.begin(), extension.end(), extension.begin(), [](char c){ return std::tolower(c); });
-    std::vector<std::string> supportedExtensions = {".mp3", ".flac", ".wav"};
-    if (!std::any_of(supportedExtensions.begin(), supportedExtensions.end(), [&extension](const auto& supExt){ return extension == supExt; })) {
-        return {};
+    watchDirs[wd] = dir;
+    std::error_code ec;
+    for (fs::directory_iterator iter(dir, fs::directory_options::skip_permission_denied, ec), end; !ec && iter != end; iter.increment(ec)) {
+        const fs::directory_entry& entry = *iter;
+        std::error_code entryEc;
+        if (entry.is_directory(entryEc) && !entry.is_symlink(entryEc)) {
+            addWatches(entry.path(), files);
+        }
+        else if (entry.is_regular_file(entryEc)) {
+            files.push_back(entry.path());
+        }
     }
-    std::ifstream ifs(path, std::ios_base::binary);
-    if (!ifs) {
-        return {};
+}
+
+void TagScout::removeWatches(const std::filesystem::path& dir) {
+    std::string prefix = dir.string() + "/";
+    for (auto iter = watchDirs.begin(); iter != watchDirs.end();) {
+        if ((iter->second == dir) || iter->second.string().starts_with(prefix)) {
+            inotify_rm_watch(inotifyFd, iter->first);
+            iter = watchDirs.erase(iter);
+        }
+        else {
+            ++iter;
+        }
     }
-    try {
-        std::unique_ptr<Tag> parser;
-        try {
-            if (extension == ".mp3"){
-                parser.reset(new ID3V2Parser(ifs));
+}
+
+void TagScout::watchLoop() {
+    using Clock = std::chrono::steady_clock;
+    std::vector<fs::path> files;
+    std::vector<fs::path> removedDirs;
+    bool overflow = false;
+    Clock::time_point firstEvent;
+    alignas(inotify_event) char buf[64 * 1024];
+    while (true) {
+        bool dirty = !files.empty() || !removedDirs.empty() || overflow;
+        int timeout = -1;
+        if (dirty) {
+            auto untilMax = std::chrono::duration_cast<std::chrono::milliseconds>(firstEvent + std::chrono::milliseconds(MaxDelayMs) - Clock::now()).count();
+            timeout = (int)std::max<int64_t>(0, std::min<int64_t>(CoalesceMs, untilMax));
+        }
+        pollfd fds[2] = {{inotifyFd, POLLIN, 0}, {stopFd, POLLIN, 0}};
+        int ready = poll(fds, 2, timeout);
+        if ((ready < 0) && (errno != EINTR)) {
+            return;
+        }
+        if (fds[1].revents) {
+            return;
+        }
+        // quiet period is over or events keep coming for too long - changes are not delayed more than MaxDelayMs
+        if (dirty && ((ready == 0) || (Clock::now() >= (firstEvent + std::chrono::milliseconds(MaxDelayMs))))) {
+            if (overflow) {
+                // directories, created while events were dropped, are not watched yet; watches of the known ones are just updated
+                std::vector<fs::path> all;
+                addWatches(root, all);
+                rescan();
             }
-            else if (extension == ".flac") {
-                parser.reset(new FlacTagParser(ifs));
+            else {
+                update(files, removedDirs);
+            }
+            files.clear();
+            removedDirs.clear();
+            overflow = false;
+            continue;
+        }
+        if (!(fds[0].revents & POLLIN)) {
+            continue;
+        }
+        ssize_t len = read(inotifyFd, buf, sizeof(buf));
+        if (len <= 0) {
+            continue;
+        }
+        if (!dirty) {
+            firstEvent = Clock::now();
+        }
+        for (char* ptr = buf; ptr < (buf + len); ptr += sizeof(inotify_event) + ((inotify_event*)ptr)->len) {
+            const inotify_event* event = (const inotify_event*)ptr;
+            if (event->mask & IN_Q_OVERFLOW) {
+                // events are lost - nothing to do but to scan everything
+                overflow = true;
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                watchDirs.erase(event->wd);
+                continue;
+            }
+            auto dirIter = watchDirs.find(event->wd);
+            if ((dirIter == watchDirs.end()) || !event->len) {
+                continue;
+            }
+            fs::path path = dirIter->second / event->name;
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    removeWatches(path);
+                    removedDirs.push_back(path);
+                }
+                else if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    // files may appear before watch is added - they are found by directory listing
+                    addWatches(path, files);
+                }
             }
             else {
-                parser.reset(new WavParser(ifs));
+                files.push_back(std::move(path));
             }
         }
-        catch (...) {}
+    }
+}
+
+void TagScout::update(const std::vector<std::filesystem::path>& files, const std::vector<std::filesystem::path>& removedDirs) {
+    // files are parsed without lock; every file - once, however many events it had
+    std::vector<fs::path> unique = files;
+    std::sort(unique.begin(), unique.end());
+    unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+    INSTR_SCAN("TagScout update");
+    ScanResult res;
+    for (const auto& file : unique) {
+        std::error_code ec;
+        if (fs::is_regular_file(file, ec)) {
+            scanFile(file, res, cache);
+        }
+    }
+    std::lock_guard lock(mtx);
+    for (const auto& dir : removedDirs) {
+        std::string prefix = dir.string() + "/";
+        std::vector<std::string> removed;
+        for (const auto& [path, frames] : pathFrames) {
+            if (path.starts_with(prefix)) {
+                removed.push_back(path);
+            }
+        }
+        for (const auto& path : removed) {
+            removePath(path);
+        }
+    }
+    for (const auto& file : unique) {
+        removePath(file.string());
+    }
+    for (auto& [frame, paths] : res.framePathMap) {
+        auto& dst = framePathMap[frame];
+        for (auto& path : paths) {
+            pathFrames[path].push_back(frame);
+            dst.insert(std::lower_bound(dst.begin(), dst.end(), path), path);
+        }
+    }
+    for (auto& [path, duration] : res.songDurationMap) {
+        pathFrames.try_emplace(path);
+        songDurationMap[path] = duration;
+    }
+}
+
+void TagScout::rescan() {
+    INSTR_SCAN("TagScout rescan");
+    auto results = scan();
+    std::lock_guard lock(mtx);
+    framePathMap.clear();
+    songDurationMap.clear();
+    merge(results);
+    buildPathIndex();
+}
+#else
+void TagScout::watch() {
+    throw NotImplementedException{};
+}
+
+void TagScout::stopWatching() {}
+#endif
+
+void TagScout::buildPathIndex() {
+    pathFrames.clear();
+    for (const auto& [frame, paths] : framePathMap) {
+        for (const auto& path : paths) {
+            pathFrames[path].push_back(frame);
+        }
+    }
+    for (const auto& [path, duration] : songDurationMap) {
+        pathFrames.try_emplace(path);
+    }
+}
+
+void TagScout::removePath(const std::string& path) {
+    auto iter = pathFrames.find(path);
+    if (iter == pathFrames.end()) {
+        return;
+    }
+    for (const auto& frame : iter->second) {
+        auto frameIter = framePathMap.find(frame);
+        if (frameIter == framePathMap.end()) {
+            continue;
+        }
+        frameIter->second.remove(path);
+        if (frameIter->second.empty()) {
+            framePathMap.erase(frameIter);
+        }
+    }
+    songDurationMap.erase(path);
+    pathFrames.erase(iter);
+}
+
+
+// only frames getMetainfo is going to read are loaded
+static ExtractorConfig extractorConfig(const GetMetaInfoConfig& config, Format format) {
+    ExtractorConfig res;
+    res.imageStore = config.imageStore;
+    res.filter.maxFrameSize = config.maxFrameSize;
+    res.filter.allowed.emplace();
+    auto& allowed = *res.filter.allowed;
+    if (format == Format::Mp3) {
+        // fallbacks of text and end of audio for duration - pictures need no read at the end of file
+        res.tailTags = config.textual || config.duration;
+        if (config.textual) {
+            allowed.insert({"TIT2", "TALB", "TPE1", "TYER", "TRCK", "COMM"});
+        }
+        if (config.images) {
+            allowed.insert("APIC");
+            if (config.imageLocations) {
+                res.filter.deferred.insert("APIC");
+            }
+        }
+    }
+    else if (format == Format::Flac) {
+        // STREAMINFO is always read
+        if (config.textual) {
+            allowed.insert("VORBIS_COMMENT");
+        }
+        if (config.images) {
+            allowed.insert("PICTURE");
+            if (config.imageLocations) {
+                res.filter.deferred.insert("PICTURE");
+            }
+        }
+    }
+    return res;
+}
+
+// entry is taken by value - parsed entries are moved in, cached ones are copied
+static MetaInfo metainfoFromEntry(cache::Entry entry, const GetMetaInfoConfig& config) {
+    MetaInfo metainfo;
+    if (config.textual) {
+        metainfo.fields |= MetaInfo::Textual;
+        metainfo.title = std::move(entry.title);
+        metainfo.album = std::move(entry.album);
+        metainfo.artist = std::move(entry.artist);
+        metainfo.year = std::move(entry.year);
+        metainfo.trackNumber = std::move(entry.trackNumber);
+        metainfo.comment = std::move(entry.comment);
+    }
+    if (config.duration) {
+        metainfo.fields |= MetaInfo::Duration;
+        metainfo.durationMs = entry.durationMs;
+    }
+    if (config.images) {
+        metainfo.fields |= MetaInfo::Images;
+    }
+    return metainfo;
+}
+
+static uint8_t requestedGroups(const GetMetaInfoConfig& config) {
+    return (config.textual ? cache::Entry::Textual : 0) | (config.duration ? cache::Entry::Duration : 0) | (config.images ? cache::Entry::Images : 0);
+}
+
+// results, limited by frame size, are not complete - they are not cached
+static bool cacheable(const GetMetaInfoConfig& config, cache::MetaCache* cache) {
+    return cache && (config.maxFrameSize == std::numeric_limits<size_t>::max());
+}
+
+// returns cached metainfo of file version, if there is one
+static std::optional<MetaInfo> lookupMetainfo(const std::filesystem::path& path, const GetMetaInfoConfig& config,
+                                              cache::MetaCache& cache, const cache::FileKey& key) {
+    INSTR_PHASE(Cache);
+    if (auto entry = cache.find(key)) {
+        if (entry->has(cache::Entry::Failed)) {
+            return MetaInfo{};
+        }
+        // image data is not cached, so only files without images (or with located ones) are served without parsing
+        bool located = config.imageLocations && std::all_of(entry->images.begin(), entry->images.end(), [](const auto& image) { return image.offset; });
+        if (entry->has(requestedGroups(config)) && (!config.images || entry->images.empty() || located)) {
+            std::vector<user::APICUserData> images;
+            if (config.images) {
+                for (const auto& image : entry->images) {
+                    images.push_back({(user::ImageType)image.type, image.mimeType, {}, user::ImageLocation{path, image.offset, image.size}});
+                }
+            }
+            MetaInfo metainfo = metainfoFromEntry(std::move(*entry), config);
+            metainfo.images = std::move(images);
+            return metainfo;
+        }
+    }
+    return std::nullopt;
+}
+
+static MetaInfo parseMetainfo(const std::filesystem::path& path, const std::shared_ptr<io::ByteSource>& src, Format format,
+                              const GetMetaInfoConfig& config, cache::MetaCache* cache, const std::optional<cache::FileKey>& key) {
+    INSTR_FORMAT(format);
+    cache::Entry entry;
+    entry.groups = requestedGroups(config);
+    if (key) {
+        entry.key = *key;
+    }
+    std::vector<user::APICUserData> images;
+    std::byte arenaBuf[ParseArenaSize];
+    std::pmr::monotonic_buffer_resource arena(arenaBuf, sizeof(arenaBuf));
+    ExtractorConfig extractor = extractorConfig(config, format);
+    extractor.memory = &arena;
+    try {
+        std::unique_ptr<Tag> parser;
+        if (format == Format::Mp3){
+            parser.reset(new ID3V2Parser(src, extractor));
+        }
+        else if (format == Format::Flac) {
+            parser.reset(new FlacTagParser(src, extractor));
+        }
+        else if (format == Format::Wav) {
+            parser.reset(new WavParser(*src));
+        }
         if (!parser) {
-            return {};
+            throw InvalidTagException{};
         }
-        std::unordered_map<std::string, MetainfoData> metainfo;
         if (config.textual) {
-            metainfo["title"] = parser->songTitle();
-            metainfo["album"] = parser->album();
-            metainfo["artist"] = parser->artist();
-            metainfo["year"] = parser->year();
-            metainfo["trackNumber"] = parser->trackNumber();
-            metainfo["comment"] = parser->comment();
+            entry.title = parser->songTitle();
+            entry.album = parser->album();
+            entry.artist = parser->artist();
+            entry.year = parser->year();
+            entry.trackNumber = parser->trackNumber();
+            entry.comment = parser->comment();
         }
         if (config.duration) {
-            metainfo["durationMs"] = std::to_string(parser->durationMs());
+            entry.durationMs = parser->durationMs();
         }
         if (config.images) {
-            metainfo["images"] = parser->image();
+            images = config.imageLocations ? parser->imageLocations() : parser->image();
+            for (auto& image : images) {
+                uint64_t size = image.data.second;
+                uint64_t offset = 0;
+                if (image.location) {
+                    image.location->path = path;
+                    size = image.location->size;
+                    offset = image.location->offset;
+                }
+                entry.images.push_back(cache::ImageInfo{(uint8_t)image.type, image.mimeType, size, offset});
+            }
         }
-        return metainfo;
     }
     catch (...) {
+        // same policy as scan: only failures, caused by file contents, are cached
+        if (key && src->complete() && malformedFile(std::current_exception())) {
+            INSTR_PHASE(Cache);
+            entry.groups = cache::Entry::Failed;
+            cache->put(std::move(entry));
+        }
+        return {};
+    }
+    // some reads were deferred - file is parsed again, when they are done
+    if (!src->complete()) {
         return {};
     }
+    if (!key) {
+        MetaInfo metainfo = metainfoFromEntry(std::move(entry), config);
+        metainfo.images = std::move(images);
+        return metainfo;
+    }
+    MetaInfo metainfo = metainfoFromEntry(entry, config);
+    metainfo.images = std::move(images);
+    {
+        INSTR_PHASE(Cache);
+        cache->put(std::move(entry));
+    }
+    return metainfo;
+}
+
+MetaInfo getMetainfo(const std::filesystem::path& path, const GetMetaInfoConfig& config, cache::MetaCache* cache) {
+    INSTR_FILE();
+    // one statx gives both file type and version for cache
+    std::optional<cache::FileKey> key = cache::statFile(path);
+    if (!key) {
+        throw NoTagException{};
+    }
+    // key is kept only if results of parse should be cached
+    if (!cacheable(config, cache)) {
+        key.reset();
+    }
+    else if (auto cached = lookupMetainfo(path, config, *cache, *key)) {
+        return std::move(*cached);
+    }
+    auto src = io::open(path);
+    if (!src) {
+        return {};
+    }
+    return parseMetainfo(path, src, detectFormat(*src, path), config, cache, key);
+}
+
+#ifdef __linux__
+namespace {
+
+    /*
+        State of one file in getMetainfoBatch.
+        Bytes at the beginning of file are kept in one growing buffer (prefix), so tag is one contiguous block;
+        other needed ranges (FLAC blocks behind skipped ones) get own buffers.
+    */
+    struct BatchFile {
+        struct Read {
+            uint64_t offset;
+            size_t size;
+            // index in ranges or npos for prefix
+            size_t range;
+        };
+        struct Range {
+            uint64_t offset;
+            size_t size;
+            io::ByteSource::Block data;
+        };
+        static constexpr size_t npos = (size_t)-1;
+
+        size_t index;
+        std::string path;
+        // by extension, until head is loaded
+        Format format = Format::Unknown;
+        std::optional<cache::FileKey> key;
+        int fd = -1;
+        uint64_t size = 0;
+        io::ByteSource::Block prefix;
+        size_t prefixSize = 0;
+        std::vector<Range> ranges;
+        std::vector<Read> reads;
+        size_t inflight = 0;
+        // parsed or given up
+        bool done = false;
+        // all read requests of the file
+        size_t readsIssued = 0;
+        // small reads, deferred by first parse (samples of bitrate) - loaded by ring for the second one
+        std::vector<std::pair<uint64_t, size_t>> peeks;
+        bool reparse = false;
+        // loaded bytes before current reads
+        size_t roundStart = 0;
+
+        bool loaded(uint64_t offset, size_t n) const {
+            if ((offset + n) <= prefixSize) {
+                return true;
+            }
+            return std::any_of(ranges.begin(), ranges.end(), [&](const Range& range) {
+                return (offset >= range.offset) && ((offset + n) <= (range.offset + range.size));
+            });
+        }
+
+        // returns byte at offset, which must be loaded
+        uint8_t at(uint64_t offset) const {
+            if (offset < prefixSize) {
+                return prefix[offset];
+            }
+            for (const auto& range : ranges) {
+                if ((offset >= range.offset) && (offset < (range.offset + range.size))) {
+                    return range.data[offset - range.offset];
+                }
+            }
+            return 0;
+        }
+
+        size_t loadedBytes() const {
+            size_t res = prefixSize;
+            for (const auto& range : ranges) {
+                res += range.size;
+            }
+            return res;
+        }
+    };
+
+    // first read of every file
+    constexpr size_t HeadSize = 64 * 1024;
+    // limit for one read request
+    constexpr size_t MaxReadSize = 1 << 30;
+
+    /*
+        Returns ranges, which parser of the file will read and which are not loaded yet; empty - file may be parsed.
+        Ranges, unknown until some bytes are loaded (FLAC blocks behind the head), are returned in following rounds.
+    */
+    std::vector<std::pair<uint64_t, uint64_t>> planReads(const BatchFile& file, const ExtractorConfig& mp3Config, const ExtractorConfig& flacConfig) {
+        std::vector<std::pair<uint64_t, uint64_t>> res;
+        if (!file.size) {
+            return res;
+        }
+        if (!file.prefixSize) {
+            res.push_back({0, std::min<uint64_t>(file.size, HeadSize)});
+            return res;
+        }
+        if (file.format == Format::Mp3) {
+            // whole ID3v2 tag and beginning of audio (first frame with Xing/VBRI header)
+            if ((file.prefixSize >= 10) && !memcmp(file.prefix.get(), "ID3", 3)) {
+                const uint8_t* header = file.prefix.get();
+                uint64_t tagEnd = ((header[5] & 0x10) ? 20 : 10) + (((uint64_t)header[6] << 21) | ((uint64_t)header[7] << 14) | ((uint64_t)header[8] << 7) | header[9]);
+                uint64_t end = std::min<uint64_t>(file.size, tagEnd + ID3V2Extractor::AudioProbeSize);
+                if (end > file.prefixSize) {
+                    res.push_back({file.prefixSize, end});
+                }
+            }
+            // tags at the end of file (ID3v1, APEv2, appended ID3v2)
+            uint64_t tailBegin = file.size - std::min<uint64_t>(file.size, tail::ProbeSize);
+            if (mp3Config.tailTags && !file.loaded(tailBegin, file.size - tailBegin)) {
+                res.push_back({std::max<uint64_t>(tailBegin, file.prefixSize), file.size});
+            }
+        }
+        else if (file.format == Format::Flac) {
+            uint64_t skip = id3v2Size(file.prefix.get(), file.prefixSize);
+            if ((file.prefixSize < (skip + 4)) || memcmp(file.prefix.get() + skip, "fLaC", 4)) {
+                return res;
+            }
+            uint64_t offset = skip + 4;
+            while ((offset + 4) <= file.size) {
+                if (!file.loaded(offset, 4)) {
+                    // header is behind loaded data - it is read in next round
+                    res.push_back({offset, std::min<uint64_t>(file.size, offset + HeadSize)});
+                    break;
+                }
+                uint8_t type = file.at(offset);
+                size_t size = ((size_t)file.at(offset + 1) << 16) | ((size_t)file.at(offset + 2) << 8) | file.at(offset + 3);
+                uint64_t end = std::min<uint64_t>(file.size, offset + 4 + size);
+                if (FlacTagExtractor::accepts(flacConfig, type & 0x7f, size)) {
+                    uint64_t needed = end;
+                    // of deferred (located) pictures only heads are parsed
+                    if (((type & 0x7f) == (uint8_t)FlacTagExtractor::BlockType::PICTURE) && flacConfig.filter.defers("PICTURE")) {
+                        needed = std::min<uint64_t>(end, offset + 4 + user::ImageHeadSize);
+                    }
+                    if (!file.loaded(offset + 4, needed - offset - 4)) {
+                        res.push_back({offset + 4, needed});
+                    }
+                }
+                offset = end;
+                if (type & 0x80) {
+                    break;
+                }
+            }
+        }
+        for (auto [offset, n] : file.peeks) {
+            if (!file.loaded(offset, n)) {
+                res.push_back({offset, std::min<uint64_t>(file.size, offset + n)});
+            }
+        }
+        std::sort(res.begin(), res.end());
+        // adjacent ranges - one read
+        std::vector<std::pair<uint64_t, uint64_t>> merged;
+        for (const auto& range : res) {
+            if (!merged.empty() && (merged.back().second >= range.first)) {
+                merged.back().second = std::max(merged.back().second, range.second);
+            }
+            else {
+                merged.push_back(range);
+            }
+        }
+        return merged;
+    }
+
+}
+
+/*
+    Pipeline on io_uring: open -> head read -> reads, planned from loaded bytes (repeated, while there are any) -> parse.
+    At most MaxInFlight files are in progress. Parser reads from loaded ranges; rare reads outside of them
+    (e.g. frame walk of VBR file without Xing header) are done synchronously.
+    Returns indices of results, which are left to blocking code: files, which ring could not open, and,
+    if ring (or anything else) fails in the middle, all unfinished ones - finished results are kept.
+*/
+static std::vector<size_t> getMetainfoUring(std::vector<BatchFile>& files, const GetMetaInfoConfig& config, cache::MetaCache* cache,
+                                            std::vector<MetaInfo>& results) {
+    static constexpr size_t MaxInFlight = 64;
+    // open marker in user data; reads have index of read there
+    static constexpr uint64_t OpenTag = 0xffffffff;
+    io::Uring ring(256);
+    if (!ring.supports(IORING_OP_OPENAT) || !ring.supports(IORING_OP_READ)) {
+        throw io::Uring::SetupException{};
+    }
+    ExtractorConfig mp3Config = extractorConfig(config, Format::Mp3);
+    ExtractorConfig flacConfig = extractorConfig(config, Format::Flac);
+    size_t next = 0;
+    size_t active = 0;
+    std::vector<size_t> fallback;
+    // completions, taken off the ring, but not handled yet - ring is reaped while waiting for free entries
+    std::vector<std::pair<uint64_t, int>> reaped;
+
+    auto reap = [&]() {
+        while (const io_uring_cqe* cqe = ring.peek()) {
+            reaped.emplace_back(cqe->user_data, cqe->res);
+            ring.pop();
+        }
+    };
+    auto prep = [&](auto&& fn) {
+        // submission queue is full - kernel takes entries, when completion queue has room for their results
+        while (!fn()) {
+            ring.submit(ring.inflight() ? 1 : 0);
+            reap();
+        }
+    };
+    // file may need one more round of reads after parse - advance is defined later
+    std::function<void(size_t)> advance;
+    auto finish = [&](size_t slot, bool parse) {
+        BatchFile& file = files[slot];
+        if (parse) {
+            INSTR_FILE();
+            INSTR_ASYNC_READ(file.loadedBytes(), file.readsIssued);
+            auto src = std::make_shared<io::RangeByteSource>(file.fd, file.size);
+            src->add(0, file.prefix, file.prefixSize);
+            for (auto& range : file.ranges) {
+                src->add(range.offset, range.data, range.size);
+            }
+            // scattered small reads would be blocking preads - first parse only collects them
+            src->deferPeeks(!file.reparse);
+            results[file.index] = parseMetainfo(file.path, src, file.format, config, cache, file.key);
+            if (!src->complete()) {
+                file.peeks = src->deferred();
+                file.reparse = true;
+                advance(slot);
+                return;
+            }
+        }
+        if (file.fd >= 0) {
+            close(file.fd);
+            file.fd = -1;
+        }
+        file.prefix.reset();
+        file.ranges.clear();
+        file.done = true;
+        --active;
+    };
+    // plans and submits next reads or parses file, when all needed bytes are there
+    advance = [&](size_t slot) {
+        BatchFile& file = files[slot];
+        auto plan = planReads(file, mp3Config, flacConfig);
+        if (plan.empty()) {
+            finish(slot, true);
+            return;
+        }
+        file.reads.clear();
+        for (auto [begin, end] : plan) {
+            end = std::min<uint64_t>(end, begin + MaxReadSize);
+            if (begin <= file.prefixSize) {
+                // growing prefix
+                io::ByteSource::Block grown(new uint8_t[end]);
+                if (file.prefixSize) {
+                    memcpy(grown.get(), file.prefix.get(), file.prefixSize);
+                }
+                file.prefix = std::move(grown);
+                begin = file.prefixSize;
+                file.reads.push_back(BatchFile::Read{begin, (size_t)(end - begin), BatchFile::npos});
+            }
+            else {
+                file.ranges.push_back(BatchFile::Range{begin, 0, io::ByteSource::Block(new uint8_t[end - begin])});
+                file.reads.push_back(BatchFile::Read{begin, (size_t)(end - begin), file.ranges.size() - 1});
+            }
+        }
+        file.inflight = file.reads.size();
+        file.readsIssued += file.reads.size();
+        file.roundStart = file.loadedBytes();
+        for (size_t i = 0; i < file.reads.size(); ++i) {
+            const auto& read = file.reads[i];
+            uint8_t* dst = (read.range == BatchFile::npos) ? file.prefix.get() + read.offset : file.ranges[read.range].data.get();
+            prep([&]() { return ring.prepRead(file.fd, dst, read.size, read.offset, ((uint64_t)slot << 32) | i); });
+        }
+    };
+    auto start = [&]() {
+        for (; (active < MaxInFlight) && (next < files.size()); ++next) {
+            ++active;
+            prep([&]() { return ring.prepOpen(files[next].path.c_str(), O_RDONLY | O_CLOEXEC, ((uint64_t)next << 32) | OpenTag); });
+        }
+    };
+    auto handle = [&](uint64_t userData, int res) {
+        size_t slot = userData >> 32;
+        uint64_t tag = userData & 0xffffffff;
+        BatchFile& file = files[slot];
+        if (tag == OpenTag) {
+            struct stat st;
+            if (res < 0) {
+                // missing file or no IORING_OP_OPENAT for this kind of path - blocking code knows what to do
+                fallback.push_back(file.index);
+                finish(slot, false);
+                return;
+            }
+            file.fd = res;
+            if (fstat(file.fd, &st) || !S_ISREG(st.st_mode)) {
+                finish(slot, false);
+                return;
+            }
+            file.size = st.st_size;
+            advance(slot);
+            return;
+        }
+        // short or failed read - missing bytes are read synchronously by parser, if it needs them
+        const auto& read = file.reads[tag];
+        size_t got = (res > 0) ? (size_t)res : 0;
+        if (read.range == BatchFile::npos) {
+            // prefix reads are issued one per round, so bytes before read.offset are loaded
+            file.prefixSize = read.offset + got;
+            // head - content overrides extension, like in detectFormat; sniffed again, when prefix grows past ID3v2 tag
+            if (Format sniffed = sniffFormat(file.prefix.get(), file.prefixSize); sniffed != Format::Unknown) {
+                file.format = sniffed;
+            }
+        }
+        else {
+            file.ranges[read.range].size = got;
+        }
+        if (--file.inflight) {
+            return;
+        }
+        // nothing was read (file is shorter than it was) - parser gets what there is
+        if (file.loadedBytes() == file.roundStart) {
+            finish(slot, true);
+            return;
+        }
+        advance(slot);
+    };
+
+    try {
+        start();
+        while (active) {
+            // completions, reaped while preparing entries, are handled before waiting for new ones
+            ring.submit(reaped.empty() ? 1 : 0);
+            reap();
+            std::vector<std::pair<uint64_t, int>> batch;
+            batch.swap(reaped);
+            for (auto [userData, res] : batch) {
+                handle(userData, res);
+            }
+            start();
+        }
+    }
+    catch (...) {
+        // reads in flight write into buffers of files - they are freed only when kernel is done with them
+        bool drained = ring.drain();
+        for (auto& file : files) {
+            if (file.done) {
+                continue;
+            }
+            if (file.fd >= 0) {
+                close(file.fd);
+                file.fd = -1;
+            }
+            fallback.push_back(file.index);
+        }
+        if (!drained) {
+            // moved vector keeps its elements in place, so buffers and paths stay valid for kernel
+            (void)new std::vector<BatchFile>(std::move(files));
+        }
+    }
+    return fallback;
+}
+#endif
+
+std::vector<MetaInfo> getMetainfoBatch(std::span<const std::filesystem::path> paths, const GetMetaInfoConfig& config, cache::MetaCache* cache) {
+    INSTR_SCAN("getMetainfoBatch");
+    std::vector<MetaInfo> results(paths.size());
+    // cache hits need no I/O
+    std::vector<size_t> pending;
+    std::vector<std::optional<cache::FileKey>> keys(paths.size());
+    bool useCache = cacheable(config, cache);
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (useCache) {
+            keys[i] = cache::statFile(paths[i]);
+            if (auto cached = keys[i] ? lookupMetainfo(paths[i], config, *cache, *keys[i]) : std::nullopt) {
+                results[i] = std::move(*cached);
+                continue;
+            }
+        }
+        pending.push_back(i);
+    }
+    if (pending.empty()) {
+        return results;
+    }
+#ifdef __linux__
+    try {
+        std::vector<BatchFile> files(pending.size());
+        for (size_t i = 0; i < pending.size(); ++i) {
+            files[i].index = pending[i];
+            files[i].path = paths[pending[i]].string();
+            files[i].format = formatFromExtension(paths[pending[i]]);
+            files[i].key = keys[pending[i]];
+        }
+        pending = getMetainfoUring(files, config, cache, results);
+    }
+    // no ring at all - every file is left to blocking code
+    catch (io::Uring::SetupException&) {}
+    if (pending.empty()) {
+        return results;
+    }
+#endif
+    // no io_uring - blocking reads in parallel
+    util::WorkStealingPool pool;
+    for (size_t i : pending) {
+        pool.submit([&, i](size_t) {
+            try {
+                results[i] = getMetainfo(paths[i], config, cache);
+            }
+            catch (...) {}
+        });
+    }
+    pool.wait();
+    return results;
 }
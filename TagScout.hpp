@@ -5,11 +5,17 @@
 #include <string>
 #include <filesystem>
 #include <list>
-#include <variant>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <span>
 #include "ID3V2Parser.hpp"
 #include "Mp3FrameParser.hpp"
 #include "FlacTagParser.hpp"
 #include "WavParser.hpp"
+#include "ByteSource.hpp"
+#include "MetaCache.hpp"
+#include "ImageStore.hpp"
 
 /*
     for testing purposes
@@ -17,37 +23,118 @@
 class TagScout {
 public:
     using MapT = std::map<std::string, std::list<std::string>>;
-    TagScout(const std::filesystem::path& path);
+    // threads > 1 - directories are scanned by that many workers in parallel, 0 - by one worker per hardware thread
+    // files, which have not changed since they were put into cache, are not parsed
+    TagScout(const std::filesystem::path& path, size_t threads = 1, cache::MetaCache* cache = nullptr);
+    ~TagScout();
+    TagScout(const TagScout&) = delete;
+    TagScout& operator=(const TagScout&) = delete;
+    // maps are copied, because watcher may change them any time
     inline const MapT map() const {
+        std::lock_guard lock(mtx);
         return framePathMap;
     }
-    inline const std::map<std::string, size_t>& durations() const {
+    inline const std::map<std::string, size_t> durations() const {
+        std::lock_guard lock(mtx);
         return songDurationMap;
     }
     void dump(const std::filesystem::path& path);
     void dumpDurations(const std::filesystem::path& path);
+    /*
+        Starts a thread, which keeps maps up to date with the tree (Linux only, inotify):
+        created, changed and moved in files are parsed, deleted and moved out ones are removed.
+        Events are processed after CoalesceMs of quiet (but no later than MaxDelayMs after first of them),
+        so a file written in many chunks is parsed once.
+    */
+    void watch();
+    void stopWatching();
+    static constexpr int CoalesceMs = 200;
+    static constexpr int MaxDelayMs = 2000;
 private:
+    // results, collected by one thread
+    struct ScanResult {
+        MapT framePathMap;
+        std::map<std::string, size_t> songDurationMap;
+    };
+    std::vector<ScanResult> scan();
+    static void scanFile(const std::filesystem::path& path, ScanResult& res, cache::MetaCache* cache);
+    // fills frames and duration; returns false, if file could not be read
+    static bool parseFile(const std::filesystem::path& path, cache::Entry& entry);
+    static void addEntry(const std::filesystem::path& path, const cache::Entry& entry, ScanResult& res);
+    std::vector<ScanResult> scanParallel();
+    void merge(std::vector<ScanResult>& results);
+    // watch mode
+    void watchLoop();
+    // watches dir and its subdirectories; their files are added to files
+    void addWatches(const std::filesystem::path& dir, std::vector<std::filesystem::path>& files);
+    void removeWatches(const std::filesystem::path& dir);
+    // re-parses changed files, removes deleted ones
+    void update(const std::vector<std::filesystem::path>& files, const std::vector<std::filesystem::path>& removedDirs);
+    void rescan();
+    void buildPathIndex();
+    void removePath(const std::string& path);
+
+    std::filesystem::path root;
+    size_t threads;
+    cache::MetaCache* cache;
+    std::filesystem::file_time_type scanStart;
     MapT framePathMap;
     std::map<std::string, size_t> songDurationMap;
+    // frames of every file - for removal of files from framePathMap; only in watch mode
+    std::unordered_map<std::string, std::vector<std::string>> pathFrames;
+    mutable std::mutex mtx;
+    std::thread watcher;
+    int inotifyFd = -1;
+    // wakes watcher up, when it has to stop
+    int stopFd = -1;
+    // watch descriptor -> watched directory
+    std::unordered_map<int, std::filesystem::path> watchDirs;
 };
 
 /*
-    Function for extracting metainfo from a file.
-    Populates a metainfo map.
-    Keys:
-        title
-        album
-        artist,
-        images
-        durationMs
+    Metainfo of a file, as extracted by getMetainfo.
+    fields tells which groups are filled - requested ones, if file was read, none otherwise.
 */
-using MetainfoData = std::variant<std::string, std::vector<tag::user::APICUserData>>;
+struct MetaInfo {
+    enum Field : uint8_t {
+        Textual = 1,
+        Duration = 2,
+        Images = 4
+    };
+    uint8_t fields = 0;
+    std::string title;
+    std::string album;
+    std::string artist;
+    std::string year;
+    std::string trackNumber;
+    std::string comment;
+    size_t durationMs = 0;
+    // with GetMetaInfoConfig::imageLocations - without data, but with location
+    std::vector<tag::user::APICUserData> images;
+    inline bool has(uint8_t field) const { return (fields & field) == field; }
+};
+
 struct GetMetaInfoConfig {
     bool textual;
     bool duration;
     bool images;
+    // frames bigger than that are skipped
+    size_t maxFrameSize = std::numeric_limits<size_t>::max();
+    // images are only located in file - picture bytes are not read (and files with them may be served from cache)
+    bool imageLocations = false;
+    // images with same bytes (covers of album tracks) are returned as one shared copy
+    tag::ImageStore* imageStore = nullptr;
 };
 
-std::unordered_map<std::string, MetainfoData> getMetainfo(const std::filesystem::path& path, const GetMetaInfoConfig& config);
+// unchanged files are served from cache (if it is given); files with images are parsed anyway, as image data is not cached,
+// unless only image locations are asked for
+MetaInfo getMetainfo(const std::filesystem::path& path, const GetMetaInfoConfig& config, cache::MetaCache* cache = nullptr);
+
+/*
+    getMetainfo for many files at once; results are in order of paths, unreadable files get results without fields.
+    Opens and reads of all files are queued to io_uring, each file is parsed as soon as its bytes are there;
+    without io_uring files are processed by a thread pool.
+*/
+std::vector<MetaInfo> getMetainfoBatch(std::span<const std::filesystem::path> paths, const GetMetaInfoConfig& config, cache::MetaCache* cache = nullptr);
 
 #endif // TAGSCOUT_H
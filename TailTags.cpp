@@ -0,0 +1,159 @@
+#include "TailTags.hpp"
+#include <string.h>
+#include <algorithm>
+#include <cctype>
+#include "util.hpp"
+
+using namespace tag::tail;
+
+namespace {
+
+    constexpr size_t ID3V1Size = 128;
+    constexpr size_t APEFooterSize = 32;
+    constexpr size_t ID3V2FooterSize = 10;
+    // APEv2 footer flags
+    constexpr uint32_t APEHasHeader = 1u << 31;
+    // item flags: bits 1-2 - type of value, 0 is UTF-8 text
+    constexpr uint32_t APEItemTypeMask = 0b110;
+
+    uint32_t le32(const uint8_t* p) {
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    uint32_t be32(const uint8_t* p) {
+        return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+    }
+
+    // fixed size field: zero terminated or padded with zeros/spaces
+    std::string_view field(const uint8_t* data, size_t n) {
+        std::string_view res((const char*)data, n);
+        res = res.substr(0, res.find('\0'));
+        while (!res.empty() && (res.back() == ' ')) {
+            res.remove_suffix(1);
+        }
+        return res;
+    }
+
+    ID3V1 parseID3V1(const uint8_t* data) {
+        ID3V1 res;
+        res.title = field(data + 3, 30);
+        res.artist = field(data + 33, 30);
+        res.album = field(data + 63, 30);
+        res.year = field(data + 93, 4);
+        const uint8_t* comment = data + 97;
+        // ID3v1.1: zero byte and track number in the last two bytes of comment
+        if (!comment[28] && comment[29]) {
+            res.comment = field(comment, 28);
+            res.track = comment[29];
+        }
+        else {
+            res.comment = field(comment, 30);
+        }
+        res.genre = data[127];
+        return res;
+    }
+
+    // item: value size (4), flags (4), key (zero terminated ASCII), value
+    void parseAPEItems(const uint8_t* data, size_t n, uint32_t count, TailTags& res) {
+        const uint8_t* end = data + n;
+        for (uint32_t i = 0; (i < count) && ((end - data) > 8); ++i) {
+            uint32_t valueSize = le32(data);
+            uint32_t flags = le32(data + 4);
+            data += 8;
+            const uint8_t* keyEnd = std::find(data, end, 0);
+            if (keyEnd == end) {
+                return;
+            }
+            std::string_view key((const char*)data, keyEnd - data);
+            data = keyEnd + 1;
+            if (valueSize > (size_t)(end - data)) {
+                return;
+            }
+            if (!(flags & APEItemTypeMask)) {
+                res.ape.emplace_back(key, std::string_view((const char*)data, valueSize));
+            }
+            data += valueSize;
+        }
+    }
+
+}
+
+std::string_view tag::tail::TailTags::apeItem(std::string_view key) const {
+    auto equal = [](char a, char b) { return std::tolower((unsigned char)a) == std::tolower((unsigned char)b); };
+    for (const auto& [itemKey, value] : ape) {
+        if (std::equal(itemKey.begin(), itemKey.end(), key.begin(), key.end(), equal)) {
+            return value;
+        }
+    }
+    return {};
+}
+
+TailTags tag::tail::probe(io::ByteSource& src, std::pmr::memory_resource* memory) {
+    TailTags res(memory);
+    uint64_t size = src.size();
+    res.audioEnd = size;
+    size_t n = std::min<uint64_t>(size, ProbeSize);
+    if (!n) {
+        return res;
+    }
+    uint64_t base = size - n;
+    res.data = src.block(base, n);
+    if (!res.data) {
+        return res;
+    }
+    auto at = [&](uint64_t offset) { return res.data.get() + (offset - base); };
+    // every tag is taken off the end, until there is none
+    uint64_t end = size;
+    for (bool found = true; found;) {
+        found = false;
+        if (!res.id3v1 && (end == size) && ((end - base) >= ID3V1Size) && !memcmp(at(end - ID3V1Size), "TAG", 3)) {
+            res.id3v1 = parseID3V1(at(end - ID3V1Size));
+            end -= ID3V1Size;
+            found = true;
+        }
+        else if (!res.hasApe && ((end - base) >= APEFooterSize) && !memcmp(at(end - APEFooterSize), "APETAGEX", 8)) {
+            const uint8_t* footer = at(end - APEFooterSize);
+            // size of items and footer, without header
+            uint32_t tagSize = le32(footer + 12);
+            uint32_t count = le32(footer + 16);
+            uint32_t flags = le32(footer + 20);
+            uint64_t headerSize = (flags & APEHasHeader) ? APEFooterSize : 0;
+            if ((tagSize < APEFooterSize) || ((tagSize + headerSize) > end)) {
+                break;
+            }
+            uint64_t itemsBegin = end - tagSize;
+            size_t itemsSize = tagSize - APEFooterSize;
+            const uint8_t* items = nullptr;
+            if (itemsBegin >= base) {
+                items = at(itemsBegin);
+            }
+            else if ((res.apeData = src.block(itemsBegin, itemsSize))) {
+                items = res.apeData.get();
+            }
+            if (items) {
+                parseAPEItems(items, itemsSize, count, res);
+            }
+            res.hasApe = true;
+            end = itemsBegin - headerSize;
+            found = true;
+        }
+        else if (!res.id3v2Offset && ((end - base) >= ID3V2FooterSize) && !memcmp(at(end - ID3V2FooterSize), "3DI", 3)) {
+            const uint8_t* footer = at(end - ID3V2FooterSize);
+            uint32_t sizeBytes = be32(footer + 6);
+            // size is syncsafe - highest bit of every byte is 0
+            if (sizeBytes & 0x80808080) {
+                break;
+            }
+            // header, frames and footer
+            uint64_t tagSize = 2 * ID3V2FooterSize + util::syncSafe(sizeBytes);
+            if (tagSize > end) {
+                break;
+            }
+            end -= tagSize;
+            res.id3v2Offset = end;
+            found = true;
+        }
+    }
+    res.audioEnd = end;
+    return res;
+}
@@ -0,0 +1,58 @@
+#ifndef TAILTAGS_HPP
+#define TAILTAGS_HPP
+#include <cstdint>
+#include <string_view>
+#include <optional>
+#include <vector>
+#include <memory_resource>
+#include "ByteSource.hpp"
+
+namespace tag {
+    namespace tail {
+
+        // end of file, read at once; tags at the end are usually much smaller
+        constexpr size_t ProbeSize = 64 * 1024;
+
+        // 128 bytes at the very end of file, starting with "TAG"
+        struct ID3V1 {
+            // ISO-8859-1, without trailing spaces and zeros
+            std::string_view title;
+            std::string_view artist;
+            std::string_view album;
+            std::string_view year;
+            std::string_view comment;
+            // ID3v1.1 only; 0 - none
+            uint8_t track = 0;
+            uint8_t genre = 0xff;
+        };
+
+        /*
+            Tags after audio data, in the order they are usually written: ID3v2 (with footer), APEv2, ID3v1.
+            Views point into data, loaded by probe.
+        */
+        struct TailTags {
+            TailTags(std::pmr::memory_resource* memory = std::pmr::get_default_resource()) : ape{memory} {}
+
+            std::optional<ID3V1> id3v1;
+            // APEv2 text items (UTF-8)
+            std::pmr::vector<std::pair<std::string_view, std::string_view>> ape;
+            bool hasApe = false;
+            // ID3v2 tag, found by its footer ("3DI"): offset of its header
+            std::optional<uint64_t> id3v2Offset;
+            // audio data ends here - before all tail tags
+            uint64_t audioEnd = 0;
+            io::ByteSource::Block data;
+            // APEv2 items, which do not fit into probe
+            io::ByteSource::Block apeData;
+
+            // value of APEv2 item; keys are case insensitive
+            std::string_view apeItem(std::string_view key) const;
+        };
+
+        // one read of the last ProbeSize bytes; APEv2 tags bigger than that cost one more read
+        TailTags probe(io::ByteSource& src, std::pmr::memory_resource* memory = std::pmr::get_default_resource());
+
+    }
+}
+
+#endif // TAILTAGS_HPP
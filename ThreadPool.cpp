@@ -0,0 +1,100 @@
+#include "ThreadPool.hpp"
+
+using namespace util;
+
+namespace {
+    // pool and index of worker, running on current thread
+    thread_local const WorkStealingPool* currentPool = nullptr;
+    thread_local size_t currentWorker = 0;
+}
+
+util::WorkStealingPool::WorkStealingPool(size_t threads) {
+    if (!threads) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        queues.emplace_back(new Queue);
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back([this, i]() { run(i); });
+    }
+}
+
+util::WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard lock(mtx);
+        stop = true;
+    }
+    hasWork.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void util::WorkStealingPool::submit(Task task) {
+    size_t idx = (currentPool == this) ? currentWorker : (nextQueue++ % queues.size());
+    pending++;
+    {
+        // counted before push, so counter never goes below zero; under lock, so sleeping worker can't miss it
+        std::lock_guard lock(mtx);
+        queued++;
+    }
+    {
+        std::lock_guard lock(queues[idx]->mtx);
+        queues[idx]->tasks.push_back(std::move(task));
+    }
+    hasWork.notify_one();
+}
+
+void util::WorkStealingPool::wait() {
+    std::unique_lock lock(mtx);
+    done.wait(lock, [this]() { return pending == 0; });
+}
+
+bool util::WorkStealingPool::pop(size_t worker, Task& task) {
+    Queue& queue = *queues[worker];
+    std::lock_guard lock(queue.mtx);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    queued--;
+    return true;
+}
+
+bool util::WorkStealingPool::steal(size_t worker, Task& task) {
+    for (size_t i = 1; i < queues.size(); ++i) {
+        Queue& queue = *queues[(worker + i) % queues.size()];
+        std::lock_guard lock(queue.mtx);
+        if (!queue.tasks.empty()) {
+            // oldest tasks are the biggest ones (upper directories)
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void util::WorkStealingPool::run(size_t worker) {
+    currentPool = this;
+    currentWorker = worker;
+    while (true) {
+        Task task;
+        if (pop(worker, task) || steal(worker, task)) {
+            task(worker);
+            if (--pending == 0) {
+                std::lock_guard lock(mtx);
+                done.notify_all();
+            }
+            continue;
+        }
+        std::unique_lock lock(mtx);
+        hasWork.wait(lock, [this]() { return stop || queued > 0; });
+        if (stop && !queued) {
+            return;
+        }
+    }
+}
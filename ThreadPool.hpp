@@ -0,0 +1,58 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+#include <cstddef>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+
+namespace util {
+
+    /*
+        Thread pool with per worker task queues.
+        Worker takes tasks from back of own queue and, when it is empty, steals from front of others.
+        Tasks may submit more tasks - they are put into the queue of the worker running them.
+    */
+    class WorkStealingPool {
+    public:
+        // worker index is passed to the task, so it can use per worker data without locking
+        using Task = std::function<void(size_t worker)>;
+
+        // 0 threads - one per hardware thread
+        WorkStealingPool(size_t threads = 0);
+        ~WorkStealingPool();
+        WorkStealingPool(const WorkStealingPool&) = delete;
+        WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+        void submit(Task task);
+        // blocks until all tasks, including ones submitted by tasks, are done
+        void wait();
+        inline size_t size() const { return workers.size(); }
+    private:
+        struct Queue {
+            std::mutex mtx;
+            std::deque<Task> tasks;
+        };
+        void run(size_t worker);
+        bool pop(size_t worker, Task& task);
+        bool steal(size_t worker, Task& task);
+
+        std::vector<std::unique_ptr<Queue>> queues;
+        std::vector<std::thread> workers;
+        std::mutex mtx;
+        std::condition_variable hasWork;
+        std::condition_variable done;
+        // submitted but not finished tasks
+        std::atomic<size_t> pending = 0;
+        // tasks lying in queues
+        std::atomic<size_t> queued = 0;
+        std::atomic<size_t> nextQueue = 0;
+        bool stop = false;
+    };
+
+}
+
+#endif // THREADPOOL_HPP
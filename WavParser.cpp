@@ -1,21 +1,15 @@
 #include "WavParser.hpp"
+#include "Format.hpp"
 
 using namespace tag;
 using namespace tag::wav;
 
-WavExtractor::WavExtractor(std::ifstream& is) {
-    if (!is) {
+WavExtractor::WavExtractor(io::ByteSource& src) {
+    src.seek(id3v2Size(src));
+    if (src.remaining() < sizeof(WAVHeader)) {
         throw NoTagException{};
     }
-    size_t offset = is.tellg();
-    size_t sz = 0;
-    is.seekg(0, std::ios_base::end);
-    sz = is.tellg();
-    is.seekg(offset);
-    if (sz < sizeof(WAVHeader)) {
-        throw NoTagException{};
-    }
-    is.read((char*)&_header, sizeof(WAVHeader));
+    src.read(&_header, sizeof(WAVHeader));
     if (!(
             (strncmp(_header.RIFF, "RIFF", 4) == 0) &&
             (strncmp(_header.WAVE, "WAVE", 4) == 0) &&
@@ -27,7 +21,7 @@ WavExtractor::WavExtractor(std::ifstream& is) {
     }
 }
 
-std::list<std::pair<Extractor::Data, size_t>> WavExtractor::framesData(const std::string& frameName) {
+Extractor::FramesData WavExtractor::framesData(FrameId) {
     return {};
 }
 
@@ -35,9 +29,9 @@ std::vector<std::string> WavExtractor::frameTitles() const {
     return {};
 }
 
-WavParser::WavParser(std::ifstream& fs) {
+WavParser::WavParser(io::ByteSource& src) {
     try {
-        extractor = std::shared_ptr<Extractor>(new WavExtractor(fs));
+        extractor = std::shared_ptr<Extractor>(new WavExtractor(src));
     }
     catch (NoTagException) {
         ;
@@ -72,6 +66,10 @@ std::vector<user::APICUserData> WavParser::image()  {
     return {};
 }
 
+std::vector<user::APICUserData> WavParser::imageLocations() {
+    return {};
+}
+
 size_t WavParser::durationMs() {
     auto header = std::dynamic_pointer_cast<WavExtractor>(extractor)->header();
     return header.dataSize / header.sampleRateMulBitsPerSampleMulChannelsBytes * 1000;
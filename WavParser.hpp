@@ -1,6 +1,7 @@
 #ifndef WAVPARSER_HPP
 #define WAVPARSER_HPP
 #include "Tag.hpp"
+#include "ByteSource.hpp"
 
 namespace tag {
     namespace wav {
@@ -23,9 +24,11 @@ namespace tag {
 
         class WavExtractor : public Extractor {
         public:
-            WavExtractor(std::ifstream& is);
+            WavExtractor(io::ByteSource& src);
             inline const WAVHeader& header() const { return _header; }
-            std::list<std::pair<Extractor::Data, size_t>> framesData(const std::string& frameName) override;
+            using Extractor::framesData;
+            FramesData framesData(FrameId id) override;
+            inline FrameId frameId(std::string_view frameName) const override { return fourcc(frameName); }
             std::vector<std::string> frameTitles() const override;
         private:
             WAVHeader _header;
@@ -33,7 +36,7 @@ namespace tag {
 
         class WavParser : public Tag {
         public:
-            WavParser(std::ifstream& ifs);
+            WavParser(io::ByteSource& src);
             std::string songTitle() override;
             std::string album() override;
             std::string artist() override;
@@ -41,6 +44,7 @@ namespace tag {
             std::string trackNumber() override;
             std::string comment() override;
             std::vector<user::APICUserData> image() override;
+            std::vector<user::APICUserData> imageLocations() override;
             size_t durationMs() override;
         };
     }
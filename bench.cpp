@@ -0,0 +1,477 @@
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include "util.hpp"
+#include "Tag.hpp"
+#include "ByteSource.hpp"
+#include "ID3V2Parser.hpp"
+#include "FlacTagParser.hpp"
+#include "Mp3FrameParser.hpp"
+
+/*
+    Micro-benchmarks of text converters, frame readers and header decoders.
+    All inputs are generated in memory from fixed seed, so runs on one machine are comparable.
+    Results are printed as JSON to stdout.
+
+    usage: MetaTagsParserBench [name filter] [--min-time-ms N]
+*/
+
+using namespace util;
+using namespace tag;
+
+namespace {
+
+    constexpr uint32_t Seed = 20240601;
+    constexpr size_t Repetitions = 5;
+    const size_t TextSizes[] = {16, 256, 4096, 65536};
+    const size_t ImageSizes[] = {1024, 64 * 1024, 1024 * 1024};
+
+    // result must be computed, even if it is not used
+    template<typename T>
+    inline void keep(const T& value) {
+#if defined(__GNUC__)
+        asm volatile("" : : "g"(&value) : "memory");
+#else
+        static const void* volatile sink;
+        sink = &value;
+#endif
+    }
+
+    struct Result {
+        std::string name;
+        // bytes of input, processed by one operation
+        size_t size;
+        uint64_t iterations;
+        double nsPerOp;
+        double minNsPerOp;
+    };
+
+    class Bench {
+    public:
+        Bench(std::string filter, std::chrono::nanoseconds minTime)
+            : filter{std::move(filter)}, minTime{minTime}
+        {}
+
+        // fn is one operation; it is repeated until Repetitions batches of at least minTime / Repetitions are timed
+        template<typename F>
+        void run(const std::string& name, size_t size, F&& fn) {
+            if (!filter.empty() && (name.find(filter) == std::string::npos)) {
+                return;
+            }
+            auto batchTime = minTime / Repetitions;
+            uint64_t iterations = 1;
+            while (true) {
+                auto elapsed = time(fn, iterations);
+                if ((elapsed >= batchTime) || (iterations >= (uint64_t(1) << 40))) {
+                    break;
+                }
+                // aiming a bit above batch time, but growing at most 10 times per step
+                double scale = elapsed.count() ? (1.2 * batchTime.count() / elapsed.count()) : 10.0;
+                iterations = std::max<uint64_t>(iterations + 1, (uint64_t)(iterations * std::min(scale, 10.0)));
+            }
+            std::vector<double> samples;
+            for (size_t i = 0; i < Repetitions; ++i) {
+                samples.push_back((double)time(fn, iterations).count() / iterations);
+            }
+            std::sort(samples.begin(), samples.end());
+            results.push_back(Result{name, size, iterations, samples[samples.size() / 2], samples.front()});
+            std::cerr << name << ": " << samples[samples.size() / 2] << " ns\n";
+        }
+
+        void print(std::ostream& os) const {
+            os << "{\n  \"context\": {\n";
+            os << "    \"seed\": " << Seed << ",\n";
+            os << "    \"min_time_ms\": " << std::chrono::duration_cast<std::chrono::milliseconds>(minTime).count() << ",\n";
+            os << "    \"repetitions\": " << Repetitions << ",\n";
+#ifdef __VERSION__
+            os << "    \"compiler\": \"" << escape(__VERSION__) << "\",\n";
+#endif
+#ifdef __OPTIMIZE__
+            os << "    \"optimized\": true\n";
+#else
+            os << "    \"optimized\": false\n";
+#endif
+            os << "  },\n  \"benchmarks\": [";
+            for (size_t i = 0; i < results.size(); ++i) {
+                const Result& res = results[i];
+                os << (i ? ",\n" : "\n");
+                os << "    {\"name\": \"" << escape(res.name) << "\", \"size\": " << res.size << ", \"iterations\": " << res.iterations
+                   << ", \"ns_per_op\": " << res.nsPerOp << ", \"min_ns_per_op\": " << res.minNsPerOp
+                   << ", \"mb_per_s\": " << (res.nsPerOp ? res.size * 1000.0 / res.nsPerOp : 0.0) << "}";
+            }
+            os << "\n  ]\n}\n";
+        }
+    private:
+        template<typename F>
+        std::chrono::nanoseconds time(F& fn, uint64_t iterations) {
+            auto begin = std::chrono::steady_clock::now();
+            for (uint64_t i = 0; i < iterations; ++i) {
+                fn();
+            }
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin);
+        }
+
+        static std::string escape(const std::string& str) {
+            std::string res;
+            for (char c : str) {
+                if ((c == '"') || (c == '\\')) {
+                    res.push_back('\\');
+                }
+                res.push_back(((uint8_t)c < 0x20) ? ' ' : c);
+            }
+            return res;
+        }
+
+        std::string filter;
+        std::chrono::nanoseconds minTime;
+        std::vector<Result> results;
+    };
+
+    /*
+        Generated inputs
+    */
+
+    std::mt19937 rng(Seed);
+
+    std::string asciiText(size_t n) {
+        std::string res(n, '\0');
+        for (auto& c : res) {
+            c = (char)(' ' + rng() % 95);
+        }
+        return res;
+    }
+
+    // ISO-8859-1, every 5th byte on average is above 0x7f
+    std::string latin1Text(size_t n) {
+        std::string res = asciiText(n);
+        for (auto& c : res) {
+            if (!(rng() % 5)) {
+                c = (char)(0xa0 + rng() % 0x60);
+            }
+        }
+        return res;
+    }
+
+    // UTF-16LE of n bytes: ASCII runs, Cyrillic, CJK and surrogate pairs (emoji)
+    std::u16string utf16Text(size_t n, bool ascii) {
+        std::u16string res;
+        while ((res.size() * 2) < n) {
+            uint32_t kind = ascii ? 0 : rng() % 8;
+            if (kind < 4) {
+                res.push_back((char16_t)(' ' + rng() % 95));
+            }
+            else if (kind < 6) {
+                res.push_back((char16_t)(0x0410 + rng() % 0x40));
+            }
+            else if ((kind == 6) || ((res.size() * 2 + 4) > n)) {
+                res.push_back((char16_t)(0x4e00 + rng() % 0x5000));
+            }
+            else {
+                uint32_t cp = 0x1f300 + rng() % 0x300 - 0x10000;
+                res.push_back((char16_t)(0xd800 + (cp >> 10)));
+                res.push_back((char16_t)(0xdc00 + (cp & 0x3ff)));
+            }
+        }
+        return res;
+    }
+
+    std::string bytesOf(const std::u16string& str, bool bigEndian) {
+        std::string res((const char*)str.data(), str.size() * 2);
+        if (bigEndian) {
+            for (size_t i = 0; (i + 1) < res.size(); i += 2) {
+                std::swap(res[i], res[i + 1]);
+            }
+        }
+        return res;
+    }
+
+    std::string utf8Text(size_t n, bool ascii) {
+        std::string utf16 = bytesOf(utf16Text(n, ascii), false);
+        std::string res = utf16ToUtf8(utf16.data(), utf16.size());
+        // cutting at character boundary
+        size_t len = std::min(n, res.size());
+        while (len && ((res[len] & 0b11000000) == 0b10000000)) {
+            --len;
+        }
+        res.resize(len);
+        return res;
+    }
+
+    // string in ID3v2 encoding; wide strings get BOM (Utf16BOM)
+    std::string encodedText(Encoding encoding, size_t n) {
+        switch (encoding) {
+        case Encoding::Ascii:
+            return latin1Text(n);
+        case Encoding::Utf16BOM:
+            return "\xff\xfe" + bytesOf(utf16Text(n, false), false);
+        case Encoding::Utf16BE:
+            return bytesOf(utf16Text(n, false), true);
+        default:
+            return utf8Text(n, false);
+        }
+    }
+
+    std::string terminator(Encoding encoding) {
+        return ((encoding == Encoding::Utf16BOM) || (encoding == Encoding::Utf16BE)) ? std::string(2, '\0') : std::string(1, '\0');
+    }
+
+    const char* encodingName(Encoding encoding) {
+        switch (encoding) {
+        case Encoding::Ascii:
+            return "latin1";
+        case Encoding::Utf16BOM:
+            return "utf16bom";
+        case Encoding::Utf16BE:
+            return "utf16be";
+        default:
+            return "utf8";
+        }
+    }
+
+    template<std::unsigned_integral T>
+    void putBE(std::string& out, T val) {
+        val = swapBytes<T>(val);
+        out.append((const char*)&val, sizeof(T));
+    }
+
+    template<std::unsigned_integral T>
+    void putLE(std::string& out, T val) {
+        out.append((const char*)&val, sizeof(T));
+    }
+
+    std::shared_ptr<uint8_t[]> toBlock(const std::string& str) {
+        std::shared_ptr<uint8_t[]> res(new uint8_t[str.size() + 1]);
+        memcpy(res.get(), str.data(), str.size());
+        return res;
+    }
+
+    std::string apicFrame(Encoding encoding, size_t imageSize) {
+        std::string res(1, (char)encoding);
+        res += std::string("image/jpeg") + '\0';
+        res.push_back(3);
+        res += encodedText(encoding, 32) + terminator(encoding);
+        res += std::string(imageSize, '\x5a');
+        return res;
+    }
+
+    std::string commFrame(Encoding encoding, size_t textSize) {
+        std::string res(1, (char)encoding);
+        res += "eng";
+        res += encodedText(encoding, 16) + terminator(encoding);
+        res += encodedText(encoding, textSize);
+        return res;
+    }
+
+    std::string vorbisCommentBlock(size_t comments) {
+        static const char* keys[] = {"TITLE", "ARTIST", "ALBUM", "DATE", "TRACKNUMBER", "GENRE", "DESCRIPTION", "COMPOSER"};
+        std::string vendor = "reference libFLAC 1.4.3 20230623";
+        std::string res;
+        putLE<uint32_t>(res, vendor.size());
+        res += vendor;
+        putLE<uint32_t>(res, comments);
+        for (size_t i = 0; i < comments; ++i) {
+            std::string comment = std::string(keys[i % 8]) + "=" + utf8Text(8 + rng() % 40, i % 2);
+            putLE<uint32_t>(res, comment.size());
+            res += comment;
+        }
+        return res;
+    }
+
+    std::string pictureBlock(size_t imageSize) {
+        std::string mime = "image/jpeg";
+        std::string description = utf8Text(24, false);
+        std::string res;
+        putBE<uint32_t>(res, 3);
+        putBE<uint32_t>(res, mime.size());
+        res += mime;
+        putBE<uint32_t>(res, description.size());
+        res += description;
+        for (uint32_t val : {500u, 500u, 24u, 0u}) {
+            putBE<uint32_t>(res, val);
+        }
+        putBE<uint32_t>(res, imageSize);
+        res += std::string(imageSize, '\x5a');
+        return res;
+    }
+
+    // valid MPEG audio frame headers (as big endian numbers) of all versions and layers
+    std::vector<uint32_t> mp3Headers(size_t n) {
+        std::vector<uint32_t> res;
+        while (res.size() < n) {
+            uint32_t version = rng() % 4;
+            uint32_t layer = 1 + rng() % 3;
+            if (version == 1) {
+                continue;
+            }
+            uint32_t bitrate = 1 + rng() % 14;
+            uint32_t sampleRate = rng() % 3;
+            uint32_t padding = rng() % 2;
+            res.push_back(0xffe00000 | (version << 19) | (layer << 17) | (1 << 16) | (bitrate << 12) | (sampleRate << 10) | (padding << 9));
+        }
+        return res;
+    }
+
+    // MPEG1 Layer III 128 kbps 44100 Hz frames without padding
+    std::string mp3Stream(size_t frames) {
+        static constexpr uint32_t Header = 0xfffb9000;
+        std::string frame;
+        putBE<uint32_t>(frame, Header);
+        frame.resize(mp3::Mp3FrameParser::frameLength(Header), '\0');
+        std::string res;
+        for (size_t i = 0; i < frames; ++i) {
+            res += frame;
+        }
+        return res;
+    }
+
+    /*
+        Benchmarks
+    */
+
+    void benchConverters(Bench& bench) {
+        for (size_t size : TextSizes) {
+            std::string suffix = "/" + std::to_string(size);
+            for (bool ascii : {true, false}) {
+                std::u16string utf16 = utf16Text(size, ascii);
+                const char* kind = ascii ? "/ascii" : "/mixed";
+                for (bool bigEndian : {false, true}) {
+                    std::string bytes = bytesOf(utf16, bigEndian);
+                    bench.run(std::string("utf16ToUtf8") + kind + (bigEndian ? "/be" : "/le") + suffix, bytes.size(), [&]() {
+                        keep(utf16ToUtf8(bytes.data(), bytes.size(), bigEndian));
+                    });
+                }
+                std::string utf8 = utf8Text(size, ascii);
+                bench.run(std::string("utf8ToUtf16") + kind + suffix, utf8.size(), [&]() {
+                    keep(utf8ToUtf16(utf8.data(), utf8.size()));
+                });
+                bench.run(std::string("isValidUtf8") + kind + suffix, utf8.size(), [&]() {
+                    keep(isValidUtf8(utf8.data(), utf8.size()));
+                });
+            }
+            std::string ascii = asciiText(size);
+            bench.run("asciiToUtf8/ascii" + suffix, ascii.size(), [&]() {
+                keep(asciiToUtf8(ascii.data(), ascii.size()));
+            });
+            std::string latin1 = latin1Text(size);
+            bench.run("asciiToUtf8/latin1" + suffix, latin1.size(), [&]() {
+                keep(asciiToUtf8(latin1.data(), latin1.size()));
+            });
+            for (Encoding encoding : {Encoding::Ascii, Encoding::Utf16BOM, Encoding::Utf16BE, Encoding::Utf8}) {
+                std::string text = encodedText(encoding, size);
+                auto block = toBlock(text);
+                bench.run(std::string("decodeStr/") + encodingName(encoding) + suffix, text.size(), [&]() {
+                    keep(decodeStr(block.get(), text.size(), encoding));
+                });
+                TextBuffer buffer;
+                bench.run(std::string("decodeStrView/") + encodingName(encoding) + suffix, text.size(), [&]() {
+                    keep(decodeStrView(block.get(), text.size(), encoding, &buffer));
+                    buffer.clear();
+                });
+            }
+        }
+    }
+
+    template<typename Reader>
+    void benchReader(Bench& bench, const std::string& name, const std::string& frame, Encoding encoding = Encoding::Ascii) {
+        auto block = toBlock(frame);
+        TextBuffer buffer;
+        bench.run(name, frame.size(), [&]() {
+            DataBlock data(block, frame.size());
+            data.encoding = encoding;
+            data.text = &buffer;
+            keep(Reader().read(data));
+            buffer.clear();
+        });
+    }
+
+    void benchFrameReaders(Bench& bench) {
+        using namespace tag::id3v2;
+        using namespace tag::flac;
+        for (Encoding encoding : {Encoding::Ascii, Encoding::Utf16BOM, Encoding::Utf8}) {
+            std::string apic = apicFrame(encoding, ImageSizes[0]);
+            benchReader<APICReader>(bench, std::string("APICReader/") + encodingName(encoding), apic);
+            benchReader<APICViewReader>(bench, std::string("APICViewReader/") + encodingName(encoding), apic);
+            for (size_t size : TextSizes) {
+                std::string comm = commFrame(encoding, size);
+                std::string suffix = std::string("/") + encodingName(encoding) + "/" + std::to_string(size);
+                benchReader<COMMReader>(bench, "COMMReader" + suffix, comm);
+                benchReader<COMMViewReader>(bench, "COMMViewReader" + suffix, comm);
+            }
+        }
+        for (size_t size : ImageSizes) {
+            std::string apic = apicFrame(Encoding::Utf8, size);
+            benchReader<APICReader>(bench, "APICReader/image/" + std::to_string(size), apic);
+            std::string picture = pictureBlock(size);
+            benchReader<PictureReader>(bench, "PictureReader/" + std::to_string(size), picture, Encoding::Utf8);
+        }
+        for (size_t comments : {8, 64}) {
+            std::string vorbis = vorbisCommentBlock(comments);
+            benchReader<VorbisCommentReader>(bench, "VorbisCommentReader/" + std::to_string(comments), vorbis, Encoding::Utf8);
+            benchReader<VorbisCommentViewReader>(bench, "VorbisCommentViewReader/" + std::to_string(comments), vorbis, Encoding::Utf8);
+        }
+    }
+
+    void benchHeaders(Bench& bench) {
+        std::vector<uint32_t> sizes(4096);
+        for (auto& size : sizes) {
+            size = rng() & 0x7f7f7f7f;
+        }
+        bench.run("syncSafe/4096", sizes.size() * 4, [&]() {
+            uint32_t sum = 0;
+            for (uint32_t size : sizes) {
+                sum += syncSafe(size);
+            }
+            keep(sum);
+        });
+        std::vector<uint32_t> headers = mp3Headers(4096);
+        bench.run("mp3/frameLength/4096", headers.size() * 4, [&]() {
+            uint32_t sum = 0;
+            for (uint32_t header : headers) {
+                sum += mp3::Mp3FrameParser::frameLength(header) + mp3::Mp3FrameParser::frameSamples(header) + mp3::Mp3FrameParser::frameSampleRate(header);
+            }
+            keep(sum);
+        });
+        std::string stream = mp3Stream(1000);
+        io::MemoryByteSource src(toBlock(stream), stream.size());
+        bench.run("mp3/Mp3FrameParser", 4, [&]() {
+            src.seek(0);
+            mp3::Mp3FrameParser parser(src);
+            keep(parser.getHeader());
+        });
+        bench.run("mp3/Mp3FrameWalker/1000", stream.size(), [&]() {
+            mp3::Mp3FrameWalker walker(src, 0, stream.size());
+            mp3::FrameInfo frame;
+            size_t frames = 0;
+            while (walker.next(frame)) {
+                ++frames;
+            }
+            keep(frames);
+        });
+    }
+
+}
+
+int main(int argc, char** argv) {
+    std::string filter;
+    long minTimeMs = 200;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if ((arg == "--min-time-ms") && ((i + 1) < argc)) {
+            minTimeMs = std::max(1l, std::atol(argv[++i]));
+        }
+        else {
+            filter = arg;
+        }
+    }
+    Bench bench(filter, std::chrono::milliseconds(minTimeMs));
+    benchConverters(bench);
+    benchFrameReaders(bench);
+    benchHeaders(bench);
+    bench.print(std::cout);
+    return 0;
+}
@@ -0,0 +1,771 @@
+#include <random>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include "util.hpp"
+#include "Mp3FrameParser.hpp"
+
+/*
+    Writes synthetic audio library for end-to-end benchmarks (see scanbench.cpp).
+    Files are deterministic for given options: same seed - same bytes, on every platform.
+    Only headers and tags are meaningful, audio payload is silence (zero bytes).
+
+    usage: MetaTagsCorpusGen <output dir> [options]
+        --files N               number of files (200)
+        --dirs N                files are spread over that many subdirectories (10)
+        --seed N                (20240601)
+        --mix M:F:W             weights of mp3, flac and wav files (70:20:10)
+        --id3 V2:V3:V4          weights of ID3v2.2, 2.3 and 2.4 tags in mp3 files (10:50:40)
+        --untagged P            percent of mp3 files without ID3v2 tag (10)
+        --frames MIN:MAX        number of text frames / vorbis comments (4:24)
+        --padding MAX           tag padding is 0 or up to MAX bytes (4096)
+        --vbr P                 percent of VBR mp3 files (30)
+        --vbr-header P          percent of mp3 files with Xing/Info/VBRI header (60)
+        --apic P                percent of files with cover image (50)
+        --apic-size MIN:MAX     cover size in bytes (1024:524288)
+        --album-covers P        percent of covers, which are shared by files of directory, like covers of album tracks (0)
+        --seconds MIN:MAX       duration of files (5:60)
+        --mislabeled P          percent of files with extension of other format (2)
+    Summary of written corpus is printed as JSON to stdout.
+*/
+
+using namespace util;
+
+namespace {
+
+    struct Range {
+        size_t min;
+        size_t max;
+    };
+
+    struct Options {
+        std::filesystem::path dir;
+        size_t files = 200;
+        size_t dirs = 10;
+        uint32_t seed = 20240601;
+        std::vector<size_t> mix = {70, 20, 10};
+        std::vector<size_t> id3 = {10, 50, 40};
+        size_t untagged = 10;
+        Range frames = {4, 24};
+        size_t padding = 4096;
+        size_t vbr = 30;
+        size_t vbrHeader = 60;
+        size_t apic = 50;
+        Range apicSize = {1024, 512 * 1024};
+        size_t albumCovers = 0;
+        Range seconds = {5, 60};
+        size_t mislabeled = 2;
+    };
+
+    enum Kind {
+        Mp3,
+        Flac,
+        Wav
+    };
+
+    const char* Extensions[] = {".mp3", ".flac", ".wav"};
+
+    struct Stats {
+        size_t files[3] = {0};
+        size_t id3[3] = {0};
+        size_t untagged = 0;
+        size_t vbr = 0;
+        size_t vbrHeaders = 0;
+        size_t images = 0;
+        size_t mislabeled = 0;
+        uint64_t bytes = 0;
+    };
+
+    /*
+        Only rng() is used, never std distributions, as their results differ between standard libraries.
+    */
+    std::mt19937 rng;
+
+    size_t uniform(size_t min, size_t max) {
+        return min + ((max > min) ? rng() % (max - min + 1) : 0);
+    }
+
+    size_t uniform(Range range) {
+        return uniform(range.min, range.max);
+    }
+
+    bool percent(size_t p) {
+        return (rng() % 100) < p;
+    }
+
+    size_t weighted(const std::vector<size_t>& weights) {
+        size_t total = 0;
+        for (size_t w : weights) {
+            total += w;
+        }
+        size_t val = total ? rng() % total : 0;
+        for (size_t i = 0; i < weights.size(); ++i) {
+            if (val < weights[i]) {
+                return i;
+            }
+            val -= weights[i];
+        }
+        return 0;
+    }
+
+    // sizes from every power of two in range are equally likely - like real covers (thumbnails to full scans)
+    size_t logUniform(Range range) {
+        size_t min = std::max<size_t>(range.min, 1);
+        size_t max = std::max(range.max, min);
+        size_t steps = 0;
+        while ((min << (steps + 1)) <= max) {
+            ++steps;
+        }
+        size_t low = min << uniform(0, steps);
+        return uniform(low, std::min(max, low * 2));
+    }
+
+    template<std::unsigned_integral T>
+    void putBE(std::string& out, T val) {
+        val = swapBytes<T>(val);
+        out.append((const char*)&val, sizeof(T));
+    }
+
+    template<std::unsigned_integral T>
+    void putLE(std::string& out, T val) {
+        out.append((const char*)&val, sizeof(T));
+    }
+
+    void putBE24(std::string& out, uint32_t val) {
+        out.push_back((char)(val >> 16));
+        out.push_back((char)(val >> 8));
+        out.push_back((char)val);
+    }
+
+    // inverse of util::syncSafe
+    uint32_t toSyncSafe(uint32_t val) {
+        return (val & 0x7f) | ((val << 1) & 0x7f00) | ((val << 2) & 0x7f0000) | ((val << 3) & 0x7f000000);
+    }
+
+    /*
+        Text
+    */
+
+    const char* Words[] = {
+        "night", "river", "blue", "echo", "summer", "live", "remix", "part", "love", "city",
+        "dream", "fire", "song", "road", "light", "home", "electric", "shadow", "gold", "rain"
+    };
+
+    // latin words, with Cyrillic and CJK ones for non latin1 encodings
+    std::u16string words(size_t count, bool ascii) {
+        std::u16string res;
+        for (size_t i = 0; i < count; ++i) {
+            if (i) {
+                res.push_back(u' ');
+            }
+            size_t kind = ascii ? 0 : rng() % 4;
+            if (kind < 2) {
+                for (const char* c = Words[rng() % std::size(Words)]; *c; ++c) {
+                    res.push_back((char16_t)*c);
+                }
+            }
+            else {
+                char16_t first = (kind == 2) ? 0x0430 : 0x4e00;
+                char16_t span = (kind == 2) ? 0x20 : 0x5000;
+                for (size_t n = uniform(2, 6); n; --n) {
+                    res.push_back((char16_t)(first + rng() % span));
+                }
+            }
+        }
+        return res;
+    }
+
+    std::u16string utf16Text(const std::string& ascii) {
+        return std::u16string(ascii.begin(), ascii.end());
+    }
+
+    /*
+        ID3v2 encodings:
+            0 - ISO-8859-1, 1 - UTF-16 with BOM, 2 - UTF-16BE (v2.4), 3 - UTF-8 (v2.4)
+    */
+    std::string encode(const std::u16string& str, uint8_t encoding) {
+        std::string res;
+        switch (encoding) {
+        case 0:
+            for (char16_t c : str) {
+                res.push_back((c < 0x100) ? (char)c : '?');
+            }
+            break;
+        case 1:
+            res = "\xff\xfe";
+            res.append((const char*)str.data(), str.size() * 2);
+            break;
+        case 2:
+            for (char16_t c : str) {
+                putBE<uint16_t>(res, c);
+            }
+            break;
+        default:
+            res = utf16ToUtf8((const char*)str.data(), str.size() * 2);
+        }
+        return res;
+    }
+
+    std::string terminator(uint8_t encoding) {
+        return ((encoding == 1) || (encoding == 2)) ? std::string(2, '\0') : std::string(1, '\0');
+    }
+
+    std::string utf8(const std::u16string& str) {
+        return encode(str, 3);
+    }
+
+    // JPEG markers around filler - enough for anything that sniffs image type
+    std::string image(size_t size) {
+        std::string res = "\xff\xd8\xff\xe0";
+        res.resize(std::max<size_t>(size, 6) - 2, '\x5a');
+        res += "\xff\xd9";
+        return res;
+    }
+
+    /*
+        ID3v2
+    */
+
+    struct Id3Names {
+        const char* title;
+        const char* artist;
+        const char* album;
+        const char* track;
+        const char* year;
+        const char* genre;
+        const char* comment;
+        const char* userText;
+        const char* userUrl;
+        const char* picture;
+    };
+
+    const Id3Names V22Names = {"TT2", "TP1", "TAL", "TRK", "TYE", "TCO", "COM", "TXX", "WXX", "PIC"};
+    const Id3Names V23Names = {"TIT2", "TPE1", "TALB", "TRCK", "TYER", "TCON", "COMM", "TXXX", "WXXX", "APIC"};
+    const Id3Names V24Names = {"TIT2", "TPE1", "TALB", "TRCK", "TDRC", "TCON", "COMM", "TXXX", "WXXX", "APIC"};
+
+    class Id3Writer {
+    public:
+        Id3Writer(uint8_t version) : version{version} {}
+
+        void frame(const char* id, const std::string& payload) {
+            if (version == 2) {
+                tag.append(id, 3);
+                putBE24(tag, payload.size());
+            }
+            else {
+                tag.append(id, 4);
+                putBE<uint32_t>(tag, (version == 4) ? toSyncSafe(payload.size()) : payload.size());
+                putBE<uint16_t>(tag, 0);
+            }
+            tag += payload;
+        }
+
+        uint8_t encoding() const {
+            return (version == 4) ? rng() % 4 : rng() % 2;
+        }
+
+        void text(const char* id, const std::u16string& value) {
+            uint8_t enc = encoding();
+            frame(id, std::string(1, (char)enc) + encode(value, enc));
+        }
+
+        void described(const char* id, const std::u16string& description, const std::u16string& value, bool url = false) {
+            uint8_t enc = encoding();
+            std::string payload(1, (char)enc);
+            payload += encode(description, enc) + terminator(enc);
+            payload += url ? encode(value, 0) : encode(value, enc);
+            frame(id, payload);
+        }
+
+        void comment(const char* id, const std::u16string& value) {
+            uint8_t enc = encoding();
+            std::string payload(1, (char)enc);
+            payload += "eng";
+            payload += terminator(enc) + encode(value, enc);
+            frame(id, payload);
+        }
+
+        void picture(const char* id, size_t size) {
+            uint8_t enc = encoding();
+            std::string payload(1, (char)enc);
+            // v2.2 has 3 character image format instead of MIME type
+            payload += (version == 2) ? std::string("JPG") : (std::string("image/jpeg") + '\0');
+            payload.push_back(3);
+            payload += encode(u"Cover", enc) + terminator(enc);
+            payload += image(size);
+            frame(id, payload);
+        }
+
+        std::string finish(size_t padding) {
+            std::string res = "ID3";
+            res.push_back((char)version);
+            res.push_back(0);
+            res.push_back(0);
+            putBE<uint32_t>(res, toSyncSafe(tag.size() + padding));
+            res += tag;
+            res.append(padding, '\0');
+            return res;
+        }
+    private:
+        uint8_t version;
+        std::string tag;
+    };
+
+    /*
+        albumCover - size of shared cover of the directory, 0 until first file takes it.
+        Images of equal size have equal bytes, so shared covers are identical.
+    */
+    size_t coverSize(const Options& opt, size_t& albumCover) {
+        size_t size = logUniform(opt.apicSize);
+        // no rng calls without the option - corpora of same seed stay the same
+        if (!opt.albumCovers || !percent(opt.albumCovers)) {
+            return size;
+        }
+        if (!albumCover) {
+            albumCover = size;
+        }
+        return albumCover;
+    }
+
+    std::string id3Tag(const Options& opt, Stats& stats, uint8_t version, bool cover, size_t& albumCover) {
+        const Id3Names& names = (version == 2) ? V22Names : ((version == 3) ? V23Names : V24Names);
+        Id3Writer writer(version);
+        size_t frames = uniform(opt.frames);
+        bool ascii = percent(60);
+        writer.text(names.title, words(uniform(1, 5), ascii));
+        writer.text(names.artist, words(uniform(1, 3), ascii));
+        writer.text(names.album, words(uniform(1, 4), ascii));
+        writer.text(names.track, utf16Text(std::to_string(uniform(1, 20))));
+        writer.text(names.year, utf16Text(std::to_string(uniform(1960, 2024))));
+        for (size_t i = 5; i < frames; ++i) {
+            switch (rng() % 4) {
+            case 0:
+                writer.text(names.genre, words(1, true));
+                break;
+            case 1:
+                writer.comment(names.comment, words(uniform(2, 30), ascii));
+                break;
+            case 2:
+                writer.described(names.userText, words(1, true), words(uniform(1, 8), ascii));
+                break;
+            default:
+                writer.described(names.userUrl, words(1, true), u"https://example.com/" + words(1, true), true);
+            }
+        }
+        if (cover) {
+            writer.picture(names.picture, coverSize(opt, albumCover));
+            ++stats.images;
+        }
+        ++stats.id3[version - 2];
+        return writer.finish(percent(25) ? 0 : uniform(0, opt.padding));
+    }
+
+    /*
+        MPEG1 Layer III, 44100 Hz, stereo
+    */
+
+    constexpr uint32_t SampleRate = 44100;
+    constexpr uint32_t FrameSamples = 1152;
+    // bitrate index 9 - 128 kbps
+    constexpr uint32_t CbrHeader = 0xfffb9000;
+
+    constexpr uint32_t PaddingBit = 0x200;
+    // kbps by bitrate index
+    constexpr uint32_t Bitrates[15] = {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320};
+
+    uint32_t mp3Header(uint32_t bitrateIndex) {
+        return (CbrHeader & ~0xf000u) | (bitrateIndex << 12);
+    }
+
+    std::string mp3Frame(uint32_t header) {
+        std::string res;
+        putBE<uint32_t>(res, header);
+        res.resize(mp3::Mp3FrameParser::frameLength(header), '\0');
+        return res;
+    }
+
+    // Xing/Info or VBRI header in frame, which itself holds no audio
+    std::string vbrHeaderFrame(bool vbr, const std::vector<uint32_t>& headers, uint32_t bytes) {
+        static constexpr size_t XingOffset = 4 + 32;
+        std::string res = mp3Frame(CbrHeader);
+        uint32_t frames = headers.size();
+        std::string header;
+        if (!vbr || percent(80)) {
+            header = vbr ? "Xing" : "Info";
+            // frames, bytes and TOC fields, as LAME writes them
+            putBE<uint32_t>(header, 0x7);
+            putBE<uint32_t>(header, frames);
+            putBE<uint32_t>(header, bytes);
+            // position of every percent of frames, in 1/256 of bytes from the header frame
+            uint64_t offset = res.size();
+            size_t frame = 0;
+            for (size_t i = 0; i < 100; ++i) {
+                for (; frame < (size_t)frames * i / 100; ++frame) {
+                    offset += mp3::Mp3FrameParser::frameLength(headers[frame]);
+                }
+                header.push_back((char)std::min<uint64_t>(offset * 256 / bytes, 255));
+            }
+        }
+        else {
+            header = "VBRI";
+            putBE<uint16_t>(header, 1);
+            putBE<uint16_t>(header, 0);
+            putBE<uint16_t>(header, 75);
+            putBE<uint32_t>(header, bytes);
+            putBE<uint32_t>(header, frames);
+        }
+        res.replace(XingOffset, header.size(), header);
+        return res;
+    }
+
+    void writeMp3(std::ofstream& out, const Options& opt, Stats& stats, bool cover, size_t& albumCover) {
+        if (percent(opt.untagged)) {
+            ++stats.untagged;
+        }
+        else {
+            uint8_t version = 2 + weighted(opt.id3);
+            out << id3Tag(opt, stats, version, cover, albumCover);
+        }
+        bool vbr = percent(opt.vbr);
+        uint32_t frames = uniform(opt.seconds) * SampleRate / FrameSamples;
+        std::vector<uint32_t> headers(frames, CbrHeader);
+        uint32_t bytes = 0;
+        // 144 * bitrate / 44100 bytes is not whole - encoders pad some frames, so that stream keeps nominal bitrate
+        uint32_t rest = 0;
+        for (auto& header : headers) {
+            if (vbr) {
+                // 32..320 kbps
+                header = mp3Header(uniform(1, 14));
+            }
+            rest += 144 * Bitrates[(header >> 12) & 0xf] * 1000 % SampleRate;
+            if (rest >= SampleRate) {
+                rest -= SampleRate;
+                header |= PaddingBit;
+            }
+            bytes += mp3::Mp3FrameParser::frameLength(header);
+        }
+        stats.vbr += vbr;
+        if (percent(opt.vbrHeader)) {
+            // bytes include header frame itself
+            out << vbrHeaderFrame(vbr, headers, bytes + mp3::Mp3FrameParser::frameLength(CbrHeader));
+            ++stats.vbrHeaders;
+        }
+        // audio frames repeat, so they are built once per bitrate and padding
+        std::string cache[15][2];
+        for (uint32_t header : headers) {
+            std::string& frame = cache[(header >> 12) & 0xf][(header & PaddingBit) ? 1 : 0];
+            if (frame.empty()) {
+                frame = mp3Frame(header);
+            }
+            out << frame;
+        }
+    }
+
+    /*
+        FLAC
+    */
+
+    enum FlacBlock : uint8_t {
+        StreamInfo = 0,
+        Padding = 1,
+        Application = 2,
+        SeekTable = 3,
+        VorbisComment = 4,
+        Picture = 6
+    };
+
+    void flacBlock(std::string& out, uint8_t type, const std::string& data, bool last) {
+        out.push_back((char)(type | (last ? 0x80 : 0)));
+        putBE24(out, data.size());
+        out += data;
+    }
+
+    std::string streamInfo(uint64_t totalSamples) {
+        std::string res;
+        putBE<uint16_t>(res, 4096);
+        putBE<uint16_t>(res, 4096);
+        putBE24(res, 0);
+        putBE24(res, 0);
+        // sample rate (20 bits), channels - 1 (3 bits), bits per sample - 1 (5 bits), total samples (36 bits)
+        uint64_t packed = ((uint64_t)SampleRate << 44) | ((uint64_t)(2 - 1) << 41) | ((uint64_t)(16 - 1) << 36) | (totalSamples & 0xfffffffff);
+        putBE<uint64_t>(res, packed);
+        res.append(16, '\0');
+        return res;
+    }
+
+    std::string seekTable(uint64_t totalSamples) {
+        std::string res;
+        // point every 10 seconds
+        for (uint64_t sample = 0; sample < totalSamples; sample += 10 * SampleRate) {
+            putBE<uint64_t>(res, sample);
+            putBE<uint64_t>(res, sample / 4);
+            putBE<uint16_t>(res, 4096);
+        }
+        return res;
+    }
+
+    std::string vorbisComment(const Options& opt) {
+        static const char* keys[] = {"GENRE", "COMMENT", "COMPOSER", "DISCNUMBER", "LABEL", "ISRC", "DESCRIPTION", "REPLAYGAIN_TRACK_GAIN"};
+        std::string vendor = "reference libFLAC 1.4.3 20230623";
+        bool ascii = percent(60);
+        std::vector<std::string> comments = {
+            "TITLE=" + utf8(words(uniform(1, 5), ascii)),
+            "ARTIST=" + utf8(words(uniform(1, 3), ascii)),
+            "ALBUM=" + utf8(words(uniform(1, 4), ascii)),
+            "TRACKNUMBER=" + std::to_string(uniform(1, 20)),
+            "DATE=" + std::to_string(uniform(1960, 2024))
+        };
+        for (size_t n = uniform(opt.frames); comments.size() < n;) {
+            comments.push_back(std::string(keys[rng() % std::size(keys)]) + "=" + utf8(words(uniform(1, 8), ascii)));
+        }
+        std::string res;
+        putLE<uint32_t>(res, vendor.size());
+        res += vendor;
+        putLE<uint32_t>(res, comments.size());
+        for (const auto& comment : comments) {
+            putLE<uint32_t>(res, comment.size());
+            res += comment;
+        }
+        return res;
+    }
+
+    std::string picture(size_t size) {
+        std::string mime = "image/jpeg";
+        std::string description = "Cover";
+        std::string res;
+        putBE<uint32_t>(res, 3);
+        putBE<uint32_t>(res, mime.size());
+        res += mime;
+        putBE<uint32_t>(res, description.size());
+        res += description;
+        for (uint32_t val : {500u, 500u, 24u, 0u}) {
+            putBE<uint32_t>(res, val);
+        }
+        std::string data = image(size);
+        putBE<uint32_t>(res, data.size());
+        res += data;
+        return res;
+    }
+
+    void writeFlac(std::ofstream& out, const Options& opt, Stats& stats, bool cover, size_t& albumCover) {
+        uint64_t totalSamples = (uint64_t)uniform(opt.seconds) * SampleRate;
+        std::vector<std::pair<uint8_t, std::string>> blocks;
+        blocks.emplace_back(StreamInfo, streamInfo(totalSamples));
+        if (percent(50)) {
+            blocks.emplace_back(SeekTable, seekTable(totalSamples));
+        }
+        if (percent(90)) {
+            blocks.emplace_back(VorbisComment, vorbisComment(opt));
+        }
+        if (percent(10)) {
+            blocks.emplace_back(Application, "ATCH" + std::string(uniform(16, 256), '\x11'));
+        }
+        if (cover) {
+            blocks.emplace_back(Picture, picture(coverSize(opt, albumCover)));
+            ++stats.images;
+        }
+        if (percent(70)) {
+            blocks.emplace_back(Padding, std::string(uniform(0, opt.padding), '\0'));
+        }
+        std::string head = "fLaC";
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            flacBlock(head, blocks[i].first, blocks[i].second, (i + 1) == blocks.size());
+        }
+        out << head;
+        // audio frames are never parsed - sized like 128 kbps stream, to keep corpus comparable with mp3 part
+        uint64_t audio = totalSamples / SampleRate * 16 * 1024;
+        std::string chunk(64 * 1024, '\0');
+        for (uint64_t written = 0; written < audio; written += chunk.size()) {
+            out.write(chunk.data(), std::min<uint64_t>(chunk.size(), audio - written));
+        }
+    }
+
+    /*
+        WAV: 8 kHz 8 bit mono PCM, so files stay small
+    */
+
+    void writeWav(std::ofstream& out, const Options& opt) {
+        constexpr uint32_t Rate = 8000;
+        uint32_t dataSize = uniform(opt.seconds) * Rate;
+        std::string head = "RIFF";
+        putLE<uint32_t>(head, 36 + dataSize);
+        head += "WAVEfmt ";
+        putLE<uint32_t>(head, 16);
+        putLE<uint16_t>(head, 1);
+        putLE<uint16_t>(head, 1);
+        putLE<uint32_t>(head, Rate);
+        putLE<uint32_t>(head, Rate);
+        putLE<uint16_t>(head, 1);
+        putLE<uint16_t>(head, 8);
+        head += "data";
+        putLE<uint32_t>(head, dataSize);
+        out << head;
+        // silence in 8 bit PCM
+        std::string chunk(64 * 1024, '\x80');
+        for (uint64_t written = 0; written < dataSize; written += chunk.size()) {
+            out.write(chunk.data(), std::min<uint64_t>(chunk.size(), dataSize - written));
+        }
+    }
+
+    bool parseRange(const char* arg, Range& range) {
+        const char* colon = strchr(arg, ':');
+        if (!colon) {
+            return false;
+        }
+        range = {(size_t)std::atoll(arg), (size_t)std::atoll(colon + 1)};
+        return range.min <= range.max;
+    }
+
+    bool parseWeights(const char* arg, std::vector<size_t>& weights) {
+        std::vector<size_t> res;
+        for (const char* p = arg; p; p = strchr(p, ':') ? strchr(p, ':') + 1 : nullptr) {
+            res.push_back((size_t)std::atoll(p));
+        }
+        if (res.size() != weights.size()) {
+            return false;
+        }
+        weights = res;
+        return true;
+    }
+
+    bool parseOptions(int argc, char** argv, Options& opt) {
+        if (argc < 2) {
+            return false;
+        }
+        opt.dir = argv[1];
+        for (int i = 2; i < argc; ++i) {
+            std::string arg = argv[i];
+            if ((i + 1) >= argc) {
+                return false;
+            }
+            const char* val = argv[++i];
+            bool ok = true;
+            if (arg == "--files") {
+                opt.files = std::atoll(val);
+            }
+            else if (arg == "--dirs") {
+                opt.dirs = std::max(1ll, std::atoll(val));
+            }
+            else if (arg == "--seed") {
+                opt.seed = std::atoll(val);
+            }
+            else if (arg == "--mix") {
+                ok = parseWeights(val, opt.mix);
+            }
+            else if (arg == "--id3") {
+                ok = parseWeights(val, opt.id3);
+            }
+            else if (arg == "--untagged") {
+                opt.untagged = std::atoll(val);
+            }
+            else if (arg == "--frames") {
+                ok = parseRange(val, opt.frames);
+            }
+            else if (arg == "--padding") {
+                opt.padding = std::atoll(val);
+            }
+            else if (arg == "--vbr") {
+                opt.vbr = std::atoll(val);
+            }
+            else if (arg == "--vbr-header") {
+                opt.vbrHeader = std::atoll(val);
+            }
+            else if (arg == "--apic") {
+                opt.apic = std::atoll(val);
+            }
+            else if (arg == "--apic-size") {
+                ok = parseRange(val, opt.apicSize);
+            }
+            else if (arg == "--album-covers") {
+                opt.albumCovers = std::atoll(val);
+            }
+            else if (arg == "--seconds") {
+                ok = parseRange(val, opt.seconds);
+            }
+            else if (arg == "--mislabeled") {
+                opt.mislabeled = std::atoll(val);
+            }
+            else {
+                ok = false;
+            }
+            if (!ok) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parseOptions(argc, argv, opt)) {
+        std::cerr << "usage: " << argv[0] << " <output dir> [--files N] [--dirs N] [--seed N] [--mix M:F:W] [--id3 V2:V3:V4] [--untagged P]"
+                     " [--frames MIN:MAX] [--padding MAX] [--vbr P] [--vbr-header P] [--apic P] [--apic-size MIN:MAX] [--album-covers P]"
+                     " [--seconds MIN:MAX] [--mislabeled P]\n";
+        return 1;
+    }
+    rng.seed(opt.seed);
+    Stats stats;
+    // size of shared cover of every directory
+    std::vector<size_t> albumCovers(opt.dirs, 0);
+    for (size_t i = 0; i < opt.files; ++i) {
+        Kind kind = (Kind)weighted(opt.mix);
+        bool cover = percent(opt.apic);
+        // WAV parser reads no tags, so WAV files have no cover either
+        cover = cover && (kind != Wav);
+        size_t ext = kind;
+        if (percent(opt.mislabeled)) {
+            ext = (ext + uniform(1, 2)) % 3;
+            ++stats.mislabeled;
+        }
+        // "dNNN/fNNNNNN" - wider for big numbers
+        char name[64];
+        snprintf(name, sizeof(name), "d%03zu/f%06zu", i % opt.dirs, i);
+        std::filesystem::path path = opt.dir / (std::string(name) + Extensions[ext]);
+        std::filesystem::create_directories(path.parent_path());
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cerr << "can't write " << path << "\n";
+            return 1;
+        }
+        switch (kind) {
+        case Mp3:
+            writeMp3(out, opt, stats, cover, albumCovers[i % opt.dirs]);
+            break;
+        case Flac:
+            writeFlac(out, opt, stats, cover, albumCovers[i % opt.dirs]);
+            break;
+        default:
+            writeWav(out, opt);
+        }
+        stats.bytes += out.tellp();
+        ++stats.files[kind];
+        if (!out) {
+            std::cerr << "can't write " << path << "\n";
+            return 1;
+        }
+    }
+    std::cout << "{\n";
+    std::cout << "  \"seed\": " << opt.seed << ",\n";
+    std::cout << "  \"files\": " << opt.files << ",\n";
+    std::cout << "  \"bytes\": " << stats.bytes << ",\n";
+    std::cout << "  \"mp3\": " << stats.files[Mp3] << ",\n";
+    std::cout << "  \"flac\": " << stats.files[Flac] << ",\n";
+    std::cout << "  \"wav\": " << stats.files[Wav] << ",\n";
+    std::cout << "  \"id3v22\": " << stats.id3[0] << ",\n";
+    std::cout << "  \"id3v23\": " << stats.id3[1] << ",\n";
+    std::cout << "  \"id3v24\": " << stats.id3[2] << ",\n";
+    std::cout << "  \"untagged\": " << stats.untagged << ",\n";
+    std::cout << "  \"vbr\": " << stats.vbr << ",\n";
+    std::cout << "  \"vbr_headers\": " << stats.vbrHeaders << ",\n";
+    std::cout << "  \"images\": " << stats.images << ",\n";
+    std::cout << "  \"mislabeled\": " << stats.mislabeled << "\n";
+    std::cout << "}\n";
+    return 0;
+}
@@ -36,11 +36,11 @@ void testUtfConverters() {
 void testFlacExtractor() {
     //std::string path = "/media/onyazuka/New SSD/music/虹のコンキスタドール/01 心臓にメロディー.flac";
     std::string path = "/media/onyazuka/New SSD/music/Oasis - Falling Down (Eden of the East OP theme).flac";
-    std::ifstream ifs(path, std::ios_base::binary);
-    if (!ifs) {
+    auto src = io::open(path);
+    if (!src) {
         throw std::runtime_error("error opening file");
     }
-    FlacTagParser parser(ifs);
+    FlacTagParser parser(src);
     auto vorbis = parser.VorbisCommentMap();
     for (const auto& [key,val] : vorbis) {
         cout << key << " = " << val << endl;
@@ -52,11 +52,11 @@ void testFlacExtractor() {
 
 void testWav() {
     std::string path = "/home/onyazuka/sample.wav";
-    std::ifstream ifs(path, std::ios_base::binary);
-    if (!ifs) {
+    auto src = io::open(path);
+    if (!src) {
         throw std::runtime_error("error opening file");
     }
-    WavParser wav(ifs);
+    WavParser wav(*src);
     auto dur = wav.durationMs();
     cout << "WAV duration is " << dur << endl;
 }
@@ -87,13 +87,13 @@ int main()
         std::string home = "/home/onyazuka/";
         std::string path = home + "鈴木このみ アスタロア.mp3";
         //std::string path = "/media/onyazuka/New SSD/music/all-for-you-genshin-impact-hoyofair2023-new-year.mp3";
-        std::ifstream ifs(path, std::ios_base::binary);
-        if (!ifs) {
+        auto src = io::open(path);
+        if (!src) {
             throw std::runtime_error("error opening file");
         }
 
         std::unordered_map<std::string, std::string> tags;
-        ID3V2Parser parser(ifs);
+        ID3V2Parser parser(src);
         for (const auto& title : parser.getExtractor()->frameTitles()) {
             if(title[0] == 'T' && (title != "TXXX")) {
                 tags[title] = std::get<1>(parser.Textual(title));
@@ -112,7 +112,7 @@ int main()
         }
 
         auto before1 = getTsMcs();
-        std::cout << "Duration " << mp3::getMp3FileDuration(ifs) << " ms\n";
+        std::cout << "Duration " << mp3::getMp3FileDuration(*src) << " ms\n";
         auto after1 = getTsMcs();
         std::cout << "Elapsed: " << (after1 - before1) << " mcs\n";
     }
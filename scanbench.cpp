@@ -0,0 +1,314 @@
+#include <chrono>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+#include <optional>
+#include <cstdlib>
+#include "TagScout.hpp"
+#include "MetaCache.hpp"
+#include "Instrumentation.hpp"
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+/*
+    End-to-end benchmark of library scan: TagScout and getMetainfo over directory (e.g. written by MetaTagsCorpusGen).
+    Reports files/s, bytes read and per-file latency percentiles as JSON to stdout.
+
+    usage: MetaTagsParserScanBench <dir> [--threads N] [--passes N] [--batch N] [--images] [--locations] [--dedup] [--cache] [--no-warmup]
+        --threads N     TagScout workers, 0 - one per hardware thread (1)
+        --passes N      times every file is given to getMetainfo (1)
+        --batch N       files per getMetainfoBatch call (256)
+        --images        getMetainfo extracts images too
+        --locations     images are only located in files, their bytes are not read (implies --images)
+        --dedup         images with same bytes are shared through one ImageStore (implies --images); its stats are reported
+        --cache         also runs with MetaCache (cold, then warm); cache file is temporary
+        --no-warmup     files are not read before measuring, so first phase sees cold page cache
+
+    Bytes read are taken from /proc/self/io (Linux only):
+        mb_read - bytes returned by read syscalls (reads through io_uring may be not counted),
+        mb_read_storage - bytes fetched from storage, 0 when files are in page cache.
+*/
+
+namespace {
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        std::filesystem::path dir;
+        size_t threads = 1;
+        size_t passes = 1;
+        size_t batch = 256;
+        bool images = false;
+        bool locations = false;
+        bool dedup = false;
+        bool cache = false;
+        bool warmup = true;
+    };
+
+    struct IoCounters {
+        uint64_t rchar = 0;
+        uint64_t readBytes = 0;
+        uint64_t syscr = 0;
+    };
+
+    std::optional<IoCounters> ioCounters() {
+#ifdef __linux__
+        std::ifstream ifs("/proc/self/io");
+        if (!ifs) {
+            return std::nullopt;
+        }
+        IoCounters res;
+        std::string name;
+        uint64_t val;
+        while (ifs >> name >> val) {
+            if (name == "rchar:") {
+                res.rchar = val;
+            }
+            else if (name == "syscr:") {
+                res.syscr = val;
+            }
+            else if (name == "read_bytes:") {
+                res.readBytes = val;
+            }
+        }
+        return res;
+#else
+        return std::nullopt;
+#endif
+    }
+
+    struct Result {
+        std::string name;
+        size_t files = 0;
+        // files, which gave no metainfo (or TagScout errors)
+        size_t failed = 0;
+        double seconds = 0;
+        std::optional<IoCounters> io;
+        // per file, in microseconds; empty if phase can't time single files
+        std::vector<double> latencies;
+    };
+
+    // nearest rank
+    double percentile(std::vector<double>& values, double p) {
+        if (values.empty()) {
+            return 0;
+        }
+        size_t rank = std::min(values.size() - 1, (size_t)(p / 100.0 * values.size()));
+        std::nth_element(values.begin(), values.begin() + rank, values.end());
+        return values[rank];
+    }
+
+    class Phase {
+    public:
+        Phase(std::string name) : io{ioCounters()}, begin{Clock::now()} {
+            result.name = std::move(name);
+        }
+
+        Result finish(size_t files) {
+            result.seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+            result.files = files;
+            auto end = ioCounters();
+            if (io && end) {
+                result.io = IoCounters{end->rchar - io->rchar, end->readBytes - io->readBytes, end->syscr - io->syscr};
+            }
+            return std::move(result);
+        }
+
+        Result result;
+    private:
+        std::optional<IoCounters> io;
+        Clock::time_point begin;
+    };
+
+    // shared by all phases with --dedup
+    tag::ImageStore imageStore;
+
+    GetMetaInfoConfig metainfoConfig(const Options& opt) {
+        GetMetaInfoConfig config{true, true, opt.images};
+        config.imageLocations = opt.locations;
+        config.imageStore = opt.dedup ? &imageStore : nullptr;
+        return config;
+    }
+
+    Result runGetMetainfo(const std::string& name, const std::vector<std::filesystem::path>& files, const Options& opt, cache::MetaCache* cache) {
+        GetMetaInfoConfig config = metainfoConfig(opt);
+        INSTR_SCAN(name);
+        Phase phase(name);
+        phase.result.latencies.reserve(files.size() * opt.passes);
+        for (size_t pass = 0; pass < opt.passes; ++pass) {
+            for (const auto& path : files) {
+                auto begin = Clock::now();
+                MetaInfo info = getMetainfo(path, config, cache);
+                phase.result.latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - begin).count());
+                phase.result.failed += !info.fields;
+            }
+        }
+        return phase.finish(files.size() * opt.passes);
+    }
+
+    Result runGetMetainfoBatch(const std::vector<std::filesystem::path>& files, const Options& opt) {
+        GetMetaInfoConfig config = metainfoConfig(opt);
+        Phase phase("getMetainfoBatch");
+        for (size_t pass = 0; pass < opt.passes; ++pass) {
+            for (size_t i = 0; i < files.size(); i += opt.batch) {
+                auto batch = std::span(files).subspan(i, std::min(opt.batch, files.size() - i));
+                for (const auto& info : getMetainfoBatch(batch, config)) {
+                    phase.result.failed += !info.fields;
+                }
+            }
+        }
+        return phase.finish(files.size() * opt.passes);
+    }
+
+    Result runTagScout(const std::string& name, const Options& opt, size_t files, cache::MetaCache* cache) {
+        Phase phase(name);
+        TagScout scout(opt.dir, opt.threads, cache);
+        // unreadable files are listed under "error"
+        auto map = scout.map();
+        auto errors = map.find("error");
+        phase.result.failed = (errors != map.end()) ? errors->second.size() : 0;
+        return phase.finish(files);
+    }
+
+    // reads every file once, so all phases start with the same (hot) page cache
+    void warmup(const std::vector<std::filesystem::path>& files) {
+        std::vector<char> buf(1 << 20);
+        for (const auto& path : files) {
+            std::ifstream ifs(path, std::ios::binary);
+            while (ifs.read(buf.data(), buf.size()) || ifs.gcount()) {}
+        }
+    }
+
+    void print(std::ostream& os, const Options& opt, size_t files, uint64_t bytes, std::vector<Result>& results) {
+        os << "{\n  \"context\": {\n";
+        os << "    \"dir\": \"" << opt.dir.generic_string() << "\",\n";
+        os << "    \"files\": " << files << ",\n";
+        os << "    \"mb\": " << bytes / 1e6 << ",\n";
+        os << "    \"threads\": " << opt.threads << ",\n";
+        os << "    \"passes\": " << opt.passes << ",\n";
+        os << "    \"images\": " << (opt.images ? "true" : "false") << ",\n";
+        os << "    \"locations\": " << (opt.locations ? "true" : "false") << ",\n";
+        if (opt.dedup) {
+            auto stats = imageStore.stats();
+            os << "    \"image_store\": {\"lookups\": " << stats.lookups << ", \"hits\": " << stats.hits << ", \"images\": " << stats.images
+               << ", \"mb_returned\": " << stats.bytesReturned / 1e6 << ", \"mb_stored\": " << stats.bytesStored / 1e6 << "},\n";
+        }
+        os << "    \"warmup\": " << (opt.warmup ? "true" : "false") << ",\n";
+#ifdef __OPTIMIZE__
+        os << "    \"optimized\": true\n";
+#else
+        os << "    \"optimized\": false\n";
+#endif
+        os << "  },\n  \"results\": [";
+        for (size_t i = 0; i < results.size(); ++i) {
+            Result& res = results[i];
+            os << (i ? ",\n" : "\n");
+            os << "    {\"name\": \"" << res.name << "\", \"files\": " << res.files << ", \"failed\": " << res.failed
+               << ", \"seconds\": " << res.seconds << ", \"files_per_s\": " << (res.seconds ? res.files / res.seconds : 0.0);
+            if (res.io) {
+                os << ", \"mb_read\": " << res.io->rchar / 1e6 << ", \"mb_read_storage\": " << res.io->readBytes / 1e6
+                   << ", \"read_syscalls\": " << res.io->syscr;
+            }
+            if (!res.latencies.empty()) {
+                os << ", \"p50_us\": " << percentile(res.latencies, 50) << ", \"p99_us\": " << percentile(res.latencies, 99)
+                   << ", \"max_us\": " << percentile(res.latencies, 100);
+            }
+            os << "}";
+        }
+        os << "\n  ]\n}\n";
+    }
+
+    bool parseOptions(int argc, char** argv, Options& opt) {
+        if (argc < 2) {
+            return false;
+        }
+        opt.dir = argv[1];
+        for (int i = 2; i < argc; ++i) {
+            std::string arg = argv[i];
+            bool hasValue = (i + 1) < argc;
+            if ((arg == "--threads") && hasValue) {
+                opt.threads = std::atoll(argv[++i]);
+            }
+            else if ((arg == "--passes") && hasValue) {
+                opt.passes = std::max(1ll, std::atoll(argv[++i]));
+            }
+            else if ((arg == "--batch") && hasValue) {
+                opt.batch = std::max(1ll, std::atoll(argv[++i]));
+            }
+            else if (arg == "--images") {
+                opt.images = true;
+            }
+            else if (arg == "--locations") {
+                opt.images = opt.locations = true;
+            }
+            else if (arg == "--dedup") {
+                opt.images = opt.dedup = true;
+            }
+            else if (arg == "--cache") {
+                opt.cache = true;
+            }
+            else if (arg == "--no-warmup") {
+                opt.warmup = false;
+            }
+            else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parseOptions(argc, argv, opt)) {
+        std::cerr << "usage: " << argv[0] << " <dir> [--threads N] [--passes N] [--batch N] [--images] [--locations] [--dedup] [--cache] [--no-warmup]\n";
+        return 1;
+    }
+    std::vector<std::filesystem::path> files;
+    uint64_t bytes = 0;
+    std::error_code ec;
+    for (auto iter = std::filesystem::recursive_directory_iterator(opt.dir, ec); !ec && (iter != std::filesystem::recursive_directory_iterator()); iter.increment(ec)) {
+        if (iter->is_regular_file(ec)) {
+            files.push_back(iter->path());
+            bytes += iter->file_size(ec);
+        }
+    }
+    if (files.empty()) {
+        std::cerr << "no files in " << opt.dir << "\n";
+        return 1;
+    }
+    // same order on every run
+    std::sort(files.begin(), files.end());
+    if (opt.warmup) {
+        warmup(files);
+    }
+
+    std::vector<Result> results;
+    results.push_back(runTagScout("TagScout", opt, files.size(), nullptr));
+    results.push_back(runGetMetainfo("getMetainfo", files, opt, nullptr));
+    results.push_back(runGetMetainfoBatch(files, opt));
+    if (opt.cache) {
+#ifdef __linux__
+        std::string suffix = std::to_string(getpid());
+#else
+        std::string suffix = std::to_string(Clock::now().time_since_epoch().count());
+#endif
+        auto cachePath = std::filesystem::temp_directory_path() / ("MetaTagsParserScanBench-" + suffix + ".cache");
+        {
+            cache::MetaCache cache(cachePath);
+            results.push_back(runTagScout("TagScout cache cold", opt, files.size(), &cache));
+            results.push_back(runTagScout("TagScout cache warm", opt, files.size(), &cache));
+            results.push_back(runGetMetainfo("getMetainfo cache cold", files, opt, &cache));
+            results.push_back(runGetMetainfo("getMetainfo cache warm", files, opt, &cache));
+        }
+        std::filesystem::remove(cachePath, ec);
+    }
+    print(std::cout, opt, files.size(), bytes, results);
+    return 0;
+}
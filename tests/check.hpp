@@ -0,0 +1,29 @@
+#ifndef CHECK_HPP
+#define CHECK_HPP
+#include <iostream>
+
+/*
+    Minimal test harness (no dependencies): failed CHECK is reported and test goes on, so one run shows every broken check.
+    Test executable returns non-zero, if any check failed.
+*/
+namespace check {
+
+    inline int failures = 0;
+
+    inline void fail(const char* expr, const char* file, int line) {
+        ++failures;
+        std::cerr << file << ":" << line << ": CHECK(" << expr << ") failed\n";
+    }
+
+    inline int result() {
+        if (failures) {
+            std::cerr << failures << " check(s) failed\n";
+        }
+        return failures ? 1 : 0;
+    }
+
+}
+
+#define CHECK(expr) ((expr) ? (void)0 : check::fail(#expr, __FILE__, __LINE__))
+
+#endif // CHECK_HPP
@@ -0,0 +1,191 @@
+#ifndef FIXTURES_HPP
+#define FIXTURES_HPP
+#include <string>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+#include <utility>
+#include "ByteSource.hpp"
+
+/*
+    Small files for tests, built in memory: only bytes, which parsers look at, are filled; audio data is zeros.
+*/
+namespace fixtures {
+
+    inline std::shared_ptr<io::ByteSource> memory(const std::string& data) {
+        io::ByteSource::Block block(new uint8_t[data.size() + 1]);
+        memcpy(block.get(), data.data(), data.size());
+        return std::make_shared<io::MemoryByteSource>(std::move(block), data.size());
+    }
+
+    inline void be16(std::string& out, uint16_t value) {
+        out.push_back((char)(value >> 8));
+        out.push_back((char)value);
+    }
+
+    inline void be32(std::string& out, uint32_t value) {
+        be16(out, (uint16_t)(value >> 16));
+        be16(out, (uint16_t)value);
+    }
+
+    inline void le32(std::string& out, uint32_t value) {
+        for (int i = 0; i < 4; ++i) {
+            out.push_back((char)(value >> (8 * i)));
+        }
+    }
+
+    // 7 bits per byte, as ID3v2 and APE sizes are written
+    inline void syncsafe32(std::string& out, uint32_t value) {
+        for (int shift = 21; shift >= 0; shift -= 7) {
+            out.push_back((char)((value >> shift) & 0x7f));
+        }
+    }
+
+    namespace mp3 {
+
+        // MPEG1 Layer III, 44100 Hz, stereo, no CRC
+        constexpr uint32_t SampleRate = 44100;
+        constexpr uint32_t Samples = 1152;
+        // kbps by bitrate index
+        constexpr uint32_t Bitrates[15] = {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320};
+
+        inline size_t frameLength(uint32_t bitrateIndex, bool padding) {
+            return 144 * Bitrates[bitrateIndex] * 1000 / SampleRate + (padding ? 1 : 0);
+        }
+
+        inline std::string frame(uint32_t bitrateIndex, bool padding = false) {
+            std::string res(frameLength(bitrateIndex, padding), '\0');
+            res[0] = (char)0xff;
+            res[1] = (char)0xfb;
+            res[2] = (char)((bitrateIndex << 4) | (padding ? 0x2 : 0));
+            return res;
+        }
+
+        // CBR stream with padding bits, set the way encoders do it, so average frame has exact bitrate
+        inline std::string cbr(uint32_t bitrateIndex, size_t frames) {
+            std::string res;
+            uint32_t rest = 0;
+            for (size_t i = 0; i < frames; ++i) {
+                rest += 144 * Bitrates[bitrateIndex] * 1000 % SampleRate;
+                bool padding = rest >= SampleRate;
+                if (padding) {
+                    rest -= SampleRate;
+                }
+                res += frame(bitrateIndex, padding);
+            }
+            return res;
+        }
+
+        // frames, cycling through bitrate indices
+        inline std::string vbr(std::initializer_list<uint32_t> bitrateIndices, size_t frames) {
+            std::string res;
+            for (size_t i = 0; i < frames; ++i) {
+                res += frame(bitrateIndices.begin()[i % bitrateIndices.size()]);
+            }
+            return res;
+        }
+
+        // first frame with Xing ("Xing") or Info ("Info") header after side information of MPEG1 stereo (32 bytes)
+        inline std::string xingFrame(const char* id, uint32_t frames, uint32_t bytes, const uint8_t* toc = nullptr) {
+            std::string res = frame(9);
+            std::string header = id;
+            be32(header, 0x1 | 0x2 | (toc ? 0x4 : 0));
+            be32(header, frames);
+            be32(header, bytes);
+            if (toc) {
+                header.append((const char*)toc, 100);
+            }
+            res.replace(4 + 32, header.size(), header);
+            return res;
+        }
+
+        // first frame with VBRI header, which is always 32 bytes after frame header
+        inline std::string vbriFrame(uint32_t frames, uint32_t bytes) {
+            std::string res = frame(9);
+            std::string header = "VBRI";
+            be16(header, 1);
+            be16(header, 0);
+            be16(header, 75);
+            be32(header, bytes);
+            be32(header, frames);
+            res.replace(4 + 32, header.size(), header);
+            return res;
+        }
+
+        inline uint64_t durationMs(size_t frames) {
+            return (uint64_t)frames * Samples * 1000 / SampleRate;
+        }
+
+    }
+
+    namespace tags {
+
+        // ID3v1.1, if track is not 0
+        inline std::string id3v1(const std::string& title, const std::string& artist, const std::string& album, const std::string& year,
+                                 const std::string& comment, uint8_t track = 0, uint8_t genre = 17) {
+            std::string res = "TAG";
+            auto field = [&](const std::string& value, size_t n) { res += value.substr(0, n) + std::string(n - std::min(n, value.size()), '\0'); };
+            field(title, 30);
+            field(artist, 30);
+            field(album, 30);
+            field(year, 4);
+            field(comment, track ? 28 : 30);
+            if (track) {
+                res.push_back('\0');
+                res.push_back((char)track);
+            }
+            res.push_back((char)genre);
+            return res;
+        }
+
+        // APEv2 with text items: header (optional), items, footer
+        inline std::string ape(const std::vector<std::pair<std::string, std::string>>& items, bool withHeader = true) {
+            std::string body;
+            for (const auto& [key, value] : items) {
+                le32(body, (uint32_t)value.size());
+                le32(body, 0);
+                body += key;
+                body.push_back('\0');
+                body += value;
+            }
+            auto frame = [&](bool header) {
+                std::string res = "APETAGEX";
+                le32(res, 2000);
+                le32(res, (uint32_t)body.size() + 32);
+                le32(res, (uint32_t)items.size());
+                le32(res, (withHeader ? (1u << 31) : 0) | (header ? (1u << 29) : 0));
+                res.append(8, '\0');
+                return res;
+            };
+            return (withHeader ? frame(true) : "") + body + frame(false);
+        }
+
+        // ID3v2.4 text frame, UTF-8
+        inline std::string textFrame(const std::string& id, const std::string& text) {
+            std::string res = id;
+            syncsafe32(res, (uint32_t)text.size() + 1);
+            res.append(2, '\0');
+            res.push_back((char)3);
+            return res + text;
+        }
+
+        // ID3v2.4 tag; with footer it may be appended to the file
+        inline std::string id3v2(const std::string& frames, bool footer = false) {
+            auto header = [&](const char* id) {
+                std::string res = id;
+                res.push_back((char)4);
+                res.push_back('\0');
+                res.push_back((char)(footer ? 0x10 : 0));
+                syncsafe32(res, (uint32_t)frames.size());
+                return res;
+            };
+            return header("ID3") + frames + (footer ? header("3DI") : "");
+        }
+
+    }
+
+}
+
+#endif // FIXTURES_HPP
@@ -0,0 +1,139 @@
+#include <vector>
+#include "check.hpp"
+#include "fixtures.hpp"
+#include "FlacTagParser.hpp"
+
+using namespace fixtures;
+
+namespace {
+
+    constexpr uint32_t SampleRate = 44100;
+    constexpr uint32_t BlockSize = 4096;
+    constexpr size_t FrameSize = 1000;
+    constexpr size_t Frames = 100;
+
+    std::string block(uint8_t type, const std::string& payload, bool last) {
+        std::string res(1, (char)(type | (last ? 0x80 : 0)));
+        res.push_back((char)(payload.size() >> 16));
+        be16(res, (uint16_t)payload.size());
+        return res + payload;
+    }
+
+    std::string streamInfo(uint64_t totalSamples) {
+        std::string res;
+        be16(res, BlockSize);
+        be16(res, BlockSize);
+        res.append(3, '\0');
+        res.push_back('\0');
+        be16(res, FrameSize);
+        // sample rate (20 bits), channels - 1 (3), bits per sample - 1 (5), total samples (36)
+        uint64_t packed = ((uint64_t)SampleRate << 44) | ((uint64_t)1 << 41) | ((uint64_t)15 << 36) | totalSamples;
+        be32(res, (uint32_t)(packed >> 32));
+        be32(res, (uint32_t)packed);
+        res.append(16, '\0');
+        return res;
+    }
+
+    // sample, offset from the first frame, samples in frame
+    std::string seekTable(const std::vector<std::pair<uint64_t, uint64_t>>& points) {
+        std::string res;
+        for (auto [sample, offset] : points) {
+            be32(res, (uint32_t)(sample >> 32));
+            be32(res, (uint32_t)sample);
+            be32(res, (uint32_t)(offset >> 32));
+            be32(res, (uint32_t)offset);
+            be16(res, (uint16_t)BlockSize);
+        }
+        return res;
+    }
+
+    uint8_t crc8(const std::string& data) {
+        uint8_t crc = 0;
+        for (char c : data) {
+            crc ^= (uint8_t)c;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+            }
+        }
+        return crc;
+    }
+
+    // frames of fixed blocking strategy: 4096 samples (code 12), 44.1 kHz (code 9), stereo, 16 bits, frame number < 128
+    std::string audio() {
+        std::string res;
+        for (size_t number = 0; number < Frames; ++number) {
+            std::string header = {(char)0xff, (char)0xf8, (char)0xc9, (char)0x18, (char)number};
+            header.push_back((char)crc8(header));
+            res += header + std::string(FrameSize - header.size(), '\0');
+        }
+        return res;
+    }
+
+    void streamInfoAndDuration() {
+        std::string file = "fLaC" + block(0, streamInfo(Frames * BlockSize), true) + audio();
+        auto src = memory(file);
+        tag::flac::FlacTagParser parser(src);
+        auto info = parser.StreamInfo();
+        CHECK(info.sampleRate == SampleRate);
+        CHECK(info.totalSamples == Frames * BlockSize);
+        CHECK(info.maximumFrameSizeInBytes == FrameSize);
+        CHECK(parser.durationMs() == Frames * BlockSize / SampleRate * 1000);
+        // no SEEKTABLE and no scan - no points
+        CHECK(parser.seekIndex().empty());
+    }
+
+    void seekTableIndex() {
+        // placeholder points (sample 0xffffffffffffffff) are at the end of table
+        std::string table = seekTable({{0, 0}, {10 * BlockSize, 10 * FrameSize}, {50 * BlockSize, 50 * FrameSize}, {~0ull, 0}, {~0ull, 0}});
+        std::string metadata = "fLaC" + block(0, streamInfo(Frames * BlockSize), false) + block(3, table, false) + block(1, std::string(100, '\0'), true);
+        auto src = memory(metadata + audio());
+        tag::flac::FlacTagParser parser(src);
+        seek::Index index = parser.seekIndex();
+        CHECK(index.size() == 3);
+        CHECK(index.sampleRate() == SampleRate);
+        if (index.size() == 3) {
+            CHECK(index.points()[1].sample == 10 * BlockSize);
+            // offsets in table are relative to the first frame
+            CHECK(index.points()[1].offset == metadata.size() + 10 * FrameSize);
+        }
+        // 2 s is between second (0.93 s) and third (4.64 s) point
+        auto point = index.find(2000);
+        CHECK(point && (point->sample == 10 * BlockSize));
+        point = index.find(5000);
+        CHECK(point && (point->sample == 50 * BlockSize));
+    }
+
+    // without SEEKTABLE: frames, found at evenly spaced offsets by sync code and CRC of header
+    void scanIndex() {
+        std::string metadata = "fLaC" + block(0, streamInfo(Frames * BlockSize), true);
+        // parser shares the source - scan reads it after construction
+        tag::flac::FlacTagParser parser(memory(metadata + audio()));
+        seek::Index index = parser.seekIndex(true, 10);
+        CHECK(index.size() == 10);
+        for (size_t i = 0; i < index.size(); ++i) {
+            CHECK(index.points()[i].sample == i * 10 * BlockSize);
+            CHECK(index.points()[i].offset == metadata.size() + i * 10 * FrameSize);
+        }
+    }
+
+    // ID3v2 tag before FLAC stream is skipped
+    void id3v2Prefix() {
+        std::string id3 = tags::id3v2(tags::textFrame("TIT2", "Prepended"));
+        std::string metadata = "fLaC" + block(0, streamInfo(Frames * BlockSize), true);
+        tag::flac::FlacTagParser parser(memory(id3 + metadata + audio()));
+        CHECK(parser.StreamInfo().totalSamples == Frames * BlockSize);
+        CHECK(parser.durationMs() == Frames * BlockSize / SampleRate * 1000);
+        seek::Index index = parser.seekIndex(true, 10);
+        CHECK(index.size() == 10);
+        CHECK(!index.empty() && (index.points()[0].offset == id3.size() + metadata.size()));
+    }
+
+}
+
+int main() {
+    streamInfoAndDuration();
+    seekTableIndex();
+    scanIndex();
+    id3v2Prefix();
+    return check::result();
+}
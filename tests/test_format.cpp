@@ -0,0 +1,65 @@
+#include "check.hpp"
+#include "fixtures.hpp"
+#include "Format.hpp"
+
+using namespace fixtures;
+using tag::Format;
+
+namespace {
+
+    Format sniff(const std::string& data) {
+        return tag::sniffFormat((const uint8_t*)data.data(), data.size());
+    }
+
+    const std::string Id3 = tags::id3v2(tags::textFrame("TIT2", "Title"));
+    const std::string Wav = "RIFF" + std::string(4, '\0') + "WAVEfmt ";
+
+    void magic() {
+        CHECK(sniff("fLaC" + std::string(100, '\0')) == Format::Flac);
+        CHECK(sniff(Wav) == Format::Wav);
+        CHECK(sniff(mp3::frame(9)) == Format::Mp3);
+        // mp3 parser skips zero padding before the first frame
+        CHECK(sniff(std::string(100, '\0') + mp3::frame(9)) == Format::Mp3);
+        CHECK(sniff(Id3 + mp3::frame(9)) == Format::Mp3);
+        CHECK(sniff("RIFF" + std::string(4, '\0') + "AVI ") == Format::Unknown);
+        CHECK(sniff(std::string(100, 'x')) == Format::Unknown);
+        CHECK(sniff("") == Format::Unknown);
+    }
+
+    // ID3v2 tag prepended to other formats
+    void afterId3v2() {
+        CHECK(sniff(Id3 + "fLaC" + std::string(100, '\0')) == Format::Flac);
+        CHECK(sniff(Id3 + Wav) == Format::Wav);
+        // footer (flag 0x10) is skipped too
+        std::string withFooter = tags::id3v2(tags::textFrame("TIT2", "Title"), true);
+        CHECK(tag::id3v2Size((const uint8_t*)withFooter.data(), withFooter.size()) == withFooter.size());
+        CHECK(sniff(withFooter + "fLaC") == Format::Flac);
+        CHECK(sniff(withFooter + Wav) == Format::Wav);
+        // junk after tag is left to mp3 parser
+        CHECK(sniff(Id3 + std::string(100, 'x')) == Format::Mp3);
+        // tag ends beyond head - nothing to tell but the tag
+        CHECK(sniff(Id3.substr(0, Id3.size() - 1)) == Format::Mp3);
+        CHECK(sniff(Id3) == Format::Mp3);
+    }
+
+    // detectFormat reads magic after tag, which is longer than head
+    void detect() {
+        std::string big = tags::id3v2(tags::textFrame("TXXX", std::string(tag::SniffSize * 2, 'x')));
+        auto src = memory(big + "fLaC" + std::string(100, '\0'));
+        CHECK(tag::detectFormat(*src, "song.mp3") == Format::Flac);
+        src = memory(big + mp3::frame(9));
+        CHECK(tag::detectFormat(*src, "song.flac") == Format::Mp3);
+        // extension only for unknown content
+        src = memory(std::string(100, 'x'));
+        CHECK(tag::detectFormat(*src, "song.FLAC") == Format::Flac);
+        CHECK(tag::detectFormat(*src, "song.txt") == Format::Unknown);
+    }
+
+}
+
+int main() {
+    magic();
+    afterId3v2();
+    detect();
+    return check::result();
+}
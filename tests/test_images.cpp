@@ -0,0 +1,132 @@
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "check.hpp"
+#include "fixtures.hpp"
+#include "ImageStore.hpp"
+#include "ID3V2Parser.hpp"
+
+using namespace fixtures;
+
+namespace {
+
+    tag::BinaryData::Data picture(size_t size, uint8_t fill) {
+        tag::BinaryData::Data res{std::shared_ptr<uint8_t[]>(new uint8_t[size]), size};
+        memset(res.first.get(), fill, size);
+        return res;
+    }
+
+    uint64_t hash(std::string_view str, uint64_t seed = 0) {
+        return tag::ImageStore::hash((const uint8_t*)str.data(), str.size(), seed);
+    }
+
+    // reference values of XXH64: short input, input with 32 byte stripes and seed
+    void xxh64() {
+        CHECK(hash("") == 0xef46db3751d8e999);
+        CHECK(hash("abc") == 0x44bc2cf5ad770999);
+        CHECK(hash("Nobody inspects the spammish repetition") == 0xfbcea83c8a378bf1);
+        CHECK(hash("abc", 1) == 0xbea9ca8199328908);
+        uint8_t bytes[100];
+        for (size_t i = 0; i < sizeof(bytes); ++i) {
+            bytes[i] = (uint8_t)i;
+        }
+        CHECK(tag::ImageStore::hash(bytes, sizeof(bytes)) == 0x6ac1e58032166597);
+    }
+
+    void dedup() {
+        tag::ImageStore store(1000);
+        auto a = picture(300, 1);
+        auto b = picture(300, 1);
+        auto first = store.intern(a);
+        auto second = store.intern(b);
+        // copied into store, then the same copy is returned
+        CHECK(first.first != a.first);
+        CHECK(first.first == second.first);
+        CHECK(second.second == 300);
+        auto other = store.intern(picture(300, 2));
+        CHECK(other.first != first.first);
+        auto stats = store.stats();
+        CHECK(stats.lookups == 3);
+        CHECK(stats.hits == 1);
+        CHECK(stats.images == 2);
+        CHECK(stats.bytesStored == 600);
+        CHECK(stats.bytesReturned == 900);
+        // empty pictures are not stored
+        CHECK(!store.intern({nullptr, 0}).first);
+        store.clear();
+        CHECK(store.stats().images == 0);
+    }
+
+    void eviction() {
+        tag::ImageStore store(1000);
+        auto first = store.intern(picture(400, 1));
+        auto second = store.intern(picture(400, 2));
+        // first is used again - second is the least recently used one now
+        CHECK(store.intern(picture(400, 1)).first == first.first);
+        store.intern(picture(400, 3));
+        auto stats = store.stats();
+        CHECK(stats.evictions == 1);
+        CHECK(stats.images == 2);
+        CHECK(stats.bytesStored == 800);
+        CHECK(store.intern(picture(400, 1)).first == first.first);
+        CHECK(store.intern(picture(400, 2)).first != second.first);
+        // evicted picture stays valid for its holder
+        CHECK(second.first[399] == 2);
+        // bigger than capacity - returned as is, not stored
+        auto big = picture(2000, 4);
+        CHECK(store.intern(big).first == big.first);
+        CHECK(store.stats().bytesStored <= 1000);
+    }
+
+    void threads() {
+        tag::ImageStore store(1000);
+        std::vector<std::thread> workers;
+        std::vector<tag::BinaryData::Data> results(8);
+        for (size_t i = 0; i < results.size(); ++i) {
+            workers.emplace_back([&, i]() { results[i] = store.intern(picture(100, 7)); });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        for (const auto& result : results) {
+            CHECK(result.first == results[0].first);
+        }
+        CHECK(store.stats().images == 1);
+    }
+
+    // same cover in two files: parsers, sharing store, return the same bytes
+    void parsers() {
+        std::string image(5000, 'p');
+        std::string payload = std::string(1, '\0') + "image/png" + std::string(1, '\0') + "\x03" + std::string(1, '\0') + image;
+        std::string apic = "APIC";
+        syncsafe32(apic, (uint32_t)payload.size());
+        apic.append(2, '\0');
+        std::string file = tags::id3v2(apic + payload) + mp3::cbr(9, 10);
+        tag::ImageStore store;
+        tag::ExtractorConfig config;
+        config.imageStore = &store;
+        tag::id3v2::ID3V2Parser first(memory(file), config);
+        tag::id3v2::ID3V2Parser second(memory(file), config);
+        auto a = first.image();
+        auto b = second.image();
+        CHECK((a.size() == 1) && (b.size() == 1));
+        if ((a.size() == 1) && (b.size() == 1)) {
+            CHECK(a[0].type == tag::user::ImageType::FrontCover);
+            CHECK(a[0].mimeType == "image/png");
+            CHECK(a[0].data.second == image.size());
+            CHECK(!memcmp(a[0].data.first.get(), image.data(), image.size()));
+            CHECK(a[0].data.first == b[0].data.first);
+        }
+        CHECK(store.stats().hits == 1);
+    }
+
+}
+
+int main() {
+    xxh64();
+    dedup();
+    eviction();
+    threads();
+    parsers();
+    return check::result();
+}
@@ -0,0 +1,238 @@
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include "check.hpp"
+#include "MetaCache.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+    fs::path dir;
+
+    void writeFile(const fs::path& path, const std::string& data, std::ios::openmode mode = std::ios::trunc) {
+        std::ofstream ofs(path, std::ios::binary | mode);
+        ofs.write(data.data(), data.size());
+    }
+
+    cache::Entry full(uint64_t ino) {
+        cache::Entry entry;
+        entry.key = {1, ino, 1000 + ino, 1700000000123456789};
+        entry.groups = cache::Entry::Textual | cache::Entry::Duration | cache::Entry::Images | cache::Entry::Frames;
+        entry.title = "Title " + std::to_string(ino);
+        entry.album = "Album";
+        entry.artist = "Артист";
+        entry.year = "2001";
+        entry.trackNumber = "3/12";
+        entry.comment = std::string("with\0zero", 9);
+        entry.durationMs = 123456;
+        entry.images = {{3, "image/jpeg", 5000, 1234}, {4, "image/png", 10, 0}};
+        entry.frames = {"TIT2", "TALB", "APIC"};
+        return entry;
+    }
+
+    bool same(const cache::Entry& a, const cache::Entry& b) {
+        bool images = a.images.size() == b.images.size();
+        for (size_t i = 0; images && (i < a.images.size()); ++i) {
+            images = (a.images[i].type == b.images[i].type) && (a.images[i].mimeType == b.images[i].mimeType) &&
+                     (a.images[i].size == b.images[i].size) && (a.images[i].offset == b.images[i].offset);
+        }
+        return images && (a.key == b.key) && (a.groups == b.groups) && (a.title == b.title) && (a.album == b.album) &&
+               (a.artist == b.artist) && (a.year == b.year) && (a.trackNumber == b.trackNumber) && (a.comment == b.comment) &&
+               (a.durationMs == b.durationMs) && (a.frames == b.frames);
+    }
+
+    void roundTrip() {
+        fs::path path = dir / "roundtrip.cache";
+        {
+            cache::MetaCache cache(path);
+            CHECK(cache.size() == 0);
+            for (uint64_t ino = 1; ino <= 50; ++ino) {
+                cache.put(full(ino));
+            }
+            cache::Entry failed;
+            failed.key = {1, 100, 0, 0};
+            failed.groups = cache::Entry::Failed;
+            cache.put(failed);
+        }
+        cache::MetaCache cache(path);
+        CHECK(cache.size() == 51);
+        for (uint64_t ino = 1; ino <= 50; ++ino) {
+            auto entry = cache.find(full(ino).key);
+            CHECK(entry && same(*entry, full(ino)));
+        }
+        auto failed = cache.find({1, 100, 0, 0});
+        CHECK(failed && failed->has(cache::Entry::Failed) && !failed->has(cache::Entry::Textual));
+        // changed file, other device and unknown file
+        cache::FileKey key = full(1).key;
+        key.mtimeNs += 1;
+        CHECK(!cache.find(key));
+        key = full(1).key;
+        key.size += 1;
+        CHECK(!cache.find(key));
+        key = full(1).key;
+        key.dev = 2;
+        CHECK(!cache.find(key));
+        CHECK(!cache.find({1, 999, 0, 0}));
+    }
+
+    void merge() {
+        fs::path path = dir / "merge.cache";
+        cache::Entry textual = full(1);
+        textual.groups = cache::Entry::Textual;
+        textual.durationMs = 0;
+        cache::Entry duration;
+        duration.key = textual.key;
+        duration.groups = cache::Entry::Duration;
+        duration.durationMs = 777;
+        {
+            cache::MetaCache cache(path);
+            cache.put(textual);
+            cache.put(duration);
+        }
+        {
+            cache::MetaCache cache(path);
+            auto entry = cache.find(textual.key);
+            CHECK(entry && entry->has(cache::Entry::Textual | cache::Entry::Duration));
+            CHECK(entry && (entry->title == textual.title) && (entry->durationMs == 777));
+            // new version of the file replaces all groups
+            cache::Entry changed = duration;
+            changed.key.mtimeNs += 1;
+            cache.put(changed);
+            CHECK(!cache.find(textual.key));
+        }
+        cache::MetaCache cache(path);
+        cache::FileKey key = textual.key;
+        key.mtimeNs += 1;
+        auto entry = cache.find(key);
+        CHECK(entry && !entry->has(cache::Entry::Textual) && (entry->durationMs == 777));
+        CHECK(cache.size() == 1);
+    }
+
+    // crash in the middle of append: complete records are kept, torn one is dropped and log is rewritten
+    void tornLog() {
+        fs::path path = dir / "torn.cache";
+        {
+            cache::MetaCache cache(path);
+            cache.put(full(1));
+            cache.put(full(2));
+        }
+        uintmax_t size = fs::file_size(path);
+        // half of a record
+        writeFile(path, std::string("\x40\x00\x00\x00\x12\x34", 6), std::ios::app);
+        {
+            cache::MetaCache cache(path);
+            CHECK(cache.size() == 2);
+            CHECK(cache.find(full(2).key).has_value());
+        }
+        CHECK(fs::file_size(path) == size);
+
+        // corrupted payload of the last record - it is dropped by checksum
+        std::string data;
+        {
+            std::ifstream ifs(path, std::ios::binary);
+            data.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+        }
+        data[data.size() - 3] ^= 0x55;
+        writeFile(path, data);
+        cache::MetaCache cache(path);
+        CHECK(cache.size() == 1);
+        CHECK(fs::file_size(path) < size);
+    }
+
+    void foreignFile() {
+        fs::path path = dir / "foreign.cache";
+        writeFile(path, "not a cache at all");
+        {
+            cache::MetaCache cache(path);
+            CHECK(cache.size() == 0);
+            cache.put(full(1));
+        }
+        cache::MetaCache cache(path);
+        CHECK(cache.find(full(1).key).has_value());
+    }
+
+    // every put appends a record: log is compacted, when dead records pile up (more than live ones and some slack)
+    void compaction() {
+        fs::path path = dir / "compaction.cache";
+        uintmax_t compacted = 0;
+        {
+            cache::MetaCache cache(path);
+            cache.put(full(1));
+            cache.compact();
+            compacted = fs::file_size(path);
+            for (int i = 0; i < 5000; ++i) {
+                cache::Entry duration;
+                duration.key = full(1).key;
+                duration.groups = cache::Entry::Duration;
+                duration.durationMs = i;
+                cache.put(duration);
+                cache.flush();
+            }
+            CHECK(fs::file_size(path) < 2000 * compacted);
+            cache.compact();
+            CHECK(fs::file_size(path) == compacted);
+            CHECK(!fs::exists(path.string() + ".tmp"));
+        }
+        cache::MetaCache cache(path);
+        auto entry = cache.find(full(1).key);
+        CHECK(entry && (entry->durationMs == 4999) && (entry->title == full(1).title));
+    }
+
+    // failed append (log path is taken by directory) does not throw from put; entries are written by next flush
+    void writeError() {
+        fs::path path = dir / "error.cache";
+        {
+            cache::MetaCache cache(path);
+            fs::remove(path);
+            fs::create_directory(path);
+            bool thrown = false;
+            try {
+                // more than one flush threshold of records
+                for (uint64_t ino = 1; ino <= 10000; ++ino) {
+                    cache.put(full(ino));
+                }
+            }
+            catch (...) {
+                thrown = true;
+            }
+            CHECK(!thrown);
+            CHECK(cache.size() == 10000);
+            fs::remove(path);
+            cache.flush();
+        }
+        cache::MetaCache cache(path);
+        CHECK(cache.size() == 10000);
+        auto entry = cache.find(full(1).key);
+        CHECK(entry && same(*entry, full(1)));
+    }
+
+    void statFile() {
+        fs::path path = dir / "file.bin";
+        writeFile(path, std::string(4321, 'x'));
+        auto key = cache::statFile(path);
+        CHECK(key && (key->size == 4321) && key->ino);
+        CHECK(key && (cache::statFile(path) == key));
+        writeFile(path, std::string(10, 'x'), std::ios::app);
+        auto changed = cache::statFile(path);
+        CHECK(changed && !(changed == key));
+        CHECK(!cache::statFile(dir));
+        CHECK(!cache::statFile(dir / "missing"));
+    }
+
+}
+
+int main() {
+    dir = fs::temp_directory_path() / ("metacache_test_" + std::to_string(getpid()));
+    fs::create_directories(dir);
+    roundTrip();
+    merge();
+    tornLog();
+    foreignFile();
+    compaction();
+    writeError();
+    statFile();
+    fs::remove_all(dir);
+    return check::result();
+}
@@ -0,0 +1,128 @@
+#include "check.hpp"
+#include "fixtures.hpp"
+#include "Mp3FrameParser.hpp"
+
+namespace {
+
+    // counts bytes, which parser asks for
+    class CountingSource : public io::ByteSource {
+    public:
+        CountingSource(const std::string& data) : src(fixtures::memory(data)) { _size = src->size(); }
+        size_t readAt(uint64_t offset, void* dst, size_t n) override { bytes += n; return src->readAt(offset, dst, n); }
+        Block block(uint64_t offset, size_t n) override { bytes += n; return src->block(offset, n); }
+        size_t peekAt(uint64_t offset, void* dst, size_t n) override { bytes += n; return src->peekAt(offset, dst, n); }
+        size_t bytes = 0;
+    private:
+        std::shared_ptr<io::ByteSource> src;
+    };
+
+    uint64_t duration(const std::string& data) {
+        auto src = fixtures::memory(data);
+        return mp3::getMp3FileDuration(*src);
+    }
+
+    bool near(uint64_t a, uint64_t b, uint64_t tolerance) {
+        return (a > b ? a - b : b - a) <= tolerance;
+    }
+
+    void frameTables() {
+        // 128 kbps: 144 * 128000 / 44100 = 417.96
+        CHECK(mp3::Mp3FrameParser::frameLength(0xfffb9000) == 417);
+        CHECK(mp3::Mp3FrameParser::frameLength(0xfffb9200) == 418);
+        CHECK(mp3::Mp3FrameParser::frameSamples(0xfffb9000) == 1152);
+        CHECK(mp3::Mp3FrameParser::frameSampleRate(0xfffb9000) == 44100);
+        // MPEG2 Layer III, 22050 Hz, 64 kbps: 72 * 64000 / 22050 = 208.98
+        CHECK(mp3::Mp3FrameParser::frameLength(0xfff38000) == 208);
+        CHECK(mp3::Mp3FrameParser::frameSamples(0xfff38000) == 576);
+        // no sync, free format, bad bitrate, reserved sampling rate
+        CHECK(mp3::Mp3FrameParser::frameLength(0x7ffb9000) == 0);
+        CHECK(mp3::Mp3FrameParser::frameLength(0xfffb0000) == 0);
+        CHECK(mp3::Mp3FrameParser::frameLength(0xfffbf000) == 0);
+        CHECK(mp3::Mp3FrameParser::frameLength(0xfffb9c00) == 0);
+    }
+
+    void xing() {
+        uint8_t toc[100];
+        for (size_t i = 0; i < 100; ++i) {
+            toc[i] = (uint8_t)(i * 256 / 100);
+        }
+        // frame count of the header is trusted: stream is not walked
+        std::string data = fixtures::mp3::xingFrame("Xing", 5000, 123456, toc) + fixtures::mp3::vbr({9, 11, 5}, 30);
+        auto src = fixtures::memory(data);
+        mp3::Mp3FrameParser parser(*src);
+        const mp3::VbrHeader& header = parser.vbrHeader();
+        CHECK(header.type == mp3::VbrHeader::Type::Xing);
+        CHECK(header.frames == 5000);
+        CHECK(header.bytes == 123456);
+        CHECK(header.hasToc);
+        CHECK(header.toc[50] == 128);
+        CHECK(parser.isVBR());
+        CHECK(parser.vbrHeaderDurationMs() == fixtures::mp3::durationMs(5000));
+        CHECK(duration(data) == fixtures::mp3::durationMs(5000));
+    }
+
+    void info() {
+        std::string data = fixtures::mp3::xingFrame("Info", 100, 100 * 417) + fixtures::mp3::cbr(9, 100);
+        auto src = fixtures::memory(data);
+        mp3::Mp3FrameParser parser(*src);
+        CHECK(parser.vbrHeader().type == mp3::VbrHeader::Type::Info);
+        CHECK(!parser.vbrHeader().hasToc);
+        CHECK(!parser.isVBR());
+        CHECK(duration(data) == fixtures::mp3::durationMs(100));
+    }
+
+    void vbri() {
+        std::string data = fixtures::mp3::vbriFrame(777, 4242) + fixtures::mp3::vbr({9, 11}, 10);
+        auto src = fixtures::memory(data);
+        mp3::Mp3FrameParser parser(*src);
+        CHECK(parser.vbrHeader().type == mp3::VbrHeader::Type::VBRI);
+        CHECK(parser.vbrHeader().frames == 777);
+        CHECK(parser.vbrHeader().bytes == 4242);
+        CHECK(parser.isVBR());
+        CHECK(duration(data) == fixtures::mp3::durationMs(777));
+    }
+
+    // no VBR header: bitrate is sampled over the stream, VBR stream is walked
+    void headerlessVbr() {
+        CHECK(near(duration(fixtures::mp3::vbr({9, 11, 5, 14}, 400)), fixtures::mp3::durationMs(400), 1));
+        // bitrate changes only in the second half - one sample point is enough to see it
+        std::string data = fixtures::mp3::cbr(9, 200) + fixtures::mp3::vbr({5}, 200);
+        CHECK(near(duration(data), fixtures::mp3::durationMs(400), 1));
+    }
+
+    void headerlessCbr() {
+        // duration from size and bitrate, off by less than a frame
+        CHECK(near(duration(fixtures::mp3::cbr(9, 1000)), fixtures::mp3::durationMs(1000), 26));
+        CHECK(near(duration(fixtures::mp3::cbr(14, 1000)), fixtures::mp3::durationMs(1000), 26));
+        // bitrate samples read about two frames each, not blocks
+        CountingSource src(fixtures::mp3::cbr(9, 1000));
+        CHECK(near(mp3::getMp3FileDuration(src), fixtures::mp3::durationMs(1000), 26));
+        CHECK(src.bytes < 16 * 1024);
+    }
+
+    void notMp3() {
+        bool noFrame = false;
+        try {
+            duration(std::string(1000, '\0'));
+        }
+        catch (const mp3::Mp3FrameParser::NoFrameException&) {
+            noFrame = true;
+        }
+        CHECK(noFrame);
+        CHECK(duration("") == 0);
+        // stream, cut after the Xing frame
+        CHECK(duration(fixtures::mp3::xingFrame("Xing", 10, 0)) == fixtures::mp3::durationMs(10));
+    }
+
+}
+
+int main() {
+    frameTables();
+    xing();
+    info();
+    vbri();
+    headerlessVbr();
+    headerlessCbr();
+    notMp3();
+    return check::result();
+}
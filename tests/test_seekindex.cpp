@@ -0,0 +1,180 @@
+#include <set>
+#include <string>
+#include "check.hpp"
+#include "fixtures.hpp"
+#include "SeekIndex.hpp"
+#include "Mp3FrameParser.hpp"
+#include "ID3V2Parser.hpp"
+
+namespace {
+
+    bool same(const seek::Index& a, const seek::Index& b) {
+        if ((a.sampleRate() != b.sampleRate()) || (a.size() != b.size())) {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); ++i) {
+            if ((a.points()[i].sample != b.points()[i].sample) || (a.points()[i].offset != b.points()[i].offset)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // offsets of frame headers in stream
+    std::set<uint64_t> frameOffsets(const std::string& data, uint64_t begin) {
+        std::set<uint64_t> res;
+        for (uint64_t offset = begin; (offset + 4) <= data.size();) {
+            uint32_t header = ((uint32_t)(uint8_t)data[offset] << 24) | ((uint32_t)(uint8_t)data[offset + 1] << 16) |
+                              ((uint32_t)(uint8_t)data[offset + 2] << 8) | (uint32_t)(uint8_t)data[offset + 3];
+            uint32_t length = mp3::Mp3FrameParser::frameLength(header);
+            if (!length) {
+                break;
+            }
+            res.insert(offset);
+            offset += length;
+        }
+        return res;
+    }
+
+    void lookup() {
+        // unsorted, with duplicate and with point, which goes back in file
+        seek::Index index(1000, {{2000, 300}, {0, 100}, {1000, 200}, {1000, 250}, {3000, 250}});
+        CHECK(index.size() == 3);
+        CHECK(index.findSample(0)->offset == 100);
+        CHECK(index.findSample(999)->offset == 100);
+        CHECK(index.findSample(1000)->offset == 200);
+        CHECK(index.find(2500)->offset == 300);
+        CHECK(index.find(100000)->sample == 2000);
+        CHECK(!seek::Index(1000, {{500, 10}}).find(0));
+        CHECK(!seek::Index().find(0));
+        CHECK(index.msAt(44100) == 44100);
+        CHECK(seek::Index().msAt(1) == 0);
+    }
+
+    void roundTrip() {
+        std::vector<seek::Point> points;
+        for (uint64_t i = 0; i < 1000; ++i) {
+            points.push_back({i * 44100, 4096 + i * 16000 + (i % 7) * 417});
+        }
+        // big values take more varint bytes
+        points.push_back({1ull << 40, 1ull << 45});
+        points.push_back({UINT64_MAX - 1, UINT64_MAX - 1});
+        seek::Index index(44100, points);
+        std::string data = index.serialize();
+        auto restored = seek::Index::deserialize(data);
+        CHECK(restored && same(*restored, index));
+        // differences of one-second points are small: 3-5 bytes per point
+        CHECK(data.size() < index.size() * 6);
+        // empty index
+        auto empty = seek::Index::deserialize(seek::Index().serialize());
+        CHECK(empty && empty->empty() && (empty->sampleRate() == 0));
+    }
+
+    void invalidData() {
+        std::string data = seek::Index(48000, {{0, 10}, {48000, 5000}, {96000, 12000}}).serialize();
+        CHECK(seek::Index::deserialize(data).has_value());
+        CHECK(!seek::Index::deserialize(""));
+        // every truncation is rejected
+        for (size_t n = 0; n < data.size(); ++n) {
+            CHECK(!seek::Index::deserialize(std::string_view(data).substr(0, n)));
+        }
+        // trailing bytes
+        CHECK(!seek::Index::deserialize(data + '\0'));
+        // other version
+        std::string version = data;
+        version[0] = 2;
+        CHECK(!seek::Index::deserialize(version));
+        // number longer than 64 bits
+        std::string overlong(1, (char)1);
+        overlong.append(10, (char)0x80);
+        overlong.push_back(1);
+        CHECK(!seek::Index::deserialize(overlong));
+        // sample rate out of 32 bits
+        std::string rate(1, (char)1);
+        rate += std::string("\x80\x80\x80\x80\x10", 5);
+        rate.push_back(0);
+        CHECK(!seek::Index::deserialize(rate));
+        // count, which data can't hold - nothing is allocated for it
+        std::string count = "\x01\x80\x01\xff\xff\xff\xff\x0f";
+        CHECK(!seek::Index::deserialize(count));
+    }
+
+    // Xing TOC: 100 points, moved to frame headers; position is counted from the frame with header
+    void xingToc() {
+        std::string audio = fixtures::mp3::vbr({9, 11, 5, 14}, 1000);
+        std::string first = fixtures::mp3::xingFrame("Xing", 1000, 0);
+        uint8_t toc[100];
+        for (size_t i = 0; i < 100; ++i) {
+            toc[i] = (uint8_t)(i * 256 / 100);
+        }
+        std::string data = fixtures::mp3::xingFrame("Xing", 1000, (uint32_t)(first.size() + audio.size()), toc) + audio;
+        auto src = fixtures::memory(data);
+        seek::Index index;
+        CHECK(mp3::getMp3FileDuration(*src, data.size(), &index) == fixtures::mp3::durationMs(1000));
+        CHECK(index.size() > 90);
+        CHECK(index.sampleRate() == fixtures::mp3::SampleRate);
+        auto frames = frameOffsets(data, first.size());
+        CHECK(!index.empty() && (index.points()[0].offset == first.size()) && (index.points()[0].sample == 0));
+        for (const auto& point : index.points()) {
+            CHECK(frames.count(point.offset));
+        }
+        // half of duration - near the middle of audio
+        auto middle = index.find(fixtures::mp3::durationMs(1000) / 2);
+        CHECK(middle && (middle->offset > data.size() * 45 / 100) && (middle->offset < data.size() * 55 / 100));
+    }
+
+    // no TOC: first frame, which is at least an interval after the previous point
+    void walk() {
+        std::string data = fixtures::mp3::vbr({9, 11, 5, 14}, 1000);
+        auto src = fixtures::memory(data);
+        seek::Index index;
+        uint64_t duration = mp3::getMp3FileDuration(*src, data.size(), &index, 1000);
+        CHECK((duration + 1) >= fixtures::mp3::durationMs(1000));
+        // 1000 frames of 26.1 ms, 39 frames (1.02 s) between points
+        CHECK(index.size() == 26);
+        CHECK(!index.empty() && (index.points()[0].sample == 0) && (index.points()[0].offset == 0));
+        auto frames = frameOffsets(data, 0);
+        for (size_t i = 0; i < index.size(); ++i) {
+            const auto& point = index.points()[i];
+            CHECK(frames.count(point.offset));
+            CHECK(point.sample % fixtures::mp3::Samples == 0);
+            if (i) {
+                uint64_t distance = point.sample - index.points()[i - 1].sample;
+                CHECK((distance >= fixtures::mp3::SampleRate) && (distance < fixtures::mp3::SampleRate + fixtures::mp3::Samples));
+            }
+        }
+        // CBR files are walked for index too
+        data = fixtures::mp3::cbr(9, 500);
+        src = fixtures::memory(data);
+        index = {};
+        mp3::getMp3FileDuration(*src, data.size(), &index, 1000);
+        CHECK(index.size() == 13);
+    }
+
+    // ExtractorConfig::seekIndex: duration and index come from the same pass, and they are the same as separate ones
+    void parser() {
+        std::string data = fixtures::tags::id3v2(fixtures::tags::textFrame("TIT2", "Title")) + fixtures::mp3::vbr({9, 11, 5}, 600);
+        tag::ExtractorConfig config;
+        config.seekIndex = true;
+        tag::id3v2::ID3V2Parser together(fixtures::memory(data), config);
+        tag::id3v2::ID3V2Parser separate(fixtures::memory(data));
+        CHECK(together.durationMs() == separate.durationMs());
+        CHECK(same(together.seekIndex(), separate.seekIndex()));
+        CHECK(!together.seekIndex().empty());
+        // offsets are from the beginning of file - after the ID3v2 tag
+        CHECK(together.seekIndex().points()[0].offset == fixtures::tags::id3v2(fixtures::tags::textFrame("TIT2", "Title")).size());
+        auto restored = seek::Index::deserialize(together.seekIndex().serialize());
+        CHECK(restored && same(*restored, together.seekIndex()));
+    }
+
+}
+
+int main() {
+    lookup();
+    roundTrip();
+    invalidData();
+    xingToc();
+    walk();
+    parser();
+    return check::result();
+}
@@ -0,0 +1,122 @@
+#include "check.hpp"
+#include "fixtures.hpp"
+#include "TailTags.hpp"
+#include "ID3V2Parser.hpp"
+
+using namespace fixtures;
+
+namespace {
+
+    const std::string Audio = mp3::cbr(9, 200);
+
+    void id3v1() {
+        auto src = memory(Audio + tags::id3v1("Title", "Artist", "Album", "1999", "Comment", 7, 17));
+        auto tail = tag::tail::probe(*src);
+        CHECK(tail.id3v1.has_value());
+        if (tail.id3v1) {
+            CHECK(tail.id3v1->title == "Title");
+            CHECK(tail.id3v1->artist == "Artist");
+            CHECK(tail.id3v1->album == "Album");
+            CHECK(tail.id3v1->year == "1999");
+            CHECK(tail.id3v1->comment == "Comment");
+            CHECK(tail.id3v1->track == 7);
+            CHECK(tail.id3v1->genre == 17);
+        }
+        CHECK(!tail.hasApe);
+        CHECK(!tail.id3v2Offset);
+        CHECK(tail.audioEnd == Audio.size());
+
+        // ID3v1.0: comment takes all 30 bytes, trailing spaces are not part of fields
+        std::string comment(30, 'c');
+        src = memory(Audio + tags::id3v1("Padded   ", "", "", "", comment));
+        tail = tag::tail::probe(*src);
+        CHECK(tail.id3v1 && (tail.id3v1->title == "Padded") && (tail.id3v1->comment == comment) && !tail.id3v1->track);
+    }
+
+    void ape() {
+        for (bool withHeader : {true, false}) {
+            std::string tag = tags::ape({{"Title", "APE title"}, {"Artist", "APE artist"}, {"Track", "3/12"}}, withHeader);
+            auto src = memory(Audio + tag + tags::id3v1("v1 title", "", "", "", ""));
+            auto tail = tag::tail::probe(*src);
+            CHECK(tail.hasApe);
+            CHECK(tail.ape.size() == 3);
+            CHECK(tail.apeItem("title") == "APE title");
+            CHECK(tail.apeItem("ARTIST") == "APE artist");
+            CHECK(tail.apeItem("Album").empty());
+            CHECK(tail.id3v1 && (tail.id3v1->title == "v1 title"));
+            CHECK(tail.audioEnd == Audio.size());
+        }
+        // items, which do not fit into probe, are read separately
+        std::string big(tag::tail::ProbeSize + 1000, 'x');
+        auto src = memory(Audio + tags::ape({{"Lyrics", big}, {"Title", "after big item"}}));
+        auto tail = tag::tail::probe(*src);
+        CHECK(tail.hasApe);
+        CHECK(tail.apeData != nullptr);
+        CHECK(tail.apeItem("Lyrics") == big);
+        CHECK(tail.apeItem("Title") == "after big item");
+        CHECK(tail.audioEnd == Audio.size());
+    }
+
+    void id3v2Footer() {
+        std::string id3v2 = tags::id3v2(tags::textFrame("TIT2", "Appended"), true);
+        auto src = memory(Audio + id3v2 + tags::ape({{"Title", "APE"}}) + tags::id3v1("v1", "", "", "", ""));
+        auto tail = tag::tail::probe(*src);
+        CHECK(tail.id3v2Offset && (*tail.id3v2Offset == Audio.size()));
+        CHECK(tail.hasApe && tail.id3v1);
+        CHECK(tail.audioEnd == Audio.size());
+    }
+
+    void broken() {
+        // footer with size beyond the file: tag is not taken, audio is not cut
+        std::string footer = "APETAGEX";
+        le32(footer, 2000);
+        le32(footer, 1u << 30);
+        le32(footer, 1);
+        le32(footer, 0);
+        footer.append(8, '\0');
+        auto src = memory(Audio + footer);
+        auto tail = tag::tail::probe(*src);
+        CHECK(tail.ape.empty());
+        CHECK(tail.audioEnd == Audio.size() + footer.size());
+        // smaller than ID3v1 and empty files
+        src = memory("TAG");
+        CHECK(!tag::tail::probe(*src).id3v1);
+        src = memory("");
+        CHECK(tag::tail::probe(*src).audioEnd == 0);
+    }
+
+    // ID3V2Parser: text getters fall back to APEv2, then to ID3v1; duration does not count tail tags
+    void parserFallbacks() {
+        std::string data = Audio + tags::ape({{"Title", "APE title"}}) + tags::id3v1("v1 title", "v1 artist", "", "2001", "", 5);
+        tag::id3v2::ID3V2Parser parser(memory(data));
+        CHECK(parser.songTitle() == "APE title");
+        CHECK(parser.artist() == "v1 artist");
+        CHECK(parser.year() == "2001");
+        CHECK(parser.trackNumber() == "5");
+        CHECK(parser.durationMs() == Audio.size() * 8000 / 128000);
+
+        tag::ExtractorConfig config;
+        config.tailTags = false;
+        tag::id3v2::ID3V2Parser withoutTail(memory(data), config);
+        CHECK(withoutTail.songTitle().empty());
+        CHECK(!withoutTail.tailTags().id3v1 && !withoutTail.tailTags().hasApe);
+        CHECK(withoutTail.durationMs() > parser.durationMs());
+
+        // front tag is taken first; appended ID3v2 tag is the only one
+        tag::id3v2::ID3V2Parser front(memory(tags::id3v2(tags::textFrame("TIT2", "Front")) + data));
+        CHECK(front.songTitle() == "Front");
+        tag::id3v2::ID3V2Parser appended(memory(Audio + tags::id3v2(tags::textFrame("TIT2", "Appended"), true)));
+        CHECK(appended.songTitle() == "Appended");
+        CHECK(appended.durationMs() == Audio.size() * 8000 / 128000);
+    }
+
+}
+
+int main() {
+    id3v1();
+    ape();
+    id3v2Footer();
+    broken();
+    parserFallbacks();
+    return check::result();
+}
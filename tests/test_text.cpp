@@ -0,0 +1,176 @@
+#include <string>
+#include <random>
+#include <vector>
+#include "check.hpp"
+#include "util.hpp"
+#include "Tag.hpp"
+
+using namespace util;
+
+namespace {
+
+    const TextKernels Sets[] = {TextKernels::Scalar, TextKernels::Sse2, TextKernels::Sse41, TextKernels::Avx2};
+
+    std::string utf16(std::u16string_view str, bool bigEndian) {
+        std::string res;
+        for (char16_t unit : str) {
+            res.push_back((char)(bigEndian ? (unit >> 8) : (unit & 0xff)));
+            res.push_back((char)(bigEndian ? (unit & 0xff) : (unit >> 8)));
+        }
+        return res;
+    }
+
+    // results of every function for one input - they must not depend on kernel set
+    struct Results {
+        bool valid;
+        bool ascii;
+        std::string latin1;
+        std::string utf16le;
+        std::string utf16be;
+        std::string replaced;
+        bool operator==(const Results&) const = default;
+    };
+
+    Results run(const std::string& str) {
+        size_t even = str.size() & ~(size_t)1;
+        return {isValidUtf8(str.data(), str.size()), isAscii(str.data(), str.size()), asciiToUtf8(str.data(), str.size()),
+                utf16ToUtf8(str.data(), even, false), utf16ToUtf8(str.data(), even, true), validUtf8(str.data(), str.size())};
+    }
+
+    void knownAnswers() {
+        // A, e acute, euro sign, U+1F600 (surrogate pair)
+        std::u16string text = u"Aé€\U0001F600";
+        std::string utf8 = "A\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80";
+        for (TextKernels set : Sets) {
+            if (!useTextKernels(set)) {
+                continue;
+            }
+            for (bool bigEndian : {false, true}) {
+                std::string data = utf16(text, bigEndian);
+                CHECK(utf16ToUtf8(data.data(), data.size(), bigEndian) == utf8);
+                // ASCII run, long enough for vectors, then the same text
+                std::string prefix(100, 'x');
+                std::string longData = utf16(std::u16string(100, u'x') + text, bigEndian);
+                CHECK(utf16ToUtf8(longData.data(), longData.size(), bigEndian) == prefix + utf8);
+                // lone surrogate
+                std::string broken = utf16(u"abc\xd800", bigEndian);
+                CHECK(utf16ToUtf8(broken.data(), broken.size(), bigEndian).empty());
+            }
+            CHECK(asciiToUtf8("caf\xe9", 4) == "caf\xc3\xa9");
+            CHECK(isValidUtf8(utf8.data(), utf8.size()));
+            CHECK(!isAscii(utf8.data(), utf8.size()));
+            CHECK(validUtf8("a\xff" "b", 3) == "a\xef\xbf\xbd" "b");
+        }
+        useTextKernels(TextKernels::Best);
+    }
+
+    // invalid sequences at every position of a vector, so each one is seen by vector code and by tail code
+    void invalidAtEveryOffset() {
+        const std::string invalid[] = {
+            "\xc0\xaf",             // overlong 2 bytes
+            "\xe0\x80\xaf",         // overlong 3 bytes
+            "\xed\xa0\x80",         // surrogate
+            "\xf4\x90\x80\x80",     // above U+10FFFF
+            "\x80",                 // continuation without lead
+            "\xe2\x82",             // truncated
+            "\xf8\x88\x80\x80\x80"  // 5 bytes
+        };
+        const std::string valid = "\xf0\x9f\x98\x80";
+        for (TextKernels set : Sets) {
+            if (!useTextKernels(set)) {
+                continue;
+            }
+            for (size_t offset = 0; offset < 70; ++offset) {
+                std::string str(offset, 'a');
+                CHECK(isValidUtf8((str + valid + std::string(40, 'b')).data(), offset + valid.size() + 40));
+                for (const auto& seq : invalid) {
+                    std::string bad = str + seq + std::string(40, 'b');
+                    CHECK(!isValidUtf8(bad.data(), bad.size()));
+                    // at the very end too
+                    std::string badEnd = str + seq;
+                    CHECK(!isValidUtf8(badEnd.data(), badEnd.size()));
+                }
+            }
+        }
+        useTextKernels(TextKernels::Best);
+    }
+
+    void vectorSetsMatchScalar() {
+        std::mt19937 rng(20240611);
+        const std::string pieces[] = {"\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80", "\xed\xa0\x80", "\xc0\xaf", "\xff", "\x80"};
+        size_t compared = 0;
+        for (size_t iteration = 0; iteration < 3000; ++iteration) {
+            size_t n = rng() % 300;
+            std::string str;
+            // mostly ASCII with some multibyte (valid and not) characters - like real tags
+            while (str.size() < n) {
+                if (rng() % 8) {
+                    str.push_back((char)(rng() % 0x80));
+                }
+                else if (iteration % 3) {
+                    str += pieces[rng() % 3];
+                }
+                else {
+                    str += pieces[rng() % std::size(pieces)];
+                }
+            }
+            if (iteration % 5 == 0) {
+                // random bytes
+                for (auto& c : str) {
+                    c = (char)rng();
+                }
+            }
+            useTextKernels(TextKernels::Scalar);
+            Results reference = run(str);
+            for (TextKernels set : Sets) {
+                if (useTextKernels(set)) {
+                    CHECK(run(str) == reference);
+                    ++compared;
+                }
+            }
+        }
+        CHECK(compared > 3000);
+        useTextKernels(TextKernels::Best);
+    }
+
+    // lengths in frame are not trusted: owned and view readers stop at the end of frame
+    void truncatedFrame() {
+        // vendor string (length 1000, 6 bytes present)
+        std::string frame = std::string("\xe8\x03\x00\x00", 4) + "vendor";
+        auto read = [](auto reader, std::string& bytes) {
+            tag::DataBlock block((uint8_t*)bytes.data(), bytes.size());
+            block.encoding = tag::Encoding::Utf8;
+            return reader.read(block);
+        };
+        using Owned = tag::FrameReader<tag::SizeOfData<tag::LittleEndian>, tag::EncodedStr>;
+        using View = tag::FrameReader<tag::SizeOfData<tag::LittleEndian>, tag::EncodedStrView>;
+        CHECK(std::get<1>(read(Owned(), frame)) == "vendor");
+        CHECK(std::get<1>(read(View(), frame)) == "vendor");
+        // list of 1000 comments: one complete, one truncated, then no room for length
+        std::string list = std::string("\x00\x00\x00\x00\xe8\x03\x00\x00\x05\x00\x00\x00", 12) + "A=abc" +
+                           std::string("\x40\x00\x00\x00", 4) + "B=x" + "\x01";
+        using OwnedList = tag::FrameReader<tag::SizeOfData<tag::LittleEndian>, tag::EncodedStr, tag::SizeOfData<tag::LittleEndian>,
+                                           tag::ListOfEncodedStrings<tag::LittleEndian>>;
+        using ViewList = tag::FrameReader<tag::SizeOfData<tag::LittleEndian>, tag::EncodedStrView, tag::SizeOfData<tag::LittleEndian>,
+                                          tag::ListOfEncodedStringsView<tag::LittleEndian>>;
+        auto owned = std::get<3>(read(OwnedList(), list));
+        auto view = std::get<3>(read(ViewList(), list));
+        CHECK(owned.size() == 2);
+        CHECK(view.size() == 2);
+        if ((owned.size() == 2) && (view.size() == 2)) {
+            CHECK((owned.front() == "A=abc") && (owned.back() == "B=x\x01"));
+            CHECK((view.front() == "A=abc") && (view.back() == "B=x\x01"));
+        }
+    }
+
+}
+
+int main() {
+    CHECK(useTextKernels(TextKernels::Scalar));
+    CHECK(useTextKernels(TextKernels::Best));
+    knownAnswers();
+    invalidAtEveryOffset();
+    vectorSetsMatchScalar();
+    truncatedFrame();
+    return check::result();
+}
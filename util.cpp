@@ -1,73 +1,512 @@
 #include "util.hpp"
+#include <string.h>
+#include <algorithm>
+#include <optional>
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
 
 using namespace util;
 
-std::string util::utf16ToUtf8(char* str, size_t n) {
-    if (n % 2) {
-        return "";
+namespace {
+
+    template<bool BigEndian>
+    inline uint16_t loadUtf16(const uint8_t* p) {
+        if constexpr (BigEndian) {
+            return ((uint16_t)p[0] << 8) | p[1];
+        }
+        else {
+            return p[0] | ((uint16_t)p[1] << 8);
+        }
     }
-    std::string res;
-    for (size_t i = 0; i < n; i += 2, str += 2) {
-        uint32_t codePoint = *(uint16_t*)(str);
-        if (codePoint <= 0x7f) {
-            res += codePoint;
-        }
-        else if (codePoint <= 0x7ff) {
-            uint16_t ch = 0b1000000011000000;
-            ch |= (codePoint & 0b11111000000) >> 6;
-            ch |= (codePoint & 0b111111) << 8;
-            res.append((char*)&ch, 2);
-        }
-        else if ((codePoint >= 0x800 && codePoint <= 0xd7ff) || (codePoint >= 0xe000 && codePoint <= 0xffff)) {
-            uint32_t ch = 0b00000000100000001000000011100000;
-            ch |= (codePoint & 0b1111000000000000) >> 12;
-            ch |= (codePoint & 0b111111000000) << 2;
-            ch |= (codePoint & 0b00111111) << 16;
-            res.append(((char*)&ch), 3);
-        }
-        // surrogates - decoding 4 bytes
-        else if (codePoint >= 0xd800 && codePoint <= 0xdfff) {
-            if ((n - i) < 4) {
-                return "";
-            }
-            uint16_t codePointP1 = codePoint - 0xd800;
-            str += 2;
-            i += 2;
-            uint16_t codePointP2 = *(uint16_t*)(str);
-            if (codePointP2 < 0xdc00) {
-                return "";
+
+    /*
+        Vector kernels. Each set works on whole vectors only, leaving the tail to scalar code.
+        utf16AsciiRun - converts leading UTF-16 code units while whole vectors of them are ASCII, returns their number
+        asciiPrefix - returns length of leading bytes, which are ASCII
+        countHighBytes - returns number of bytes >= 0x80
+        validateUtf8 - returns number of bytes, checked to be valid UTF-8 (it ends on character boundary), or npos on error
+    */
+    struct Kernels {
+        size_t (*utf16AsciiRun)(const uint8_t* src, size_t units, char* dst, bool bigEndian);
+        size_t (*asciiPrefix)(const uint8_t* src, size_t n);
+        size_t (*countHighBytes)(const uint8_t* src, size_t n);
+        size_t (*validateUtf8)(const uint8_t* src, size_t n);
+    };
+
+    constexpr size_t npos = (size_t)-1;
+
+    size_t utf16AsciiRunScalar(const uint8_t* src, size_t units, char* dst, bool bigEndian) {
+        size_t i = 0;
+        for (; i < units; ++i) {
+            uint16_t unit = bigEndian ? loadUtf16<true>(src + 2 * i) : loadUtf16<false>(src + 2 * i);
+            if (unit > 0x7f) {
+                break;
             }
-            codePointP2 -= 0xdc00;
-            codePoint = ((uint32_t)0x10000 | (codePointP1 << 10)) | codePointP2;
-            uint32_t ch = 0b10000000100000001000000011110000;
-            ch |= (codePoint & 0b111000000000000000000) >> 18;
-            ch |= (codePoint & 0b111111000000000000) >> 4;
-            ch |= (codePoint & 0b111111000000) << 10;
-            ch |= (codePoint & 0b111111) << 24;
-            res.append((char*)&ch, 4);
+            dst[i] = (char)unit;
+        }
+        return i;
+    }
+
+    size_t asciiPrefixScalar(const uint8_t* src, size_t n) {
+        size_t i = 0;
+        while ((i < n) && (src[i] < 0x80)) {
+            ++i;
+        }
+        return i;
+    }
+
+    size_t countHighBytesScalar(const uint8_t* src, size_t n) {
+        size_t res = 0;
+        for (size_t i = 0; i < n; ++i) {
+            res += src[i] >> 7;
+        }
+        return res;
+    }
+
+    // returns length of valid character at str or 0 if it is invalid (overlong, surrogate, > U+10FFFF, truncated)
+    size_t utf8CharLen(const uint8_t* str, size_t n) {
+        uint8_t b0 = str[0];
+        if (b0 < 0x80) {
+            return 1;
+        }
+        size_t len = 0;
+        // bounds of second byte - they exclude overlongs, surrogates and too big code points
+        uint8_t lo = 0x80, hi = 0xbf;
+        if (b0 >= 0xc2 && b0 <= 0xdf) {
+            len = 2;
+        }
+        else if (b0 >= 0xe0 && b0 <= 0xef) {
+            len = 3;
+            lo = (b0 == 0xe0) ? 0xa0 : 0x80;
+            hi = (b0 == 0xed) ? 0x9f : 0xbf;
+        }
+        else if (b0 >= 0xf0 && b0 <= 0xf4) {
+            len = 4;
+            lo = (b0 == 0xf0) ? 0x90 : 0x80;
+            hi = (b0 == 0xf4) ? 0x8f : 0xbf;
         }
         else {
-            return "";
+            return 0;
+        }
+        if (n < len || str[1] < lo || str[1] > hi) {
+            return 0;
+        }
+        for (size_t i = 2; i < len; ++i) {
+            if ((str[i] & 0b11000000) != 0b10000000) {
+                return 0;
+            }
+        }
+        return len;
+    }
+
+    size_t validateUtf8Scalar(const uint8_t* src, size_t n) {
+        size_t i = 0;
+        while (i < n) {
+            i += asciiPrefixScalar(src + i, n - i);
+            if (i == n) {
+                break;
+            }
+            size_t len = utf8CharLen(src + i, n - i);
+            if (!len) {
+                return npos;
+            }
+            i += len;
+        }
+        return i;
+    }
+
+#if defined(SIMD_X86)
+    size_t utf16AsciiRunSse2(const uint8_t* src, size_t units, char* dst, bool bigEndian) {
+        const __m128i nonAscii = _mm_set1_epi16((short)0xff80);
+        const __m128i zero = _mm_setzero_si128();
+        size_t i = 0;
+        for (; (i + 16) <= units; i += 16) {
+            __m128i lo = _mm_loadu_si128((const __m128i*)(src + 2 * i));
+            __m128i hi = _mm_loadu_si128((const __m128i*)(src + 2 * i + 16));
+            if (bigEndian) {
+                lo = _mm_or_si128(_mm_slli_epi16(lo, 8), _mm_srli_epi16(lo, 8));
+                hi = _mm_or_si128(_mm_slli_epi16(hi, 8), _mm_srli_epi16(hi, 8));
+            }
+            __m128i any = _mm_and_si128(_mm_or_si128(lo, hi), nonAscii);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(any, zero)) != 0xffff) {
+                break;
+            }
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+        }
+        return i;
+    }
+
+    size_t asciiPrefixSse2(const uint8_t* src, size_t n) {
+        size_t i = 0;
+        for (; (i + 16) <= n; i += 16) {
+            if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(src + i)))) {
+                break;
+            }
+        }
+        return i + asciiPrefixScalar(src + i, std::min<size_t>(n - i, 16));
+    }
+
+    size_t countHighBytesSse2(const uint8_t* src, size_t n) {
+        size_t res = 0;
+        size_t i = 0;
+        for (; (i + 16) <= n; i += 16) {
+            res += __builtin_popcount(_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(src + i))));
+        }
+        return res + countHighBytesScalar(src + i, n - i);
+    }
+
+    __attribute__((target("sse4.1")))
+    size_t utf16AsciiRunSse41(const uint8_t* src, size_t units, char* dst, bool bigEndian) {
+        const __m128i nonAscii = _mm_set1_epi16((short)0xff80);
+        const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+        size_t i = 0;
+        for (; (i + 16) <= units; i += 16) {
+            __m128i lo = _mm_loadu_si128((const __m128i*)(src + 2 * i));
+            __m128i hi = _mm_loadu_si128((const __m128i*)(src + 2 * i + 16));
+            if (bigEndian) {
+                lo = _mm_shuffle_epi8(lo, swap);
+                hi = _mm_shuffle_epi8(hi, swap);
+            }
+            if (!_mm_testz_si128(_mm_or_si128(lo, hi), nonAscii)) {
+                break;
+            }
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+        }
+        return i;
+    }
+
+    /*
+        UTF-8 validation by lookup tables (Keiser, Lemire: "Validating UTF-8 in less than one instruction per byte").
+        Error classes of (previous byte, current byte) pairs are looked up by high nibble of previous byte,
+        low nibble of previous byte and high nibble of current byte; pair is invalid if all three lookups share a bit.
+        Checks of 3rd and 4th bytes of a character are done separately.
+    */
+    namespace utf8tables {
+        constexpr uint8_t TooShort = 1 << 0;
+        constexpr uint8_t TooLong = 1 << 1;
+        constexpr uint8_t Overlong3 = 1 << 2;
+        constexpr uint8_t TooLarge = 1 << 3;
+        constexpr uint8_t Surrogate = 1 << 4;
+        constexpr uint8_t Overlong2 = 1 << 5;
+        constexpr uint8_t TooLarge1000 = 1 << 6;
+        constexpr uint8_t Overlong4 = 1 << 6;
+        constexpr uint8_t TwoConts = 1 << 7;
+        constexpr uint8_t Carry = TooShort | TooLong | TwoConts;
+
+        constexpr uint8_t Byte1High[16] = {
+            // 0_______ - ASCII
+            TooLong, TooLong, TooLong, TooLong, TooLong, TooLong, TooLong, TooLong,
+            // 10______ - continuation
+            TwoConts, TwoConts, TwoConts, TwoConts,
+            // 1100____, 1101____ - 2 byte lead
+            TooShort | Overlong2,
+            TooShort,
+            // 1110____ - 3 byte lead
+            TooShort | Overlong3 | Surrogate,
+            // 1111____ - 4 byte lead
+            TooShort | TooLarge | TooLarge1000 | Overlong4
+        };
+        constexpr uint8_t Byte1Low[16] = {
+            Carry | Overlong3 | Overlong2 | Overlong4,
+            Carry | Overlong2,
+            Carry,
+            Carry,
+            Carry | TooLarge,
+            Carry | TooLarge | TooLarge1000,
+            Carry | TooLarge | TooLarge1000,
+            Carry | TooLarge | TooLarge1000,
+            Carry | TooLarge | TooLarge1000,
+            Carry | TooLarge | TooLarge1000,
+            Carry | TooLarge | TooLarge1000,
+            Carry | TooLarge | TooLarge1000,
+            Carry | TooLarge | TooLarge1000,
+            Carry | TooLarge | TooLarge1000 | Surrogate,
+            Carry | TooLarge | TooLarge1000,
+            Carry | TooLarge | TooLarge1000
+        };
+        constexpr uint8_t Byte2High[16] = {
+            // ________ 0_______
+            TooShort, TooShort, TooShort, TooShort, TooShort, TooShort, TooShort, TooShort,
+            // ________ 1000____
+            TooLong | Overlong2 | TwoConts | Overlong3 | TooLarge1000 | Overlong4,
+            // ________ 1001____
+            TooLong | Overlong2 | TwoConts | Overlong3 | TooLarge,
+            // ________ 101_____
+            TooLong | Overlong2 | TwoConts | Surrogate | TooLarge,
+            TooLong | Overlong2 | TwoConts | Surrogate | TooLarge,
+            // ________ 11______
+            TooShort, TooShort, TooShort, TooShort
+        };
+    }
+
+    // validates vectors and returns offset of the first byte, which was not validated (it is a character boundary)
+    __attribute__((target("sse4.1")))
+    size_t validateUtf8Sse41(const uint8_t* src, size_t n) {
+        using namespace utf8tables;
+        const __m128i byte1High = _mm_loadu_si128((const __m128i*)Byte1High);
+        const __m128i byte1Low = _mm_loadu_si128((const __m128i*)Byte1Low);
+        const __m128i byte2High = _mm_loadu_si128((const __m128i*)Byte2High);
+        const __m128i nibble = _mm_set1_epi8(0x0f);
+        // lead bytes in last 3 positions of a vector, which need more bytes, than remain in it
+        const __m128i incompleteMax = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, (char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1));
+        __m128i prev = _mm_setzero_si128();
+        __m128i prevIncomplete = _mm_setzero_si128();
+        __m128i error = _mm_setzero_si128();
+        size_t i = 0;
+        for (; (i + 16) <= n; i += 16) {
+            __m128i input = _mm_loadu_si128((const __m128i*)(src + i));
+            if (!_mm_movemask_epi8(input)) {
+                // ASCII - only previous vector may be unfinished
+                error = _mm_or_si128(error, prevIncomplete);
+                prevIncomplete = _mm_setzero_si128();
+                prev = input;
+                continue;
+            }
+            __m128i prev1 = _mm_alignr_epi8(input, prev, 16 - 1);
+            __m128i special = _mm_and_si128(
+                _mm_and_si128(
+                    _mm_shuffle_epi8(byte1High, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+                    _mm_shuffle_epi8(byte1Low, _mm_and_si128(prev1, nibble))),
+                _mm_shuffle_epi8(byte2High, _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+            __m128i prev2 = _mm_alignr_epi8(input, prev, 16 - 2);
+            __m128i prev3 = _mm_alignr_epi8(input, prev, 16 - 3);
+            // only 111_____ and 1111____ give results with high bit set
+            __m128i must23 = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xe0 - 0x80))), _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xf0 - 0x80))));
+            __m128i must23With80 = _mm_and_si128(must23, _mm_set1_epi8((char)0x80));
+            error = _mm_or_si128(error, _mm_xor_si128(must23With80, special));
+            prevIncomplete = _mm_subs_epu8(input, incompleteMax);
+            prev = input;
+        }
+        if (!_mm_testz_si128(error, error)) {
+            return npos;
+        }
+        // last character of checked part may be unfinished - stepping back to its lead byte
+        for (size_t back = 1; (back <= 3) && (back <= i); ++back) {
+            uint8_t byte = src[i - back];
+            if (byte >= 0xc0) {
+                return i - back;
+            }
+            if (byte < 0x80) {
+                break;
+            }
+        }
+        return i;
+    }
+
+    __attribute__((target("avx2")))
+    size_t utf16AsciiRunAvx2(const uint8_t* src, size_t units, char* dst, bool bigEndian) {
+        const __m256i nonAscii = _mm256_set1_epi16((short)0xff80);
+        const __m256i swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                              1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+        size_t i = 0;
+        for (; (i + 32) <= units; i += 32) {
+            __m256i lo = _mm256_loadu_si256((const __m256i*)(src + 2 * i));
+            __m256i hi = _mm256_loadu_si256((const __m256i*)(src + 2 * i + 32));
+            if (bigEndian) {
+                lo = _mm256_shuffle_epi8(lo, swap);
+                hi = _mm256_shuffle_epi8(hi, swap);
+            }
+            if (!_mm256_testz_si256(_mm256_or_si256(lo, hi), nonAscii)) {
+                break;
+            }
+            // packus works inside of 128 bit lanes - restoring order of 64 bit parts
+            __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0b11011000);
+            _mm256_storeu_si256((__m256i*)(dst + i), packed);
+        }
+        // tail, shorter than one AVX2 step
+        return i + utf16AsciiRunSse41(src + 2 * i, units - i, dst + i, bigEndian);
+    }
+
+    __attribute__((target("avx2")))
+    size_t asciiPrefixAvx2(const uint8_t* src, size_t n) {
+        size_t i = 0;
+        for (; (i + 32) <= n; i += 32) {
+            if (_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)(src + i)))) {
+                break;
+            }
+        }
+        return i + asciiPrefixSse2(src + i, std::min<size_t>(n - i, 32));
+    }
+
+    __attribute__((target("avx2,popcnt")))
+    size_t countHighBytesAvx2(const uint8_t* src, size_t n) {
+        size_t res = 0;
+        size_t i = 0;
+        for (; (i + 32) <= n; i += 32) {
+            res += __builtin_popcount((uint32_t)_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)(src + i))));
+        }
+        return res + countHighBytesSse2(src + i, n - i);
+    }
+#endif
+
+    // nullopt - set is not supported by CPU (or by build)
+    std::optional<Kernels> selectKernels(TextKernels set) {
+        constexpr Kernels Scalar = {utf16AsciiRunScalar, asciiPrefixScalar, countHighBytesScalar, validateUtf8Scalar};
+#if defined(SIMD_X86)
+        __builtin_cpu_init();
+        bool avx2 = __builtin_cpu_supports("avx2");
+        bool sse41 = __builtin_cpu_supports("sse4.1");
+        if (set == TextKernels::Best) {
+            set = avx2 ? TextKernels::Avx2 : (sse41 ? TextKernels::Sse41 : TextKernels::Sse2);
+        }
+        switch (set) {
+        case TextKernels::Avx2:
+            return avx2 ? std::optional<Kernels>(Kernels{utf16AsciiRunAvx2, asciiPrefixAvx2, countHighBytesAvx2, validateUtf8Sse41}) : std::nullopt;
+        case TextKernels::Sse41:
+            return sse41 ? std::optional<Kernels>(Kernels{utf16AsciiRunSse41, asciiPrefixSse2, countHighBytesSse2, validateUtf8Sse41}) : std::nullopt;
+        // SSE2 is always available on x86-64
+        case TextKernels::Sse2:
+            return Kernels{utf16AsciiRunSse2, asciiPrefixSse2, countHighBytesSse2, validateUtf8Scalar};
+        default:
+            return Scalar;
+        }
+#else
+        if ((set == TextKernels::Best) || (set == TextKernels::Scalar)) {
+            return Scalar;
+        }
+        return std::nullopt;
+#endif
+    }
+
+    Kernels kernels = *selectKernels(TextKernels::Best);
+
+    template<bool BigEndian>
+    std::string utf16ToUtf8Impl(const uint8_t* str, size_t n) {
+        size_t units = n / 2;
+        // 3 bytes per code unit at most (surrogate pair - 4 bytes per 2 code units)
+        std::string res(units * 3, '\0');
+        char* out = res.data();
+        size_t i = 0;
+        while (i < units) {
+            size_t converted = kernels.utf16AsciiRun(str + 2 * i, units - i, out, BigEndian);
+            i += converted;
+            out += converted;
+            // scalar code until next ASCII character, which may start next vector run
+            for (; i < units; ++i) {
+                uint32_t codePoint = loadUtf16<BigEndian>(str + 2 * i);
+                if (codePoint <= 0x7f) {
+                    *out++ = (char)codePoint;
+                    ++i;
+                    break;
+                }
+                else if (codePoint <= 0x7ff) {
+                    *out++ = (char)(0b11000000 | (codePoint >> 6));
+                    *out++ = (char)(0b10000000 | (codePoint & 0b111111));
+                }
+                else if (codePoint < 0xd800 || codePoint > 0xdfff) {
+                    *out++ = (char)(0b11100000 | (codePoint >> 12));
+                    *out++ = (char)(0b10000000 | ((codePoint >> 6) & 0b111111));
+                    *out++ = (char)(0b10000000 | (codePoint & 0b111111));
+                }
+                // surrogates - decoding 4 bytes
+                else {
+                    if ((codePoint > 0xdbff) || ((i + 1) >= units)) {
+                        return "";
+                    }
+                    uint32_t codePointP2 = loadUtf16<BigEndian>(str + 2 * (i + 1));
+                    if (codePointP2 < 0xdc00 || codePointP2 > 0xdfff) {
+                        return "";
+                    }
+                    ++i;
+                    codePoint = 0x10000 + (((codePoint - 0xd800) << 10) | (codePointP2 - 0xdc00));
+                    *out++ = (char)(0b11110000 | (codePoint >> 18));
+                    *out++ = (char)(0b10000000 | ((codePoint >> 12) & 0b111111));
+                    *out++ = (char)(0b10000000 | ((codePoint >> 6) & 0b111111));
+                    *out++ = (char)(0b10000000 | (codePoint & 0b111111));
+                }
+            }
+        }
+        res.resize(out - res.data());
+        return res;
+    }
+
+}
+
+std::string util::utf16ToUtf8(const char* str, size_t n, bool bigEndian) {
+    if (n % 2) {
+        return "";
+    }
+    return bigEndian ? utf16ToUtf8Impl<true>((const uint8_t*)str, n) : utf16ToUtf8Impl<false>((const uint8_t*)str, n);
+}
+
+// ISO-8859-1: every byte >= 0x80 becomes 2 bytes, so exact size of result is known before conversion
+std::string util::asciiToUtf8(const char* str, size_t n) {
+    const uint8_t* src = (const uint8_t*)str;
+    size_t highBytes = kernels.countHighBytes(src, n);
+    if (!highBytes) {
+        return std::string(str, n);
+    }
+    std::string res(n + highBytes, '\0');
+    char* out = res.data();
+    size_t i = 0;
+    while (i < n) {
+        size_t ascii = kernels.asciiPrefix(src + i, n - i);
+        memcpy(out, src + i, ascii);
+        i += ascii;
+        out += ascii;
+        for (; (i < n) && (src[i] >= 0x80); ++i) {
+            *out++ = (char)(0b11000000 | (src[i] >> 6));
+            *out++ = (char)(0b10000000 | (src[i] & 0b111111));
         }
     }
     return res;
 }
 
-std::string util::asciiToUtf8(char* str, size_t n) {
-    std::string res;
-    for (size_t i = 0; i < n; ++i, ++str) {
-        uint16_t codePoint = *(uint8_t*)(str);
-        if (codePoint <= 0x7f) {
-            res += codePoint;
+bool util::useTextKernels(TextKernels set) {
+    std::optional<Kernels> selected = selectKernels(set);
+    if (!selected) {
+        return false;
+    }
+    kernels = *selected;
+    return true;
+}
+
+bool util::isAscii(const char* str, size_t n) {
+    return kernels.asciiPrefix((const uint8_t*)str, n) == n;
+}
+
+bool util::isValidUtf8(const char* str, size_t n) {
+    const uint8_t* src = (const uint8_t*)str;
+    size_t i = kernels.validateUtf8(src, n);
+    if (i == npos) {
+        return false;
+    }
+    while (i < n) {
+        i += kernels.asciiPrefix(src + i, n - i);
+        if (i == n) {
+            break;
+        }
+        size_t len = utf8CharLen(src + i, n - i);
+        if (!len) {
+            return false;
         }
-        else if (codePoint <= 0xff) {
-            uint16_t ch = 0b1000000011000000;
-            ch |= (codePoint & 0b11111000000) >> 6;
-            ch |= (codePoint & 0b111111) << 8;
-            res.append((char*)&ch, 2);
+        i += len;
+    }
+    return true;
+}
+
+std::string util::validUtf8(const char* str, size_t n, bool replace) {
+    if (isValidUtf8(str, n)) {
+        return std::string(str, n);
+    }
+    if (!replace) {
+        return "";
+    }
+    // slow path - only for broken strings
+    const uint8_t* src = (const uint8_t*)str;
+    std::string res;
+    res.reserve(n + n / 2);
+    for (size_t i = 0; i < n;) {
+        if (size_t len = utf8CharLen(src + i, n - i)) {
+            res.append(str + i, len);
+            i += len;
         }
         else {
-            return "";
+            // U+FFFD REPLACEMENT CHARACTER for each invalid byte
+            res.append("\xef\xbf\xbd");
+            ++i;
         }
     }
     return res;
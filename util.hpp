@@ -40,11 +40,35 @@ namespace util {
         }
     }
 
-    std::string utf16ToUtf8(char* str, size_t n);
-    std::string asciiToUtf8(char* str, size_t n);
+    // ID3v2 sizes: 7 bits in every byte, highest bit is always 0
+    inline uint32_t syncSafe(uint32_t n) {
+        return (n & 0b01111111) | ((n & (0b01111111 << 8)) >> 1) | ((n & (0b01111111 << 16)) >> 2) | ((n & (0b01111111 << 24)) >> 3);
+    }
+
+    // SIMD fast path for ASCII runs; endianness of input is handled while loading, input is not modified
+    std::string utf16ToUtf8(const char* str, size_t n, bool bigEndian = false);
+    // ISO-8859-1 to UTF-8
+    std::string asciiToUtf8(const char* str, size_t n);
+    bool isValidUtf8(const char* str, size_t n);
+    // no bytes >= 0x80 - same in ISO-8859-1 and UTF-8
+    bool isAscii(const char* str, size_t n);
+    // returns copy of valid UTF-8 string; invalid bytes are replaced with U+FFFD or, if replace is false, empty string is returned
+    std::string validUtf8(const char* str, size_t n, bool replace = true);
     std::basic_string<char16_t> utf8ToUtf16(char* str, size_t n);
     std::string utf8ToAscii(char* str, size_t n);
 
+    // vector code of text functions above; best set, which CPU supports, is used by default
+    enum class TextKernels : uint8_t {
+        Best,
+        // reference code - results of all sets must be the same
+        Scalar,
+        Sse2,
+        Sse41,
+        Avx2
+    };
+    // false, if CPU does not support the set - current one is kept; not thread safe - for tests and benchmarks, before parsing
+    bool useTextKernels(TextKernels set);
+
 }
 
 #endif // UTIL_HPP